@@ -0,0 +1,162 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+
+namespace rtree
+{
+    // Aggregate policies tell what every node of a tree keeps about the entries of its subtree.
+    // Besides the number of entries a policy keeps a value: value of a single entry is of(data),
+    // value of no entries is identity() and values of disjoint sets of entries are merged by combine().
+    // Values depend on ids only, so moving entries to other boxes never changes them.
+    // Weight is a default-constructible function object that gives the weight of an id.
+    // Weights that change are either carried by the ids themselves (see Prioritized) or read elsewhere,
+    // then Tree::setWeight() has to be called for the id to refresh the values of its ancestors
+
+    // Nodes keep nothing, the default
+    struct NoAggregate {};
+
+    // Nodes keep the number of entries only
+    struct CountAggregate
+    {
+        struct value_type
+        {
+            bool operator==(const value_type&) const { return true; }
+        };
+
+        template<typename DataType>
+        static value_type of(const DataType&) { return {}; }
+        static value_type identity() { return {}; }
+        static value_type combine(const value_type&, const value_type&) { return {}; }
+    };
+
+    // Nodes keep the sum of weights of their entries
+    template<typename Weight, typename Value = double>
+    struct SumAggregate
+    {
+        using value_type = Value;
+
+        template<typename DataType>
+        static value_type of(const DataType& data) { return Value(Weight()(data)); }
+        static value_type identity() { return Value(); }
+        static value_type combine(const value_type& l, const value_type& r) { return l + r; }
+    };
+
+    // Nodes keep the smallest weight of their entries, identity() is the largest value
+    template<typename Weight, typename Value = double>
+    struct MinAggregate
+    {
+        using value_type = Value;
+
+        template<typename DataType>
+        static value_type of(const DataType& data) { return Value(Weight()(data)); }
+        static value_type identity()
+        {
+            return std::numeric_limits<Value>::has_infinity ? std::numeric_limits<Value>::infinity() : std::numeric_limits<Value>::max();
+        }
+        static value_type combine(const value_type& l, const value_type& r) { return std::min(l, r); }
+    };
+
+    // Nodes keep the largest weight of their entries, identity() is the smallest value
+    template<typename Weight, typename Value = double>
+    struct MaxAggregate
+    {
+        using value_type = Value;
+
+        template<typename DataType>
+        static value_type of(const DataType& data) { return Value(Weight()(data)); }
+        static value_type identity()
+        {
+            return std::numeric_limits<Value>::has_infinity ? -std::numeric_limits<Value>::infinity() : std::numeric_limits<Value>::lowest();
+        }
+        static value_type combine(const value_type& l, const value_type& r) { return std::max(l, r); }
+    };
+
+
+    // Whether the value a node keeps is the largest value of any entry below it, which best-first search relies on
+    template<typename Aggregate>
+    struct IsMaxAggregate : std::false_type {};
+
+    template<typename Weight, typename Value>
+    struct IsMaxAggregate<MaxAggregate<Weight, Value>> : std::true_type {};
+
+
+    // Id that carries the priority of its entry, so the priority is given with the entry on insertion
+    // and moves with it through splits and reinsertions. Ids are compared and hashed by id alone,
+    // so an entry is found and removed whatever priority is passed with its id
+    template<typename Id, typename Priority = double>
+    struct Prioritized
+    {
+        Id id;
+        Priority priority;
+
+        bool operator==(const Prioritized& other) const { return id == other.id; }
+        bool operator!=(const Prioritized& other) const { return !(*this == other); }
+        std::string toString() const
+        {
+            if constexpr (std::is_integral<Id>::value) {
+                return std::to_string(id);
+            }
+            else {
+                return id.toString();
+            }
+        }
+    };
+
+    struct PriorityOf
+    {
+        template<typename Id, typename Priority>
+        Priority operator()(const Prioritized<Id, Priority>& data) const { return data.priority; }
+    };
+
+    // Nodes keep the largest priority of their Prioritized ids
+    template<typename Priority = double>
+    using PriorityAggregate = MaxAggregate<PriorityOf, Priority>;
+
+
+    // Number of entries of a subtree and their combined value
+    template<typename Aggregate>
+    struct SubtreeAggregate
+    {
+        using value_type = typename Aggregate::value_type;
+
+        std::size_t count = 0;
+        value_type value = Aggregate::identity();
+
+        template<typename DataType>
+        static SubtreeAggregate of(const DataType& data) { return { 1, Aggregate::of(data) }; }
+
+        void add(const SubtreeAggregate& other)
+        {
+            count += other.count;
+            value = Aggregate::combine(value, other.value);
+        }
+        bool operator==(const SubtreeAggregate& other) const { return count == other.count && value == other.value; }
+        bool operator!=(const SubtreeAggregate& other) const { return !(*this == other); }
+    };
+
+    template<>
+    struct SubtreeAggregate<NoAggregate>
+    {
+        template<typename DataType>
+        static SubtreeAggregate of(const DataType&) { return {}; }
+
+        void add(const SubtreeAggregate&) {}
+        bool operator==(const SubtreeAggregate&) const { return true; }
+        bool operator!=(const SubtreeAggregate&) const { return false; }
+    };
+} // namespace rtree
+
+
+namespace std
+{
+    template<typename Id, typename Priority>
+    struct hash<rtree::Prioritized<Id, Priority>>
+    {
+        size_t operator()(const rtree::Prioritized<Id, Priority>& data) const { return hash<Id>()(data.id); }
+    };
+} // namespace std
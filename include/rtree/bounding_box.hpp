@@ -0,0 +1,172 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+
+namespace rtree
+{
+    template<typename Coord>
+    struct BasicPoint
+    {
+        Coord x;
+        Coord y;
+
+        const BasicPoint operator+(const BasicPoint& other) const { return BasicPoint{ .x=x+other.x, .y=y+other.y }; }
+        const BasicPoint operator-(const BasicPoint& other) const { return BasicPoint{ .x=x-other.x, .y=y-other.y }; }
+        const BasicPoint operator*(Coord val) const { return BasicPoint{ .x=x*val, .y=y*val }; }
+        const BasicPoint operator/(Coord val) const { return BasicPoint{ .x=x/val, .y=y/val }; }
+    };
+
+    using Point = BasicPoint<double>;
+
+
+    /**
+     * Type that holds area of a box without loss: 64-bit integer for integral coordinates,
+     * the coordinate type itself for floating point ones
+     */
+    template<typename Coord>
+    using area_t = std::conditional_t<std::is_integral<Coord>::value, std::int64_t, Coord>;
+
+
+    template<typename Coord>
+    class BasicBoundingBox
+    {
+    public:
+        using coord_type = Coord;
+        using area_type = area_t<Coord>;
+        using point_type = BasicPoint<Coord>;
+
+        BasicBoundingBox() : empty(true) {}
+        BasicBoundingBox(Coord _x, Coord _y, Coord _w, Coord _h)
+            : x(_x), y(_y), w(_w), h(_h), empty(false) {}
+
+        const point_type bl() const { return point_type{ .x=std::min<Coord>(x, x+w), .y=std::min<Coord>(y, y+h) }; }
+        const point_type tr() const { return point_type{ .x=std::max<Coord>(x, x+w), .y=std::max<Coord>(y, y+h) }; }
+        const point_type center() const { return (bl() + tr()) / 2; }
+
+        bool isEmpty() const { return empty; }
+        area_type area() const { return empty ? 0 : area_type(h) * w; } //TODO: rework to be able to work with negative width and height
+        area_type margin() const { return empty ? 0 : area_type(std::abs(w)) + std::abs(h); }
+        double distance(const BasicBoundingBox& other) const;
+        /**
+         * Squared distance from p to the closest point of the box (MINDIST), 0 if p is inside.
+         * Empty box is infinitely far from any point
+         */
+        double squaredDistance(const point_type& p) const;
+        bool intersects(const BasicBoundingBox& other) const;
+        bool overlaps(const BasicBoundingBox& other) const;
+
+        bool operator==(const BasicBoundingBox& other) const;
+        bool operator!=(const BasicBoundingBox& other) const { return !(*this == other); }
+        const BasicBoundingBox operator&(const BasicBoundingBox& other) const;
+        const BasicBoundingBox operator|(const BasicBoundingBox& other) const;
+
+        Coord x;
+        Coord y;
+        Coord w;
+        Coord h;
+
+    private:
+        bool empty;
+    };
+
+    using BoundingBox = BasicBoundingBox<double>;
+
+    template<typename Coord>
+    double BasicBoundingBox<Coord>::distance(const BasicBoundingBox& other) const
+    {
+        if (isEmpty() || other.isEmpty()) {
+            return 0.0;
+        }
+        // Gap between the boxes along each axis, negative gaps mean that projections overlap
+        const auto lo = bl();
+        const auto hi = tr();
+        const auto otherLo = other.bl();
+        const auto otherHi = other.tr();
+        const double dx = std::max({ double(otherLo.x) - hi.x, double(lo.x) - otherHi.x, 0.0 });
+        const double dy = std::max({ double(otherLo.y) - hi.y, double(lo.y) - otherHi.y, 0.0 });
+        return std::sqrt(dx * dx + dy * dy);
+    }
+
+    template<typename Coord>
+    double BasicBoundingBox<Coord>::squaredDistance(const point_type& p) const
+    {
+        if (isEmpty()) {
+            return std::numeric_limits<double>::infinity();
+        }
+        const auto lo = bl();
+        const auto hi = tr();
+        const double dx = std::max({ double(lo.x) - p.x, 0.0, double(p.x) - hi.x });
+        const double dy = std::max({ double(lo.y) - p.y, 0.0, double(p.y) - hi.y });
+        return dx * dx + dy * dy;
+    }
+
+    template<typename Coord>
+    bool BasicBoundingBox<Coord>::intersects(const BasicBoundingBox& other) const
+    {
+        if (isEmpty() || other.isEmpty()) {
+            return false;
+        }
+        const auto interLeft = std::max(bl().x, other.bl().x);
+        const auto interRight = std::min(tr().x, other.tr().x);
+        const auto interBottom = std::max(bl().y, other.bl().y);
+        const auto interTop = std::min(tr().y, other.tr().y);
+        return interLeft <= interRight && 
+            interBottom <= interTop;
+    }
+
+    template<typename Coord>
+    bool BasicBoundingBox<Coord>::overlaps(const BasicBoundingBox& other) const
+    {
+        if (isEmpty() || other.isEmpty()) {
+            return false;
+        }
+        return (*this & other) == *this; 
+    }
+
+    template<typename Coord>
+    bool BasicBoundingBox<Coord>::operator==(const BasicBoundingBox& other) const
+    {
+        if (isEmpty() || other.isEmpty()) {
+            return false;
+        }
+        return x == other.x && y == other.y && w == other.w && h == other.h;
+    }
+
+    template<typename Coord>
+    const BasicBoundingBox<Coord> BasicBoundingBox<Coord>::operator&(const BasicBoundingBox& other) const
+    {
+        if (isEmpty()) {
+            return other;
+        }
+        else if (other.isEmpty()) {
+            return *this;
+        }
+        //TODO: rework to be able to work with negative width and height
+        const auto minX = std::min(x, other.x);
+        const auto minY = std::min(y, other.y);
+        const auto maxX = std::max(x + w, other.x + other.w);
+        const auto maxY = std::max(y + h, other.y + other.h);
+        return BasicBoundingBox(minX, minY, maxX-minX, maxY-minY);
+    }
+
+    template<typename Coord>
+    const BasicBoundingBox<Coord> BasicBoundingBox<Coord>::operator|(const BasicBoundingBox& other) const
+    {
+        if (isEmpty() || other.isEmpty()) {
+            return BasicBoundingBox();
+        }
+
+        const auto interLeft = std::max(bl().x, other.bl().x);
+        const auto interRight = std::min(tr().x, other.tr().x);
+        const auto interBottom = std::max(bl().y, other.bl().y);
+        const auto interTop = std::min(tr().y, other.tr().y);
+        if (interLeft <= interRight && interBottom <= interTop) {
+            return BasicBoundingBox(interLeft, interBottom, interRight - interLeft, interTop - interBottom);
+        }
+        return BasicBoundingBox();
+    }
+} // namespace rtree
\ No newline at end of file
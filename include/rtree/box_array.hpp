@@ -0,0 +1,126 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "bounding_box.hpp"
+#include "simd.hpp"
+#include "static_vector.hpp"
+
+
+namespace rtree
+{
+    // Bounding boxes of node entries or children kept as separate arrays of bounds,
+    // so that all of them can be tested against a query box in one SIMD kernel.
+    // Bounds are normalized, empty box is stored as an inverted one that intersects nothing.
+    template<size_t Capacity = DynamicCapacity, typename Coord = double>
+    class BoxArray
+    {
+    public:
+        using box_type = BasicBoundingBox<Coord>;
+
+        void clear();
+        void push_back(const box_type& box);
+        void pop_back();
+        void set(size_t i, const box_type& box);
+        size_t size() const { return _minX.size(); }
+
+        /**
+         * Call visitor with index of every box intersected by b.
+         * Visitor returning false stops the iteration, in this case false is returned
+         */
+        template<typename Visitor>
+        bool forEachIntersecting(const box_type& b, Visitor&& visitor) const;
+        /**
+         * Find index of the box whose area will be increased as little as possible after extending it with b
+         */
+        size_t leastGrowth(const box_type& b) const;
+
+    private:
+        static simd::Query<Coord> toQuery(const box_type& b);
+
+        NodeStorage<Coord, Capacity> _minX;
+        NodeStorage<Coord, Capacity> _minY;
+        NodeStorage<Coord, Capacity> _maxX;
+        NodeStorage<Coord, Capacity> _maxY;
+    };
+
+
+    template<size_t Capacity, typename Coord>
+    void BoxArray<Capacity, Coord>::clear()
+    {
+        _minX.clear();
+        _minY.clear();
+        _maxX.clear();
+        _maxY.clear();
+    }
+
+    template<size_t Capacity, typename Coord>
+    void BoxArray<Capacity, Coord>::push_back(const box_type& box)
+    {
+        const auto q = toQuery(box);
+        _minX.push_back(q.minX);
+        _minY.push_back(q.minY);
+        _maxX.push_back(q.maxX);
+        _maxY.push_back(q.maxY);
+    }
+
+    template<size_t Capacity, typename Coord>
+    void BoxArray<Capacity, Coord>::pop_back()
+    {
+        _minX.pop_back();
+        _minY.pop_back();
+        _maxX.pop_back();
+        _maxY.pop_back();
+    }
+
+    template<size_t Capacity, typename Coord>
+    void BoxArray<Capacity, Coord>::set(size_t i, const box_type& box)
+    {
+        const auto q = toQuery(box);
+        _minX[i] = q.minX;
+        _minY[i] = q.minY;
+        _maxX[i] = q.maxX;
+        _maxY[i] = q.maxY;
+    }
+
+    template<size_t Capacity, typename Coord>
+    template<typename Visitor>
+    bool BoxArray<Capacity, Coord>::forEachIntersecting(const box_type& b, Visitor&& visitor) const
+    {
+        const auto q = toQuery(b);
+        for (size_t block = 0; block < size(); block += 64) {
+            const auto count = std::min<size_t>(64, size() - block);
+            auto mask = simd::intersectMask(&_minX[block], &_minY[block], &_maxX[block], &_maxY[block], count, q);
+            while (mask) {
+                const auto i = block + __builtin_ctzll(mask);
+                mask &= mask - 1;
+                if (!visitor(i)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    template<size_t Capacity, typename Coord>
+    size_t BoxArray<Capacity, Coord>::leastGrowth(const box_type& b) const
+    {
+        return simd::leastGrowth(_minX.data(), _minY.data(), _maxX.data(), _maxY.data(), size(), toQuery(b));
+    }
+
+    template<size_t Capacity, typename Coord>
+    simd::Query<Coord> BoxArray<Capacity, Coord>::toQuery(const box_type& b)
+    {
+        if (b.isEmpty()) {
+            using limits = std::numeric_limits<Coord>;
+            constexpr auto max = limits::has_infinity ? limits::infinity() : limits::max();
+            constexpr auto min = limits::has_infinity ? -limits::infinity() : limits::lowest();
+            return { max, max, min, min };
+        }
+        const auto bl = b.bl();
+        const auto tr = b.tr();
+        return { bl.x, bl.y, tr.x, tr.y };
+    }
+} // namespace rtree
\ No newline at end of file
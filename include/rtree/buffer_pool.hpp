@@ -0,0 +1,240 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace rtree
+{
+    struct BufferPoolStats
+    {
+        // Pins of pages that were already in memory
+        size_t hits = 0;
+        // Pins that had to read the page from the file
+        size_t misses = 0;
+        // Pages written back to the file
+        size_t writes = 0;
+    };
+
+
+    // Fixed number of page frames caching pages of a file.
+    // A pinned page stays in its frame until it is unpinned, other pages are evicted
+    // by the CLOCK algorithm: the hand skips frames referenced since its last pass and takes the first one
+    // that wasn't, writing it back first if it is dirty. Memory used for pages never exceeds
+    // the number of frames times the page size, whatever the size of the file.
+    class BufferPool
+    {
+    public:
+        using page_id = std::uint64_t;
+
+        /**
+         * Open file path, creating it if it doesn't exist. Throws std::runtime_error if it can't be opened
+         */
+        BufferPool(const std::string& path, size_t pageSize, size_t frameCount);
+        BufferPool(const BufferPool&) = delete;
+        ~BufferPool();
+
+        BufferPool& operator=(const BufferPool&) = delete;
+
+        /**
+         * Bytes of page id, read from the file unless the page is in memory already.
+         * The bytes stay valid until the page is unpinned as many times as it was pinned.
+         * Throws std::runtime_error if every frame holds a pinned page
+         */
+        char* pin(page_id id);
+        /**
+         * Release a pin of page id. Dirty pages are written back when they are evicted or flushed
+         */
+        void unpin(page_id id, bool dirty);
+        /**
+         * Append a zeroed page to the file. The page is created in memory and reaches the file when it is written back
+         */
+        page_id allocate();
+        /**
+         * Write all dirty pages back to the file
+         */
+        void flush();
+
+        size_t getPageSize() const { return _pageSize; }
+        size_t getFrameCount() const { return _frames.size(); }
+        page_id getPageCount() const { return _pageCount; }
+        const BufferPoolStats& getStats() const { return _stats; }
+        void resetStats() { _stats = BufferPoolStats(); }
+
+    private:
+        struct Frame
+        {
+            page_id page = 0;
+            size_t pins = 0;
+            bool used = false;
+            bool dirty = false;
+            bool referenced = false;
+        };
+
+        size_t evict();
+        char* bytes(size_t frame) { return _memory.get() + frame * _pageSize; }
+        void write(size_t frame);
+
+        int _fd = -1;
+        size_t _pageSize;
+        page_id _pageCount = 0;
+        std::vector<Frame> _frames;
+        std::unique_ptr<char[]> _memory;
+        // Frame of every page in memory
+        std::unordered_map<page_id, size_t> _table;
+        size_t _hand = 0;
+        BufferPoolStats _stats;
+    };
+
+
+    // Pin of a page released when it goes out of scope
+    class PinnedPage
+    {
+    public:
+        PinnedPage(BufferPool& pool, BufferPool::page_id id) : _pool(pool), _id(id), _bytes(pool.pin(id)) {}
+        PinnedPage(const PinnedPage&) = delete;
+        ~PinnedPage() { _pool.unpin(_id, _dirty); }
+
+        PinnedPage& operator=(const PinnedPage&) = delete;
+
+        const char* bytes() const { return _bytes; }
+        /**
+         * Bytes for writing, the page will be written back to the file
+         */
+        char* modify() { _dirty = true; return _bytes; }
+        BufferPool::page_id id() const { return _id; }
+
+    private:
+        BufferPool& _pool;
+        BufferPool::page_id _id;
+        char* _bytes;
+        bool _dirty = false;
+    };
+
+
+    inline BufferPool::BufferPool(const std::string& path, size_t pageSize, size_t frameCount)
+        : _pageSize(pageSize), _frames(frameCount), _memory(new char[pageSize * frameCount])
+    {
+        if (frameCount == 0 || pageSize == 0) {
+            throw std::invalid_argument("BufferPool error: page size and number of frames must be positive");
+        }
+        _fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        struct stat status;
+        if (_fd < 0 || ::fstat(_fd, &status) != 0) {
+            if (_fd >= 0) {
+                ::close(_fd);
+            }
+            throw std::runtime_error("BufferPool error: can't open " + path);
+        }
+        _pageCount = status.st_size / _pageSize;
+        _table.reserve(frameCount);
+    }
+
+    inline BufferPool::~BufferPool()
+    {
+        // Errors can't be reported from here, flush() has to be called to see them
+        try {
+            flush();
+        }
+        catch (const std::exception&) {
+        }
+        ::close(_fd);
+    }
+
+    inline char* BufferPool::pin(page_id id)
+    {
+        const auto it = _table.find(id);
+        if (it != _table.end()) {
+            auto& frame = _frames[it->second];
+            frame.pins++;
+            frame.referenced = true;
+            _stats.hits++;
+            return bytes(it->second);
+        }
+
+        _stats.misses++;
+        const auto frame = evict();
+        const auto read = ::pread(_fd, bytes(frame), _pageSize, off_t(id * _pageSize));
+        if (read != ssize_t(_pageSize)) {
+            throw std::runtime_error("BufferPool error: can't read page " + std::to_string(id));
+        }
+        _frames[frame] = { id, 1, true, false, true };
+        _table.emplace(id, frame);
+        return bytes(frame);
+    }
+
+    inline void BufferPool::unpin(page_id id, bool dirty)
+    {
+        auto& frame = _frames[_table.at(id)];
+        frame.pins--;
+        frame.dirty = frame.dirty || dirty;
+    }
+
+    inline BufferPool::page_id BufferPool::allocate()
+    {
+        // Pages past the end of the file that are not written back yet are all in memory,
+        // pages before them that were never written read as zeros
+        const auto frame = evict();
+        const auto id = _pageCount++;
+        std::memset(bytes(frame), 0, _pageSize);
+        _frames[frame] = { id, 0, true, true, true };
+        _table.emplace(id, frame);
+        return id;
+    }
+
+    inline void BufferPool::flush()
+    {
+        for (size_t i = 0; i < _frames.size(); i++) {
+            if (_frames[i].used && _frames[i].dirty) {
+                write(i);
+            }
+        }
+    }
+
+    inline size_t BufferPool::evict()
+    {
+        // Two full turns clear every reference bit, so a frame that is still not found is pinned
+        for (size_t step = 0; step < 2 * _frames.size(); step++) {
+            const auto i = _hand;
+            _hand = (_hand + 1) % _frames.size();
+            auto& frame = _frames[i];
+            if (!frame.used) {
+                return i;
+            }
+            if (frame.pins > 0) {
+                continue;
+            }
+            if (frame.referenced) {
+                frame.referenced = false;
+                continue;
+            }
+            if (frame.dirty) {
+                write(i);
+            }
+            _table.erase(frame.page);
+            frame.used = false;
+            return i;
+        }
+        throw std::runtime_error("BufferPool error: all pages are pinned");
+    }
+
+    inline void BufferPool::write(size_t frame)
+    {
+        const auto id = _frames[frame].page;
+        if (::pwrite(_fd, bytes(frame), _pageSize, off_t(id * _pageSize)) != ssize_t(_pageSize)) {
+            throw std::runtime_error("BufferPool error: can't write page " + std::to_string(id));
+        }
+        _frames[frame].dirty = false;
+        _stats.writes++;
+    }
+} // namespace rtree
@@ -0,0 +1,549 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "exception.h"
+#include "rtree.hpp"
+#include "spin_lock.hpp"
+#include "split.hpp"
+
+
+namespace rtree
+{
+    // The same tree type with node locks of type Lock
+    template<typename TreeType, typename Lock>
+    struct WithNodeLock;
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord,
+             typename Aggregate, typename OldLock, typename Lock>
+    struct WithNodeLock<Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, OldLock>, Lock>
+    {
+        using type = Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>;
+    };
+
+
+    // Tree that any number of threads insert into, remove from and query at the same time.
+    // Tree is used with VersionLock as its node lock, so the pool keeps a version word next to every node
+    // and trees that aren't shared by threads carry nothing.
+    // Readers never write to locks: they descend taking versions of nodes, read the nodes and validate
+    // the versions, starting over if any of them changed. A pointer to a child is followed only after
+    // its parent is validated, and the parent is validated again once the version of the child is taken,
+    // so it is the version of a node that was attached at that moment.
+    // Writers descend the same way and lock only the nodes they change, taking every lock from the version
+    // seen on the way down. They optimistically assume that only the leaf will change. If the leaf turns out
+    // to overflow or its box has to grow, the operation starts over locking from the highest node that
+    // is going to change: the parent of the topmost split or of the topmost growing node.
+    // Threads working in different regions of the tree write to no shared line but the mutex of the id index.
+    // Readers see nodes while they are written and after they are destroyed, hence nodes must have fixed capacity:
+    // their items are inline and slots of destroyed nodes are reused by nodes only, so whatever a reader
+    // reads before validation lies in memory of the pool. Ids are copied the same way and must be trivially copyable.
+    // Overflowing nodes are always split, forced reinsertion of R*-tree is not used.
+    // Nodes are not condensed by removal unless they become empty, underfull nodes are left as they are.
+    template<typename Tree>
+    class ConcurrentTree
+    {
+        static_assert(!std::is_same<typename Tree::split_strategy, HilbertSplit>::value,
+            "Hilbert split updates largest Hilbert values of nodes while descending, so it can't be shared by threads.");
+        static_assert(!Tree::node_type::aggregated,
+            "Aggregates of all ancestors change with every insertion and removal, so a tree with aggregates can't be shared by threads.");
+        static_assert(Tree::node_type::capacity != DynamicCapacity,
+            "Readers look into nodes while they are written, so nodes must keep their items inline: MaxEntries has to be fixed.");
+        static_assert(std::is_trivially_copyable<typename Tree::node_type::data_type>::value,
+            "Readers copy ids while they are written, so ids must be trivially copyable.");
+
+    public:
+        using tree_type = typename WithNodeLock<Tree, VersionLock>::type;
+        using node_type = typename tree_type::node_type;
+        using entry_type = typename tree_type::entry_type;
+        using box_type = typename tree_type::box_type;
+        using data_type = typename node_type::data_type;
+
+        template<typename... Args>
+        explicit ConcurrentTree(Args&&... args);
+
+        /**
+         * Throws DuplicateEntryException if an entry with id data is already in the tree
+         */
+        void insert(const box_type& b, const data_type& data);
+        void remove(const data_type& data);
+        /**
+         * Find all entries whose bounding boxes are intersected by b
+         */
+        std::vector<entry_type> find(const box_type& b) const;
+
+        /**
+         * The tree itself. Can be used only while no other thread works with the tree
+         */
+        const tree_type& getTree() const { return _tree; }
+
+    private:
+        // Levels of nodes along a path: the root node is level 1, leaves are at level height + 1,
+        // level 0 stands for the root pointer
+        static constexpr size_t NoLevel = std::numeric_limits<size_t>::max();
+
+        /**
+         * Insert with locks from level exclusiveFrom down.
+         * Returns false and sets exclusiveFrom to the level that has to be locked instead if it is too low
+         */
+        bool tryInsert(const entry_type& e, size_t& exclusiveFrom);
+        /**
+         * Same as tryInsert() for removal of entry e. Returns true if the entry is removed or isn't in the tree
+         */
+        bool tryRemove(const entry_type& e, size_t& exclusiveFrom);
+        /**
+         * Depth-first search for the leaf holding e below node taken at version. Nodes on the way are pushed
+         * to path with their versions, nodes that turned out to be a dead end are popped again.
+         * Returns nothing if a node changed under the search
+         */
+        std::optional<bool> findLeaf(node_type* node, std::uint64_t version, size_t level, size_t leafLevel,
+                                     const entry_type& e, std::vector<std::pair<node_type*, std::uint64_t>>& path) const;
+        /**
+         * Collect entries intersected by b below node taken at version. Returns false if a node changed under the search
+         */
+        bool tryFind(const node_type* node, std::uint64_t version, const box_type& b, std::vector<entry_type>& found) const;
+
+        /**
+         * Take version of child read from parent taken at parentVersion.
+         * Returns false if parent changed, so that child may be no child of it
+         */
+        static bool enter(const node_type* parent, std::uint64_t parentVersion, const node_type* child,
+                          std::uint64_t& version);
+        static VersionLock& lockOf(const node_type* node) { return node_type::pool_type::getLock(node); }
+        /**
+         * Union of boxes of node items, skipping item skipped and taking box replacement for item replaced
+         */
+        static box_type itemsBox(const node_type* node, size_t skipped, size_t replaced, const box_type& replacement);
+        static bool contains(const box_type& outer, const box_type& inner) { return (outer & inner) == outer; }
+
+        tree_type _tree;
+        // Guards the root pointer of the tree and _height
+        VersionLock _rootLock;
+        // Number of levels below the root node, the same for every leaf
+        size_t _height = 0;
+        // Guards the node pool, the id index and the change log of the tree
+        std::mutex _bookkeeping;
+    };
+
+
+    template<typename Tree>
+    template<typename... Args>
+    ConcurrentTree<Tree>::ConcurrentTree(Args&&... args)
+        : _tree(std::forward<Args>(args)...)
+    {
+        if (_tree._root) {
+            _height = _tree._root->height();
+        }
+    }
+
+    template<typename Tree>
+    void ConcurrentTree<Tree>::insert(const box_type& b, const data_type& data)
+    {
+        {
+            std::lock_guard<std::mutex> guard(_bookkeeping);
+            if (!_tree._index.insert(data, { nullptr, 0 })) {
+                throw DuplicateEntryException("insert() error: entry " + toString(data) + " is already exists");
+            }
+            _tree.logChange(data);
+        }
+        const entry_type e { b, data };
+        size_t exclusiveFrom = NoLevel;
+        while (!tryInsert(e, exclusiveFrom)) {}
+    }
+
+    template<typename Tree>
+    void ConcurrentTree<Tree>::remove(const data_type& data)
+    {
+        // Box of the entry leads the search down. A locked leaf isn't waited for, because its writer
+        // may be waiting for the lock of the index
+        entry_type e;
+        while (true) {
+            std::unique_lock<std::mutex> guard(_bookkeeping);
+            const auto location = _tree._index.find(data);
+            if (!location) {
+                return;
+            }
+            std::uint64_t version = 0;
+            if (location->leaf && lockOf(location->leaf).tryReadVersion(version)) {
+                e = location->leaf->getEntries()[location->slot];
+                if (lockOf(location->leaf).validate(version)) {
+                    break;
+                }
+            }
+            guard.unlock();
+            std::this_thread::yield();
+        }
+        size_t exclusiveFrom = NoLevel;
+        while (!tryRemove(e, exclusiveFrom)) {}
+    }
+
+    template<typename Tree>
+    auto ConcurrentTree<Tree>::find(const box_type& b) const -> std::vector<entry_type>
+    {
+        std::vector<entry_type> found;
+        while (true) {
+            const auto rootVersion = _rootLock.readVersion();
+            const auto root = _tree._root;
+            const auto version = root ? lockOf(root).readVersion() : 0;
+            if (_rootLock.validate(rootVersion) && (!root || tryFind(root, version, b, found))) {
+                return found;
+            }
+            found.clear();
+        }
+    }
+
+    template<typename Tree>
+    bool ConcurrentTree<Tree>::tryInsert(const entry_type& e, size_t& exclusiveFrom)
+    {
+        const bool rootExclusive = exclusiveFrom == 0;
+        std::uint64_t rootVersion = 0;
+        if (rootExclusive) {
+            _rootLock.lock();
+        }
+        else {
+            rootVersion = _rootLock.readVersion();
+        }
+        auto node = _tree._root;
+        const auto leafLevel = _height + 1;
+        if (!node) {
+            if (!rootExclusive) {
+                exclusiveFrom = 0;
+                return false;
+            }
+            {
+                std::lock_guard<std::mutex> guard(_bookkeeping);
+                _tree._root = node_type::makeNode(_tree._pool, e);
+                _tree.indexEntry(_tree._root, 0);
+            }
+            _height = 0;
+            _rootLock.unlock();
+            return true;
+        }
+
+        // Nodes of the path and what the entry does to them as seen while they were read.
+        // Only what is seen in locked nodes is certain, the rest tells how far to lock on the next try
+        const auto exclusive = [&](size_t level) { return level >= exclusiveFrom || level == leafLevel; };
+        std::vector<node_type*> path;
+        std::vector<bool> grows;
+        std::vector<bool> full;
+        const auto release = [&]() {
+            for (size_t level = 1; level <= path.size(); level++) {
+                if (path[level - 1] && exclusive(level)) {
+                    lockOf(path[level - 1]).unlock();
+                }
+            }
+            if (rootExclusive) {
+                _rootLock.unlock();
+            }
+        };
+        auto version = lockOf(node).readVersion();
+        if (!rootExclusive && !_rootLock.validate(rootVersion)) {
+            return false;
+        }
+        for (size_t level = 1;; level++) {
+            if (exclusive(level) && !lockOf(node).tryUpgrade(version)) {
+                release();
+                return false;
+            }
+            path.push_back(node);
+            grows.push_back(!contains(node->getBoundingBox(), e.box));
+            full.push_back(node->size() >= _tree.getMaxEntries());
+            if (level == leafLevel) {
+                break;
+            }
+            // Strategy may look into children as well, what it reads there steers the choice only
+            const auto child = _tree.chooseSubtree(node, e.box);
+            std::uint64_t childVersion = 0;
+            if (exclusive(level)) {
+                childVersion = lockOf(child).readVersion();
+            }
+            else if (!enter(node, version, child, childVersion)) {
+                release();
+                return false;
+            }
+            node = child;
+            version = childVersion;
+        }
+
+        // The parent of every split node gets a new child and the parent of every growing node gets its new box.
+        // A split root needs the root pointer, a growing root needs only itself
+        auto required = leafLevel;
+        bool splitsBelow = true;
+        for (auto level = leafLevel; level > 0; level--) {
+            const bool splits = splitsBelow && full[level - 1];
+            if (!splits && !grows[level - 1]) {
+                break;
+            }
+            required = splits ? level - 1 : std::max<size_t>(level - 1, 1);
+            splitsBelow = splits;
+        }
+        if (required < std::min(exclusiveFrom, leafLevel)) {
+            release();
+            exclusiveFrom = required;
+            return false;
+        }
+
+        const auto leaf = path.back();
+        leaf->insert(e, false);
+        for (auto level = leafLevel; level > 0 && grows[level - 1]; level--) {
+            path[level - 1]->expandBoundingBox(e.box);
+        }
+        {
+            std::lock_guard<std::mutex> guard(_bookkeeping);
+            _tree.indexEntry(leaf, leaf->size() - 1);
+        }
+
+        // Halves are made detached from the parent, so filling them doesn't touch nodes above.
+        // A replaced node is unlocked before it goes back to the pool, which bumps its version for readers inside it
+        node = leaf;
+        for (auto level = leafLevel; _tree.needSplit(node); level--) {
+            const auto parent = level > 1 ? path[level - 2] : nullptr;
+            const bool isLeaf = node->isLeaf();
+            node->setParent(nullptr);
+            split_result<node_type> halves;
+            {
+                std::lock_guard<std::mutex> guard(_bookkeeping);
+                halves = _tree.split(node);
+                if (isLeaf) {
+                    _tree.indexLeaf(halves.first);
+                    _tree.indexLeaf(halves.second);
+                }
+            }
+            // Halves cover exactly what the node did, so boxes above stay the same
+            if (parent) {
+                parent->removeChild(node, false);
+                parent->insertChild(halves.first, false);
+                parent->insertChild(halves.second, false);
+            }
+            else {
+                std::lock_guard<std::mutex> guard(_bookkeeping);
+                _tree._root = node_type::makeNode(_tree._pool, halves.first);
+                _tree._root->insertChild(halves.second);
+                _height++;
+            }
+            lockOf(node).unlock();
+            {
+                std::lock_guard<std::mutex> guard(_bookkeeping);
+                _tree._pool.destroy(node);
+            }
+            path[level - 1] = nullptr;
+            if (!parent) {
+                break;
+            }
+            node = parent;
+        }
+        release();
+        return true;
+    }
+
+    template<typename Tree>
+    bool ConcurrentTree<Tree>::tryRemove(const entry_type& e, size_t& exclusiveFrom)
+    {
+        const bool rootExclusive = exclusiveFrom == 0;
+        std::uint64_t rootVersion = 0;
+        if (rootExclusive) {
+            _rootLock.lock();
+        }
+        else {
+            rootVersion = _rootLock.readVersion();
+        }
+        const auto root = _tree._root;
+        const auto leafLevel = _height + 1;
+        const auto exclusive = [&](size_t level) { return level >= exclusiveFrom || level == leafLevel; };
+        // Nodes of the path to the leaf and their versions, the first locked of them are locked
+        std::vector<std::pair<node_type*, std::uint64_t>> path;
+        size_t locked = 0;
+        const auto release = [&]() {
+            for (size_t level = 1; level <= locked; level++) {
+                if (path[level - 1].first && exclusive(level)) {
+                    lockOf(path[level - 1].first).unlock();
+                }
+            }
+            if (rootExclusive) {
+                _rootLock.unlock();
+            }
+        };
+        std::optional<bool> found = false;
+        if (root) {
+            found = findLeaf(root, lockOf(root).readVersion(), 1, leafLevel, e, path);
+        }
+        if (!found || (!rootExclusive && !_rootLock.validate(rootVersion))) {
+            release();
+            return false;
+        }
+        if (!*found) {
+            release();
+            return true;
+        }
+        // Locks are taken from the versions seen by the search, so the path is still the one that was searched
+        for (; locked < leafLevel; locked++) {
+            if (exclusive(locked + 1) && !lockOf(path[locked].first).tryUpgrade(path[locked].second)) {
+                release();
+                return false;
+            }
+        }
+
+        // Walk up while nodes become empty or get smaller boxes. An empty node is detached from its parent,
+        // a node with a new box updates the copy kept by its parent, the emptied root clears the root pointer
+        const auto leaf = path.back().first;
+        const auto& entries = leaf->getEntries();
+        const size_t slot = std::distance(entries.begin(), std::find(entries.begin(), entries.end(), e));
+        auto required = leafLevel;
+        bool empties = leaf->size() == 1;
+        auto box = empties ? box_type() : itemsBox(leaf, slot, NoLevel, box_type());
+        for (auto level = leafLevel; level > 0; level--) {
+            const auto node = path[level - 1].first;
+            if (!empties && box == node->getBoundingBox()) {
+                break;
+            }
+            required = empties || level > 1 ? level - 1 : level;
+            if (level == 1) {
+                break;
+            }
+            const auto parent = path[level - 2].first;
+            const auto& children = parent->getChildren();
+            const size_t childSlot = std::distance(children.begin(), std::find(children.begin(), children.end(), node));
+            const bool parentEmpties = empties && parent->size() == 1;
+            if (!parentEmpties) {
+                box = empties ? itemsBox(parent, childSlot, NoLevel, box_type()) : itemsBox(parent, NoLevel, childSlot, box);
+            }
+            empties = parentEmpties;
+        }
+        if (required < std::min(exclusiveFrom, leafLevel)) {
+            release();
+            exclusiveFrom = required;
+            return false;
+        }
+
+        leaf->removeAt(slot, false);
+        {
+            std::lock_guard<std::mutex> guard(_bookkeeping);
+            _tree._index.erase(e.data);
+            if (slot < leaf->size()) {
+                _tree.indexEntry(leaf, slot);
+            }
+            _tree.logChange(e.data);
+        }
+        for (auto level = leafLevel; level > 0; level--) {
+            const auto node = path[level - 1].first;
+            if (node->size() > 0) {
+                if (itemsBox(node, NoLevel, NoLevel, box_type()) == node->getBoundingBox()) {
+                    break;
+                }
+                node->updateBoundingBox();
+                continue;
+            }
+            if (level > 1) {
+                path[level - 2].first->removeChild(node, false);
+            }
+            else {
+                _tree._root = nullptr;
+                _height = 0;
+            }
+            lockOf(node).unlock();
+            {
+                std::lock_guard<std::mutex> guard(_bookkeeping);
+                _tree._pool.destroy(node);
+            }
+            path[level - 1].first = nullptr;
+        }
+        release();
+        return true;
+    }
+
+    template<typename Tree>
+    std::optional<bool> ConcurrentTree<Tree>::findLeaf(node_type* node, std::uint64_t version, size_t level,
+                                                       size_t leafLevel, const entry_type& e,
+                                                       std::vector<std::pair<node_type*, std::uint64_t>>& path) const
+    {
+        path.emplace_back(node, version);
+        std::optional<bool> found = false;
+        if (!contains(node->getBoundingBox(), e.box)) {
+            // Dead end
+        }
+        else if (level == leafLevel) {
+            const auto& entries = node->getEntries();
+            found = std::find(entries.begin(), entries.end(), e) != entries.end();
+        }
+        else {
+            const auto& children = node->getChildren();
+            node->getBoxes().forEachIntersecting(e.box, [&](size_t i) {
+                const auto child = children[i];
+                std::uint64_t childVersion = 0;
+                found = enter(node, version, child, childVersion) ?
+                    findLeaf(child, childVersion, level + 1, leafLevel, e, path) : std::nullopt;
+                return found == false;
+            });
+        }
+        // The leaf found is checked by taking its lock, a dead end only if nothing changed under the search
+        if (found == true) {
+            return found;
+        }
+        if (found && !lockOf(node).validate(version)) {
+            found = std::nullopt;
+        }
+        path.pop_back();
+        return found;
+    }
+
+    template<typename Tree>
+    bool ConcurrentTree<Tree>::tryFind(const node_type* node, std::uint64_t version, const box_type& b,
+                                       std::vector<entry_type>& found) const
+    {
+        bool valid = true;
+        if (node->isLeaf()) {
+            const auto& entries = node->getEntries();
+            node->getBoxes().forEachIntersecting(b, [&](size_t i) {
+                found.push_back(entries[i]);
+                return true;
+            });
+        }
+        else {
+            const auto& children = node->getChildren();
+            node->getBoxes().forEachIntersecting(b, [&](size_t i) {
+                const auto child = children[i];
+                std::uint64_t childVersion = 0;
+                valid = enter(node, version, child, childVersion) && tryFind(child, childVersion, b, found);
+                return valid;
+            });
+        }
+        return valid && lockOf(node).validate(version);
+    }
+
+    template<typename Tree>
+    bool ConcurrentTree<Tree>::enter(const node_type* parent, std::uint64_t parentVersion, const node_type* child,
+                                     std::uint64_t& version)
+    {
+        if (!lockOf(parent).validate(parentVersion)) {
+            return false;
+        }
+        version = lockOf(child).readVersion();
+        return lockOf(parent).validate(parentVersion);
+    }
+
+    template<typename Tree>
+    auto ConcurrentTree<Tree>::itemsBox(const node_type* node, size_t skipped, size_t replaced, const box_type& replacement)
+        -> box_type
+    {
+        box_type box;
+        for (size_t i = 0; i < node->size(); i++) {
+            if (i == skipped) {
+                continue;
+            }
+            if (i == replaced) {
+                box = box & replacement;
+            }
+            else {
+                box = box & (node->isLeaf() ? node->getEntries()[i].box : node->getChildren()[i]->getBoundingBox());
+            }
+        }
+        return box;
+    }
+} // namespace rtree
@@ -0,0 +1,354 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "bounding_box.hpp"
+#include "hilbert.hpp"
+#include "node.hpp"
+#include "packing.hpp"
+
+
+namespace rtree
+{
+    // Anonymous file for spilling records that don't fit into memory.
+    // It is unlinked right after it is created, so it is gone once closed, even if the process dies.
+    class TempFile
+    {
+    public:
+        /**
+         * Create a file in directory. Throws std::runtime_error if it can't be created
+         */
+        explicit TempFile(const std::string& directory);
+        TempFile(const TempFile&) = delete;
+        TempFile(TempFile&& other) noexcept : _file(std::exchange(other._file, nullptr)) {}
+        ~TempFile();
+
+        TempFile& operator=(const TempFile&) = delete;
+        TempFile& operator=(TempFile&& other) noexcept;
+
+        template<typename Record>
+        void write(const Record* records, size_t count);
+        /**
+         * Read at most count records, returns the number of records read
+         */
+        template<typename Record>
+        size_t read(Record* records, size_t count);
+        /**
+         * Go back to the start of the file to read what was written
+         */
+        void rewind() { seek(0); }
+        /**
+         * Go to byte offset of the file to read or write from there
+         */
+        void seek(std::uint64_t offset);
+
+    private:
+        std::FILE* _file = nullptr;
+    };
+
+
+    // What external packing has to know about records before ordering them
+    template<typename Coord>
+    struct SpillStats
+    {
+        std::uint64_t count = 0;
+        // Extent of centers of all records
+        BasicBoundingBox<Coord> centers;
+
+        void add(const BasicBoundingBox<Coord>& box);
+    };
+
+
+    // Smallest number of records sorted in memory at once, whatever memory limit is given
+    constexpr size_t MinSortRecords = 1024;
+    // Number of records read from a run at once while runs are merged
+    constexpr size_t MergeBufferRecords = 4096;
+
+    /**
+     * Call emit for every record of input in the order of key(record), keeping about memoryBytes of records in memory.
+     * Input is sorted in chunks that fit into memory, chunks are written one after another to a temporary file
+     * in directory and merged, in several passes if there are more of them than merge buffers fit into memory.
+     * Only two temporary files are open at a time whatever the size of input.
+     * Records have to be trivially copyable
+     */
+    template<typename Record, typename Key, typename Emit>
+    void externalSort(TempFile& input, Key key, size_t memoryBytes, const std::string& directory, Emit&& emit);
+
+
+    // Packing of records that don't fit into memory: emits records in the order Packing::order() would give them.
+    // Record count and the extent of their centers have to be collected while the records were written to input
+    template<typename Packing>
+    struct ExternalPacking;
+
+    template<>
+    struct ExternalPacking<STRPacking>
+    {
+        template<typename Record, typename Coord, typename Emit>
+        static void order(TempFile& input, const SpillStats<Coord>& stats, size_t nodeCapacity,
+                          size_t memoryBytes, const std::string& directory, Emit&& emit);
+    };
+
+    template<>
+    struct ExternalPacking<HilbertPacking>
+    {
+        template<typename Record, typename Coord, typename Emit>
+        static void order(TempFile& input, const SpillStats<Coord>& stats, size_t nodeCapacity,
+                          size_t memoryBytes, const std::string& directory, Emit&& emit);
+    };
+
+
+    inline TempFile::TempFile(const std::string& directory)
+    {
+        std::string path = directory + "/rtree.XXXXXX";
+        const auto fd = ::mkstemp(path.data());
+        if (fd >= 0) {
+            ::unlink(path.c_str());
+            _file = ::fdopen(fd, "w+b");
+            if (!_file) {
+                ::close(fd);
+            }
+        }
+        if (!_file) {
+            throw std::runtime_error("TempFile error: can't create a file in " + directory);
+        }
+    }
+
+    inline TempFile::~TempFile()
+    {
+        if (_file) {
+            std::fclose(_file);
+        }
+    }
+
+    inline TempFile& TempFile::operator=(TempFile&& other) noexcept
+    {
+        if (this != &other) {
+            if (_file) {
+                std::fclose(_file);
+            }
+            _file = std::exchange(other._file, nullptr);
+        }
+        return *this;
+    }
+
+    template<typename Record>
+    void TempFile::write(const Record* records, size_t count)
+    {
+        static_assert(std::is_trivially_copyable<Record>::value, "Only trivially copyable records can be written to a file.");
+        if (std::fwrite(records, sizeof(Record), count, _file) != count) {
+            throw std::runtime_error("TempFile error: can't write");
+        }
+    }
+
+    template<typename Record>
+    size_t TempFile::read(Record* records, size_t count)
+    {
+        static_assert(std::is_trivially_copyable<Record>::value, "Only trivially copyable records can be read from a file.");
+        const auto read = std::fread(records, sizeof(Record), count, _file);
+        if (read < count && std::ferror(_file)) {
+            throw std::runtime_error("TempFile error: can't read");
+        }
+        return read;
+    }
+
+    inline void TempFile::seek(std::uint64_t offset)
+    {
+        if (std::fflush(_file) != 0 || ::fseeko(_file, off_t(offset), SEEK_SET) != 0) {
+            throw std::runtime_error("TempFile error: can't seek");
+        }
+    }
+
+
+    template<typename Coord>
+    void SpillStats<Coord>::add(const BasicBoundingBox<Coord>& box)
+    {
+        const auto c = box.center();
+        centers = centers & BasicBoundingBox<Coord>(c.x, c.y, 0, 0);
+        count++;
+    }
+
+
+    template<typename Record, typename Key, typename Emit>
+    void externalSort(TempFile& input, Key key, size_t memoryBytes, const std::string& directory, Emit&& emit)
+    {
+        using key_type = std::decay_t<std::invoke_result_t<Key&, const Record&>>;
+        struct Keyed
+        {
+            key_type key;
+            Record record;
+        };
+        const auto less = [](const Keyed& l, const Keyed& r) { return l.key < r.key; };
+
+        // Sorted runs are kept in one file as ranges of records,
+        // a single run that fits into memory is emitted without being written
+        struct Run
+        {
+            std::uint64_t first;
+            std::uint64_t count;
+        };
+        const size_t capacity = std::max(MinSortRecords, memoryBytes / sizeof(Keyed));
+        std::optional<TempFile> file;
+        std::vector<Run> runs;
+        std::uint64_t written = 0;
+        std::vector<Keyed> chunk;
+        chunk.reserve(capacity);
+        std::vector<Record> batch(std::min(capacity, MergeBufferRecords));
+        input.rewind();
+        bool exhausted = false;
+        while (!exhausted) {
+            chunk.clear();
+            while (chunk.size() < capacity) {
+                const auto read = input.read(batch.data(), std::min(batch.size(), capacity - chunk.size()));
+                std::for_each(batch.begin(), std::next(batch.begin(), read),
+                    [&](const Record& record) { chunk.push_back({ key(record), record }); });
+                if (read == 0) {
+                    exhausted = true;
+                    break;
+                }
+            }
+            std::sort(chunk.begin(), chunk.end(), less);
+            if (exhausted && runs.empty()) {
+                std::for_each(chunk.begin(), chunk.end(), [&emit](const Keyed& keyed) { emit(keyed.record); });
+                return;
+            }
+            if (!chunk.empty()) {
+                if (!file) {
+                    file.emplace(directory);
+                }
+                file->write(chunk.data(), chunk.size());
+                runs.push_back({ written, chunk.size() });
+                written += chunk.size();
+            }
+        }
+        chunk = std::vector<Keyed>();
+        batch = std::vector<Record>();
+
+        // Every run being merged gets an equal share of memory for its buffer
+        const size_t fanIn = std::max<size_t>(2, capacity / MergeBufferRecords);
+        const auto merge = [&](auto begin, auto end, auto&& output) {
+            const size_t count = std::distance(begin, end);
+            const size_t bufferSize = std::max<size_t>(1, capacity / count);
+            std::vector<std::vector<Keyed>> buffers(count, std::vector<Keyed>(bufferSize));
+            std::vector<size_t> positions(count, 0);
+            std::vector<size_t> sizes(count, 0);
+            std::vector<Run> rest(begin, end);
+            const auto refill = [&](size_t i) {
+                positions[i] = 0;
+                sizes[i] = std::min<std::uint64_t>(bufferSize, rest[i].count);
+                if (sizes[i] > 0) {
+                    file->seek(rest[i].first * sizeof(Keyed));
+                    if (file->read(buffers[i].data(), sizes[i]) != sizes[i]) {
+                        throw std::runtime_error("TempFile error: run is shorter than written");
+                    }
+                    rest[i].first += sizes[i];
+                    rest[i].count -= sizes[i];
+                }
+                return sizes[i] > 0;
+            };
+
+            // Heads of runs, ties go to the earlier run
+            const auto later = [&](size_t l, size_t r) {
+                const auto& lk = buffers[l][positions[l]].key;
+                const auto& rk = buffers[r][positions[r]].key;
+                return rk < lk || (!(lk < rk) && l > r);
+            };
+            std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads(later);
+            for (size_t i = 0; i < count; i++) {
+                if (refill(i)) {
+                    heads.push(i);
+                }
+            }
+            while (!heads.empty()) {
+                const auto i = heads.top();
+                heads.pop();
+                output(buffers[i][positions[i]]);
+                if (++positions[i] < sizes[i] || refill(i)) {
+                    heads.push(i);
+                }
+            }
+        };
+
+        while (runs.size() > fanIn) {
+            TempFile merged(directory);
+            std::vector<Run> mergedRuns;
+            std::uint64_t mergedWritten = 0;
+            for (auto it = runs.cbegin(); it != runs.cend();) {
+                const auto end = std::next(it, std::min<size_t>(fanIn, std::distance(it, runs.cend())));
+                const auto first = mergedWritten;
+                merge(it, end, [&](const Keyed& keyed) {
+                    merged.write(&keyed, 1);
+                    mergedWritten++;
+                });
+                mergedRuns.push_back({ first, mergedWritten - first });
+                it = end;
+            }
+            file = std::move(merged);
+            runs = std::move(mergedRuns);
+        }
+        merge(runs.cbegin(), runs.cend(), [&emit](const Keyed& keyed) { emit(keyed.record); });
+    }
+
+
+    template<typename Record, typename Coord, typename Emit>
+    void ExternalPacking<STRPacking>::order(TempFile& input, const SpillStats<Coord>& stats, size_t nodeCapacity,
+                                            size_t memoryBytes, const std::string& directory, Emit&& emit)
+    {
+        if (stats.count <= nodeCapacity) {
+            externalSort<Record>(input, [](const Record&) { return 0; }, memoryBytes, directory, emit);
+            return;
+        }
+
+        // Records sorted by x are cut into slices by their rank, then sorted again by slice and y
+        const std::uint64_t nodeCount = (stats.count + nodeCapacity - 1) / nodeCapacity;
+        const auto sliceCount = static_cast<std::uint64_t>(std::ceil(std::sqrt(static_cast<double>(nodeCount))));
+        const std::uint64_t sliceSize = sliceCount * nodeCapacity;
+        struct Sliced
+        {
+            std::uint64_t slice;
+            Record record;
+        };
+        struct SliceKey
+        {
+            std::uint64_t slice;
+            Coord y;
+
+            bool operator<(const SliceKey& other) const { return slice < other.slice || (slice == other.slice && y < other.y); }
+        };
+
+        TempFile sliced(directory);
+        std::uint64_t rank = 0;
+        externalSort<Record>(input, [](const Record& record) { return boxOf(record).center().x; }, memoryBytes, directory,
+            [&](const Record& record) {
+                const Sliced item { rank++ / sliceSize, record };
+                sliced.write(&item, 1);
+            });
+        externalSort<Sliced>(sliced, [](const Sliced& item) { return SliceKey{ item.slice, boxOf(item.record).center().y }; },
+            memoryBytes, directory, [&emit](const Sliced& item) { emit(item.record); });
+    }
+
+    template<typename Record, typename Coord, typename Emit>
+    void ExternalPacking<HilbertPacking>::order(TempFile& input, const SpillStats<Coord>& stats, size_t nodeCapacity,
+                                                size_t memoryBytes, const std::string& directory, Emit&& emit)
+    {
+        if (stats.count <= nodeCapacity) {
+            externalSort<Record>(input, [](const Record&) { return 0; }, memoryBytes, directory, emit);
+            return;
+        }
+        const auto extent = stats.centers;
+        externalSort<Record>(input, [&extent](const Record& record) { return hilbertValue(boxOf(record), extent); },
+            memoryBytes, directory, emit);
+    }
+} // namespace rtree
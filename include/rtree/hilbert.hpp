@@ -0,0 +1,79 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#include "bounding_box.hpp"
+
+
+namespace rtree
+{
+    // Marks a node whose largest Hilbert value has not been computed yet
+    constexpr std::uint64_t UnknownHilbertValue = std::numeric_limits<std::uint64_t>::max();
+
+    /**
+     * Position of cell (x, y) along the Hilbert curve that fills 2^32 x 2^32 grid
+     */
+    inline std::uint64_t hilbertIndex(std::uint32_t x, std::uint32_t y)
+    {
+        std::uint64_t index = 0;
+        for (std::uint32_t s = std::uint32_t(1) << 31; s > 0; s >>= 1) {
+            const std::uint32_t rx = (x & s) > 0;
+            const std::uint32_t ry = (y & s) > 0;
+            index += std::uint64_t(s) * s * ((3 * rx) ^ ry);
+            // Rotate the quadrant so that the curve inside it starts at its origin
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return index;
+    }
+
+    /**
+     * Map coordinate onto the Hilbert grid without knowing the extent of the data.
+     * The mapping keeps the order of coordinates, so it can be used for dynamic insertions
+     */
+    inline std::uint32_t hilbertCoordinate(double v)
+    {
+        std::uint64_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        constexpr std::uint64_t signBit = std::uint64_t(1) << 63;
+        bits = (bits & signBit) ? ~bits : bits | signBit;
+        return static_cast<std::uint32_t>(bits >> 32);
+    }
+
+    /**
+     * Map coordinate from [min, max] onto the whole Hilbert grid
+     */
+    inline std::uint32_t hilbertCoordinate(double v, double min, double max)
+    {
+        if (max <= min) {
+            return 0;
+        }
+        const auto scale = static_cast<double>(std::numeric_limits<std::uint32_t>::max()) / (max - min);
+        return static_cast<std::uint32_t>(std::min((v - min) * scale,
+                                                   static_cast<double>(std::numeric_limits<std::uint32_t>::max())));
+    }
+
+    template<typename Coord>
+    std::uint64_t hilbertValue(const BasicBoundingBox<Coord>& box)
+    {
+        const auto c = box.center();
+        return hilbertIndex(hilbertCoordinate(static_cast<double>(c.x)), hilbertCoordinate(static_cast<double>(c.y)));
+    }
+
+    template<typename Coord>
+    std::uint64_t hilbertValue(const BasicBoundingBox<Coord>& box, const BasicBoundingBox<Coord>& extent)
+    {
+        const auto c = box.center();
+        const auto bl = extent.bl();
+        const auto tr = extent.tr();
+        return hilbertIndex(hilbertCoordinate(c.x, bl.x, tr.x), hilbertCoordinate(c.y, bl.y, tr.y));
+    }
+} // namespace rtree
\ No newline at end of file
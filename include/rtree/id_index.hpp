@@ -0,0 +1,172 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+
+namespace rtree
+{
+    // Open-addressing hash table from entry id to its location in the tree.
+    // Slots are probed linearly and erased with backward shifting, so lookups never
+    // walk over tombstones. Hash values are scrambled with Fibonacci hashing because
+    // std::hash of integers is identity and ids are often sequential or strided.
+    template<typename Key, typename Value, typename Hash = std::hash<Key>>
+    class IdIndex
+    {
+    public:
+        Value*       find(const Key& key);
+        const Value* find(const Key& key) const;
+        /**
+         * Add key with value. Returns false and leaves the index unchanged if key is already present
+         */
+        bool insert(const Key& key, const Value& value);
+        bool erase(const Key& key);
+        void clear();
+        /**
+         * Make room for count keys without rehashing
+         */
+        void reserve(size_t count);
+
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+
+    private:
+        struct Slot
+        {
+            Key key;
+            Value value;
+            bool used = false;
+        };
+
+        static constexpr size_t MinCapacity = 16;
+
+        size_t home(const Key& key) const;
+        size_t locate(const Key& key) const;
+        void rehash(size_t capacity);
+
+        std::vector<Slot> _slots;
+        size_t _size = 0;
+        unsigned _shift = 64;
+    };
+
+
+    template<typename Key, typename Value, typename Hash>
+    Value* IdIndex<Key, Value, Hash>::find(const Key& key)
+    {
+        const auto i = locate(key);
+        return i == _slots.size() ? nullptr : &_slots[i].value;
+    }
+
+    template<typename Key, typename Value, typename Hash>
+    const Value* IdIndex<Key, Value, Hash>::find(const Key& key) const
+    {
+        const auto i = locate(key);
+        return i == _slots.size() ? nullptr : &_slots[i].value;
+    }
+
+    template<typename Key, typename Value, typename Hash>
+    bool IdIndex<Key, Value, Hash>::insert(const Key& key, const Value& value)
+    {
+        if (locate(key) != _slots.size()) {
+            return false;
+        }
+        reserve(_size + 1);
+        const auto mask = _slots.size() - 1;
+        auto i = home(key);
+        while (_slots[i].used) {
+            i = (i + 1) & mask;
+        }
+        _slots[i] = { key, value, true };
+        _size++;
+        return true;
+    }
+
+    template<typename Key, typename Value, typename Hash>
+    bool IdIndex<Key, Value, Hash>::erase(const Key& key)
+    {
+        auto hole = locate(key);
+        if (hole == _slots.size()) {
+            return false;
+        }
+        // Move back every following key of the probe run that can`t be found past the hole anymore
+        const auto mask = _slots.size() - 1;
+        for (auto i = (hole + 1) & mask; _slots[i].used; i = (i + 1) & mask) {
+            const auto h = home(_slots[i].key);
+            const bool reachable = hole <= i ? (hole < h && h <= i) : (hole < h || h <= i);
+            if (!reachable) {
+                _slots[hole] = std::move(_slots[i]);
+                hole = i;
+            }
+        }
+        _slots[hole].used = false;
+        _size--;
+        return true;
+    }
+
+    template<typename Key, typename Value, typename Hash>
+    void IdIndex<Key, Value, Hash>::clear()
+    {
+        _slots.clear();
+        _size = 0;
+        _shift = 64;
+    }
+
+    template<typename Key, typename Value, typename Hash>
+    void IdIndex<Key, Value, Hash>::reserve(size_t count)
+    {
+        // Load factor is kept below 3/4
+        if (count * 4 < _slots.size() * 3) {
+            return;
+        }
+        size_t capacity = std::max(MinCapacity, _slots.size());
+        while (count * 4 >= capacity * 3) {
+            capacity *= 2;
+        }
+        rehash(capacity);
+    }
+
+    template<typename Key, typename Value, typename Hash>
+    size_t IdIndex<Key, Value, Hash>::home(const Key& key) const
+    {
+        return static_cast<size_t>((static_cast<std::uint64_t>(Hash{}(key)) * 0x9E3779B97F4A7C15ull) >> _shift);
+    }
+
+    template<typename Key, typename Value, typename Hash>
+    size_t IdIndex<Key, Value, Hash>::locate(const Key& key) const
+    {
+        if (_size == 0) {
+            return _slots.size();
+        }
+        const auto mask = _slots.size() - 1;
+        for (auto i = home(key); _slots[i].used; i = (i + 1) & mask) {
+            if (_slots[i].key == key) {
+                return i;
+            }
+        }
+        return _slots.size();
+    }
+
+    template<typename Key, typename Value, typename Hash>
+    void IdIndex<Key, Value, Hash>::rehash(size_t capacity)
+    {
+        auto old = std::move(_slots);
+        _slots = std::vector<Slot>(capacity);
+        _shift = 64;
+        for (size_t c = capacity; c > 1; c >>= 1) {
+            _shift--;
+        }
+        const auto mask = capacity - 1;
+        for (auto& slot: old) {
+            if (slot.used) {
+                auto i = home(slot.key);
+                while (_slots[i].used) {
+                    i = (i + 1) & mask;
+                }
+                _slots[i] = std::move(slot);
+            }
+        }
+    }
+} // namespace rtree
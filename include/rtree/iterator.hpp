@@ -7,28 +7,29 @@
 
 namespace rtree
 {
-    template<typename T>
+    template<typename T, size_t Capacity = DynamicCapacity, typename Coord = double, typename Aggregate = NoAggregate,
+             typename Lock = NoLock>
     class Iterator
     {
     public:
         using iterator_category = std::forward_iterator_tag;
-        using value_type = Node<T>;
+        using value_type = Node<T, Capacity, Coord, Aggregate, Lock>;
         using difference_type = int;
-        using pointer = node_ptr<T>;
-        using reference = Node<T>&;
+        using pointer = node_ptr<T, Capacity, Coord, Aggregate, Lock>;
+        using reference = Node<T, Capacity, Coord, Aggregate, Lock>&;
 
-        Iterator(const Iterator<T>& other) = default;
-        Iterator(Iterator<T>&& other) = default;
+        Iterator(const Iterator<T, Capacity, Coord, Aggregate, Lock>& other) = default;
+        Iterator(Iterator<T, Capacity, Coord, Aggregate, Lock>&& other) = default;
         Iterator(pointer ptr = nullptr);
         ~Iterator() {}
 
-        Iterator& operator=(const Iterator<T>& other) = default;
-        Iterator& operator=(Iterator<T>&& other) = default;
+        Iterator& operator=(const Iterator<T, Capacity, Coord, Aggregate, Lock>& other) = default;
+        Iterator& operator=(Iterator<T, Capacity, Coord, Aggregate, Lock>&& other) = default;
         Iterator& operator=(pointer ptr);
 
         operator bool() const { return !_stack.empty(); }
-        bool operator==(const Iterator<T>& other) const { return _stack.size() == other._stack.size() && _stack == other._stack; }
-        bool operator!=(const Iterator<T>& other) const { return !(*this == other); }
+        bool operator==(const Iterator<T, Capacity, Coord, Aggregate, Lock>& other) const { return _stack.size() == other._stack.size() && _stack == other._stack; }
+        bool operator!=(const Iterator<T, Capacity, Coord, Aggregate, Lock>& other) const { return !(*this == other); }
         Iterator& operator++();
         Iterator operator++(int);
         reference operator*() { return *_stack.top(); }
@@ -42,16 +43,16 @@ namespace rtree
     };
 
 
-    template<typename T>
-    Iterator<T>::Iterator(pointer ptr)
+    template<typename T, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    Iterator<T, Capacity, Coord, Aggregate, Lock>::Iterator(pointer ptr)
     {
         if (ptr) {
             _stack.push(ptr);
         }
     }
 
-    template<typename T>
-    Iterator<T>& Iterator<T>::operator=(pointer ptr)
+    template<typename T, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    Iterator<T, Capacity, Coord, Aggregate, Lock>& Iterator<T, Capacity, Coord, Aggregate, Lock>::operator=(pointer ptr)
     {
         _stack.clear();
         if (ptr) {
@@ -59,8 +60,8 @@ namespace rtree
         }
     }
 
-    template<typename T>
-    Iterator<T>& Iterator<T>::operator++()
+    template<typename T, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    Iterator<T, Capacity, Coord, Aggregate, Lock>& Iterator<T, Capacity, Coord, Aggregate, Lock>::operator++()
     {
         const auto node = _stack.top();
         _stack.pop();
@@ -72,8 +73,8 @@ namespace rtree
         return *this;
     }
 
-    template<typename T>
-    Iterator<T> Iterator<T>::operator++(int)
+    template<typename T, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    Iterator<T, Capacity, Coord, Aggregate, Lock> Iterator<T, Capacity, Coord, Aggregate, Lock>::operator++(int)
     {
         auto tmp = *this;
         operator++();
@@ -0,0 +1,368 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+
+namespace rtree
+{
+    // Synchronized traversal of two node hierarchies.
+    // Only pairs of nodes whose boxes intersect are visited: the taller node of a pair is descended
+    // into first, nodes of equal height are descended into together. Every pair of intersecting
+    // leaf entries is passed to the callback.
+    template<typename NodeA, typename NodeB, typename Callback>
+    class SpatialJoin
+    {
+        static_assert(std::is_same<typename NodeA::box_type, typename NodeB::box_type>::value,
+            "Joined trees must have the same coordinate type.");
+
+    public:
+        struct Task
+        {
+            const NodeA* a;
+            const NodeB* b;
+            size_t heightA;
+            size_t heightB;
+        };
+
+        explicit SpatialJoin(Callback& callback) : _callback(callback) {}
+
+        void run(const Task& task);
+        void run(const Task& task, ThreadPool& pool);
+
+    private:
+        /**
+         * Pass every pair of node's children that has to be joined to spawn
+         */
+        template<typename Spawn>
+        void expand(const Task& task, Spawn&& spawn);
+        void joinLeaves(const NodeA* a, const NodeB* b);
+
+        // Pairs this close to the leaves are joined by the thread that found them,
+        // spawning tasks for them costs more than the join itself
+        static constexpr size_t InlineHeight = 1;
+
+        Callback& _callback;
+    };
+
+
+    template<typename NodeA, typename NodeB, typename Callback>
+    void SpatialJoin<NodeA, NodeB, Callback>::run(const Task& task)
+    {
+        if (task.heightA == 0 && task.heightB == 0) {
+            joinLeaves(task.a, task.b);
+            return;
+        }
+        expand(task, [this](const Task& subtask) { run(subtask); });
+    }
+
+    template<typename NodeA, typename NodeB, typename Callback>
+    void SpatialJoin<NodeA, NodeB, Callback>::run(const Task& task, ThreadPool& pool)
+    {
+        WorkStealingQueues<Task> queues(pool.size());
+        queues.push(0, task);
+        pool.run([&](size_t worker) {
+            Task current;
+            while (queues.pop(worker, current)) {
+                // Task is reported as done even if callback throws, otherwise other workers would wait for it forever
+                try {
+                    expand(current, [&](const Task& subtask) {
+                        if (std::max(subtask.heightA, subtask.heightB) <= InlineHeight) {
+                            run(subtask);
+                        }
+                        else {
+                            queues.push(worker, subtask);
+                        }
+                    });
+                }
+                catch (...) {
+                    queues.done();
+                    throw;
+                }
+                queues.done();
+            }
+        });
+    }
+
+    template<typename NodeA, typename NodeB, typename Callback>
+    template<typename Spawn>
+    void SpatialJoin<NodeA, NodeB, Callback>::expand(const Task& task, Spawn&& spawn)
+    {
+        const auto a = task.a;
+        const auto b = task.b;
+        const auto heightA = task.heightA;
+        const auto heightB = task.heightB;
+        if (heightA == 0 && heightB == 0) {
+            spawn(task);
+        }
+        else if (heightA > heightB) {
+            const auto& children = a->getChildren();
+            a->getBoxes().forEachIntersecting(b->getBoundingBox(), [&](size_t i) {
+                spawn({ children[i], b, heightA - 1, heightB });
+                return true;
+            });
+        }
+        else if (heightB > heightA) {
+            const auto& children = b->getChildren();
+            b->getBoxes().forEachIntersecting(a->getBoundingBox(), [&](size_t i) {
+                spawn({ a, children[i], heightA, heightB - 1 });
+                return true;
+            });
+        }
+        else {
+            const auto& childrenA = a->getChildren();
+            const auto& childrenB = b->getChildren();
+            a->getBoxes().forEachIntersecting(b->getBoundingBox(), [&](size_t i) {
+                b->getBoxes().forEachIntersecting(childrenA[i]->getBoundingBox(), [&](size_t j) {
+                    spawn({ childrenA[i], childrenB[j], heightA - 1, heightB - 1 });
+                    return true;
+                });
+                return true;
+            });
+        }
+    }
+
+    template<typename NodeA, typename NodeB, typename Callback>
+    void SpatialJoin<NodeA, NodeB, Callback>::joinLeaves(const NodeA* a, const NodeB* b)
+    {
+        const auto& entriesA = a->getEntries();
+        const auto& entriesB = b->getEntries();
+        a->getBoxes().forEachIntersecting(b->getBoundingBox(), [&](size_t i) {
+            b->getBoxes().forEachIntersecting(entriesA[i].box, [&](size_t j) {
+                _callback(entriesA[i], entriesB[j]);
+                return true;
+            });
+            return true;
+        });
+    }
+
+
+    /**
+     * Call callback for every unordered pair of intersecting entries of the subtree of given height.
+     * A leaf pairs its own entries, an inner node joins every child with itself and with each of its
+     * intersecting siblings that comes later
+     */
+    template<typename NodeType, typename Callback>
+    void selfJoinNode(const NodeType* node, size_t height, Callback& callback)
+    {
+        if (height == 0) {
+            const auto& entries = node->getEntries();
+            for (size_t i = 0; i < entries.size(); i++) {
+                node->getBoxes().forEachIntersecting(entries[i].box, [&](size_t j) {
+                    if (j > i) {
+                        callback(entries[i], entries[j]);
+                    }
+                    return true;
+                });
+            }
+            return;
+        }
+
+        SpatialJoin<NodeType, NodeType, Callback> join(callback);
+        const auto& children = node->getChildren();
+        for (size_t i = 0; i < children.size(); i++) {
+            selfJoinNode(children[i], height - 1, callback);
+            node->getBoxes().forEachIntersecting(children[i]->getBoundingBox(), [&](size_t j) {
+                if (j > i) {
+                    join.run({ children[i], children[j], height - 1, height - 1 });
+                }
+                return true;
+            });
+        }
+    }
+
+
+    /**
+     * Call callback(entryA, entryB) for every pair of entries of the trees whose bounding boxes intersect.
+     * Both trees are traversed together, so only pairs of intersecting subtrees are ever looked at
+     */
+    template<typename TreeA, typename TreeB, typename Callback>
+    void spatialJoin(const TreeA& treeA, const TreeB& treeB, Callback&& callback)
+    {
+        if (treeA.empty() || treeB.empty()) {
+            return;
+        }
+        using Join = SpatialJoin<typename TreeA::node_type, typename TreeB::node_type, std::remove_reference_t<Callback>>;
+        const auto rootA = treeA.getRoot();
+        const auto rootB = treeB.getRoot();
+        Join(callback).run({ rootA, rootB, rootA->height(), rootB->height() });
+    }
+
+    /**
+     * Same as spatialJoin(treeA, treeB, callback), but pairs of subtrees are joined by all threads of pool,
+     * which steal them from each other. Callback is called concurrently and in no particular order.
+     * The trees must not be modified until the join is done
+     */
+    template<typename TreeA, typename TreeB, typename Callback>
+    void spatialJoin(const TreeA& treeA, const TreeB& treeB, Callback&& callback, ThreadPool& pool)
+    {
+        if (treeA.empty() || treeB.empty()) {
+            return;
+        }
+        using Join = SpatialJoin<typename TreeA::node_type, typename TreeB::node_type, std::remove_reference_t<Callback>>;
+        const auto rootA = treeA.getRoot();
+        const auto rootB = treeB.getRoot();
+        Join(callback).run({ rootA, rootB, rootA->height(), rootB->height() }, pool);
+    }
+
+
+    // Set of intersecting entry pairs of a tree kept up to date from frame to frame.
+    // After the first update the tree records ids of the entries it changes, and the next update
+    // joins only those entries against the tree. Pairs of two unchanged entries can't appear
+    // or disappear, so only pairs involving changed entries are compared with the previous frame.
+    template<typename Tree>
+    class IncrementalSelfJoin
+    {
+    public:
+        using data_type = typename Tree::node_type::data_type;
+
+        /**
+         * Call added(a, b) for every pair of ids of intersecting entries that is new since the previous update
+         * and removed(a, b) for every pair that is gone. The first update reports all pairs as added.
+         * The same tree has to be passed every time, it is switched to tracking its changes
+         */
+        template<typename Added, typename Removed>
+        void update(Tree& tree, Added&& added, Removed&& removed);
+
+        /**
+         * Number of intersecting pairs found by the last update
+         */
+        size_t size() const { return _pairCount; }
+
+    private:
+        using Partners = std::unordered_map<data_type, std::vector<data_type>>;
+
+        template<typename Added, typename Removed>
+        void rebuild(const Tree& tree, Added& added, Removed& removed);
+        static bool contains(const std::vector<data_type>& ids, const data_type& id);
+        static void erase(std::vector<data_type>& ids, const data_type& id);
+
+        // Intersecting entries of every entry that has any, each pair is stored on both sides
+        Partners _partners;
+        size_t _pairCount = 0;
+        bool _tracking = false;
+    };
+
+
+    template<typename Tree>
+    template<typename Added, typename Removed>
+    void IncrementalSelfJoin<Tree>::update(Tree& tree, Added&& added, Removed&& removed)
+    {
+        const auto changes = _tracking ? tree.takeChanges() : std::nullopt;
+        if (!changes) {
+            rebuild(tree, added, removed);
+            tree.trackChanges(true);
+            _tracking = true;
+            return;
+        }
+
+        // Changed entries that are still in the tree are joined against the whole tree at once
+        std::vector<typename Tree::entry_type> moved;
+        std::unordered_set<data_type> changed;
+        for (const auto& id: *changes) {
+            if (changed.insert(id).second) {
+                if (const auto box = tree.getBoundingBox(id)) {
+                    moved.push_back({ *box, id });
+                }
+            }
+        }
+        Partners fresh;
+        Tree movedTree;
+        movedTree.bulkLoad(moved.begin(), moved.end());
+        spatialJoin(movedTree, tree, [&fresh](const auto& a, const auto& b) {
+            if (!(a.data == b.data)) {
+                fresh[a.data].push_back(b.data);
+            }
+        });
+
+        // Pair of two changed entries is compared when the first of them is processed
+        std::unordered_set<data_type> processed;
+        for (const auto& id: changed) {
+            const auto oldIt = _partners.find(id);
+            const auto freshIt = fresh.find(id);
+            const auto& oldPartners = oldIt != _partners.end() ? oldIt->second : std::vector<data_type>();
+            const auto& newPartners = freshIt != fresh.end() ? freshIt->second : std::vector<data_type>();
+            for (const auto& partner: oldPartners) {
+                if (!processed.count(partner) && !contains(newPartners, partner)) {
+                    removed(id, partner);
+                    _pairCount--;
+                    erase(_partners[partner], id);
+                    if (_partners[partner].empty()) {
+                        _partners.erase(partner);
+                    }
+                }
+            }
+            for (const auto& partner: newPartners) {
+                if (!processed.count(partner) && !contains(oldPartners, partner)) {
+                    added(id, partner);
+                    _pairCount++;
+                    if (!changed.count(partner)) {
+                        _partners[partner].push_back(id);
+                    }
+                }
+            }
+            processed.insert(id);
+            if (newPartners.empty()) {
+                _partners.erase(id);
+            }
+            else {
+                _partners[id] = newPartners;
+            }
+        }
+    }
+
+    template<typename Tree>
+    template<typename Added, typename Removed>
+    void IncrementalSelfJoin<Tree>::rebuild(const Tree& tree, Added& added, Removed& removed)
+    {
+        Partners fresh;
+        tree.selfJoin([&fresh](const auto& a, const auto& b) {
+            fresh[a.data].push_back(b.data);
+            fresh[b.data].push_back(a.data);
+        });
+
+        std::unordered_set<data_type> processed;
+        for (const auto& [id, partners]: _partners) {
+            const auto freshIt = fresh.find(id);
+            for (const auto& partner: partners) {
+                if (!processed.count(partner) && (freshIt == fresh.end() || !contains(freshIt->second, partner))) {
+                    removed(id, partner);
+                }
+            }
+            processed.insert(id);
+        }
+        processed.clear();
+        _pairCount = 0;
+        for (const auto& [id, partners]: fresh) {
+            const auto oldIt = _partners.find(id);
+            for (const auto& partner: partners) {
+                if (!processed.count(partner)) {
+                    _pairCount++;
+                    if (oldIt == _partners.end() || !contains(oldIt->second, partner)) {
+                        added(id, partner);
+                    }
+                }
+            }
+            processed.insert(id);
+        }
+        _partners = std::move(fresh);
+    }
+
+    template<typename Tree>
+    bool IncrementalSelfJoin<Tree>::contains(const std::vector<data_type>& ids, const data_type& id)
+    {
+        return std::find(ids.begin(), ids.end(), id) != ids.end();
+    }
+
+    template<typename Tree>
+    void IncrementalSelfJoin<Tree>::erase(std::vector<data_type>& ids, const data_type& id)
+    {
+        ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+    }
+} // namespace rtree
@@ -0,0 +1,405 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bounding_box.hpp"
+#include "node.hpp"
+
+
+namespace rtree
+{
+    // File written by freeze() and read by MappedTree:
+    // header, then all nodes in level order (root first), then all entries in the order of leaves.
+    // Children of a node and entries of a leaf are contiguous, so a node refers to them by the index
+    // of the first one and their count. Leaves are the last nodes, starting from leafStart.
+    // Numbers are stored in the byte order of the machine, the header records it to reject foreign files.
+    struct MappedHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::uint32_t coordSize;
+        std::uint32_t entrySize;
+        std::uint64_t nodeCount;
+        std::uint64_t leafStart;
+        std::uint64_t entryCount;
+        std::uint64_t nodesOffset;
+        std::uint64_t entriesOffset;
+    };
+
+    template<typename Coord>
+    struct MappedNode
+    {
+        Coord x;
+        Coord y;
+        Coord w;
+        Coord h;
+        // Index of the first child among nodes or of the first entry among entries for a leaf
+        std::uint64_t first;
+        std::uint64_t count;
+    };
+
+    template<typename DataType, typename Coord>
+    struct MappedEntry
+    {
+        Coord x;
+        Coord y;
+        Coord w;
+        Coord h;
+        DataType data;
+    };
+
+    constexpr char MappedMagic[8] = { 'R', 'T', 'R', 'E', 'E', 'M', 'A', 'P' };
+    constexpr std::uint32_t MappedVersion = 1;
+    constexpr std::uint32_t MappedByteOrder = 0x01020304;
+
+
+    /**
+     * Write tree to file path in the format of MappedTree. Ids have to be trivially copyable.
+     * Throws std::runtime_error if the file can't be written
+     */
+    template<typename Tree>
+    void freeze(const Tree& tree, const std::string& path);
+
+
+    // Read-only tree answering queries straight from a file written by freeze().
+    // The file is mapped into memory and nothing is deserialized, so opening it takes no time
+    // regardless of its size and processes mapping the same file share its pages.
+    // DataType and Coord have to be the same as the ones of the frozen tree.
+    // Queries throw std::runtime_error when they reach a node that refers outside of the file.
+    template<typename DataType, typename Coord = double>
+    class MappedTree
+    {
+    public:
+        using entry_type = Entry<DataType, Coord>;
+        using box_type = BasicBoundingBox<Coord>;
+        using point_type = BasicPoint<Coord>;
+
+        /**
+         * Map file path. Throws std::runtime_error if it can't be mapped or isn't a tree of these types
+         */
+        explicit MappedTree(const std::string& path);
+        MappedTree(const MappedTree&) = delete;
+        MappedTree(MappedTree&& other) noexcept;
+        ~MappedTree() { unmap(); }
+
+        MappedTree& operator=(const MappedTree&) = delete;
+        MappedTree& operator=(MappedTree&& other) noexcept;
+
+        bool empty() const { return size() == 0; }
+        size_t size() const { return _header ? _header->entryCount : 0; }
+        /**
+         * Find all entries whose bounding boxes are intersected by b
+         */
+        std::vector<entry_type> find(const box_type& b) const;
+        /**
+         * Call visitor for every entry whose bounding box is intersected by b.
+         * If visitor returns bool, returning false stops the query.
+         * Returns false if the query was stopped by visitor
+         */
+        template<typename Visitor>
+        bool query(const box_type& b, Visitor&& visitor) const;
+        /**
+         * Find at most k entries closest to p, ordered by distance
+         */
+        std::vector<entry_type> nearest(const point_type& p, size_t k) const;
+
+    private:
+        using node_record = MappedNode<Coord>;
+        using entry_record = MappedEntry<DataType, Coord>;
+
+        template<typename Visitor>
+        bool queryNode(size_t node, const box_type& b, Visitor& visitor) const;
+        /**
+         * Record of node whose children (or entries) lie inside the file, children after the node itself.
+         * Records are checked as they are reached rather than all at once on opening, which would read the whole file.
+         * Throws std::runtime_error if the record is corrupted
+         */
+        const node_record& nodeAt(size_t node) const;
+        void unmap();
+
+        template<typename Record>
+        static box_type boxOf(const Record& record) { return box_type(record.x, record.y, record.w, record.h); }
+        static entry_type entryOf(const entry_record& record) { return { boxOf(record), record.data }; }
+
+        void* _mapping = nullptr;
+        size_t _length = 0;
+        const MappedHeader* _header = nullptr;
+        const node_record* _nodes = nullptr;
+        const entry_record* _entries = nullptr;
+    };
+
+
+    template<typename Tree>
+    void freeze(const Tree& tree, const std::string& path)
+    {
+        using data_type = typename Tree::node_type::data_type;
+        using coord_type = typename Tree::node_type::coord_type;
+        using node_record = MappedNode<coord_type>;
+        using entry_record = MappedEntry<data_type, coord_type>;
+        static_assert(std::is_trivially_copyable<data_type>::value, "Only trivially copyable ids can be written to a file.");
+
+        // Level order puts children of every node next to each other and all leaves at the end
+        std::vector<const typename Tree::node_type*> order;
+        std::vector<node_record> nodes;
+        std::vector<entry_record> entries;
+        if (tree.getRoot()) {
+            order.push_back(tree.getRoot());
+        }
+        size_t leafStart = 0;
+        for (size_t i = 0; i < order.size(); i++) {
+            const auto node = order[i];
+            const auto& box = node->getBoundingBox();
+            node_record record {};
+            record.x = box.x;
+            record.y = box.y;
+            record.w = box.w;
+            record.h = box.h;
+            record.count = node->size();
+            if (node->isLeaf()) {
+                if (!leafStart) {
+                    leafStart = i;
+                }
+                record.first = entries.size();
+                for (const auto& entry: node->getEntries()) {
+                    entry_record e {};
+                    e.x = entry.box.x;
+                    e.y = entry.box.y;
+                    e.w = entry.box.w;
+                    e.h = entry.box.h;
+                    e.data = entry.data;
+                    entries.push_back(e);
+                }
+            }
+            else {
+                record.first = order.size();
+                order.insert(order.end(), node->getChildren().begin(), node->getChildren().end());
+            }
+            nodes.push_back(record);
+        }
+
+        const auto align = [](std::uint64_t offset, std::uint64_t alignment) { return (offset + alignment - 1) / alignment * alignment; };
+        MappedHeader header {};
+        std::memcpy(header.magic, MappedMagic, sizeof(header.magic));
+        header.version = MappedVersion;
+        header.byteOrder = MappedByteOrder;
+        header.coordSize = sizeof(coord_type);
+        header.entrySize = sizeof(entry_record);
+        header.nodeCount = nodes.size();
+        header.leafStart = leafStart;
+        header.entryCount = entries.size();
+        header.nodesOffset = align(sizeof(MappedHeader), alignof(node_record));
+        header.entriesOffset = align(header.nodesOffset + nodes.size() * sizeof(node_record), alignof(entry_record));
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        const auto pad = [&file](std::uint64_t offset) {
+            const std::vector<char> zeros(offset - std::uint64_t(file.tellp()), 0);
+            file.write(zeros.data(), zeros.size());
+        };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        pad(header.nodesOffset);
+        file.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(node_record));
+        pad(header.entriesOffset);
+        file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(entry_record));
+        file.close();
+        if (!file) {
+            throw std::runtime_error("freeze() error: can't write " + path);
+        }
+    }
+
+
+    template<typename DataType, typename Coord>
+    MappedTree<DataType, Coord>::MappedTree(const std::string& path)
+    {
+        static_assert(std::is_trivially_copyable<DataType>::value, "Only trivially copyable ids can be read from a file.");
+
+        const auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("MappedTree error: can't open " + path);
+        }
+        struct stat status;
+        if (::fstat(fd, &status) != 0 || size_t(status.st_size) < sizeof(MappedHeader)) {
+            ::close(fd);
+            throw std::runtime_error("MappedTree error: " + path + " is not a tree file");
+        }
+        _length = status.st_size;
+        _mapping = ::mmap(nullptr, _length, PROT_READ, MAP_SHARED, fd, 0);
+        // Mapping stays valid after the descriptor is closed
+        ::close(fd);
+        if (_mapping == MAP_FAILED) {
+            _mapping = nullptr;
+            throw std::runtime_error("MappedTree error: can't map " + path);
+        }
+
+        const auto bytes = static_cast<const char*>(_mapping);
+        _header = reinterpret_cast<const MappedHeader*>(bytes);
+        // Sizes are compared by division, so that corrupted counts can't overflow
+        const auto fits = [this](std::uint64_t offset, std::uint64_t count, size_t size, size_t alignment) {
+            return offset % alignment == 0 && offset <= _length && count <= (_length - offset) / size;
+        };
+        const bool valid = std::memcmp(_header->magic, MappedMagic, sizeof(MappedMagic)) == 0 &&
+            _header->version == MappedVersion && _header->byteOrder == MappedByteOrder &&
+            _header->coordSize == sizeof(Coord) && _header->entrySize == sizeof(entry_record) &&
+            fits(_header->nodesOffset, _header->nodeCount, sizeof(node_record), alignof(node_record)) &&
+            fits(_header->entriesOffset, _header->entryCount, sizeof(entry_record), alignof(entry_record)) &&
+            _header->leafStart <= _header->nodeCount;
+        if (!valid) {
+            unmap();
+            throw std::runtime_error("MappedTree error: " + path + " is not a tree file of these types");
+        }
+        _nodes = reinterpret_cast<const node_record*>(bytes + _header->nodesOffset);
+        _entries = reinterpret_cast<const entry_record*>(bytes + _header->entriesOffset);
+    }
+
+    template<typename DataType, typename Coord>
+    MappedTree<DataType, Coord>::MappedTree(MappedTree&& other) noexcept
+        : _mapping(std::exchange(other._mapping, nullptr)),
+          _length(std::exchange(other._length, 0)),
+          _header(std::exchange(other._header, nullptr)),
+          _nodes(std::exchange(other._nodes, nullptr)),
+          _entries(std::exchange(other._entries, nullptr))
+    {
+    }
+
+    template<typename DataType, typename Coord>
+    MappedTree<DataType, Coord>& MappedTree<DataType, Coord>::operator=(MappedTree&& other) noexcept
+    {
+        if (this != &other) {
+            unmap();
+            _mapping = std::exchange(other._mapping, nullptr);
+            _length = std::exchange(other._length, 0);
+            _header = std::exchange(other._header, nullptr);
+            _nodes = std::exchange(other._nodes, nullptr);
+            _entries = std::exchange(other._entries, nullptr);
+        }
+        return *this;
+    }
+
+    template<typename DataType, typename Coord>
+    auto MappedTree<DataType, Coord>::find(const box_type& b) const -> std::vector<entry_type>
+    {
+        std::vector<entry_type> found;
+        query(b, [&found](const entry_type& entry) { found.push_back(entry); });
+        return found;
+    }
+
+    template<typename DataType, typename Coord>
+    template<typename Visitor>
+    bool MappedTree<DataType, Coord>::query(const box_type& b, Visitor&& visitor) const
+    {
+        if (!_header || _header->nodeCount == 0) {
+            return true;
+        }
+        return queryNode(0, b, visitor);
+    }
+
+    template<typename DataType, typename Coord>
+    template<typename Visitor>
+    bool MappedTree<DataType, Coord>::queryNode(size_t node, const box_type& b, Visitor& visitor) const
+    {
+        const auto& record = nodeAt(node);
+        if (!boxOf(record).intersects(b)) {
+            return true;
+        }
+        const auto end = record.first + record.count;
+        if (node >= _header->leafStart) {
+            for (auto i = record.first; i < end; i++) {
+                if (!boxOf(_entries[i]).intersects(b)) {
+                    continue;
+                }
+                if constexpr (std::is_same<std::invoke_result_t<Visitor&, const entry_type&>, bool>::value) {
+                    if (!visitor(entryOf(_entries[i]))) {
+                        return false;
+                    }
+                }
+                else {
+                    visitor(entryOf(_entries[i]));
+                }
+            }
+            return true;
+        }
+        for (auto i = record.first; i < end; i++) {
+            if (!queryNode(i, b, visitor)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<typename DataType, typename Coord>
+    auto MappedTree<DataType, Coord>::nearest(const point_type& p, size_t k) const -> std::vector<entry_type>
+    {
+        std::vector<entry_type> closest;
+        if (!_header || _header->nodeCount == 0 || k == 0) {
+            return closest;
+        }
+
+        // Same best-first order as Tree::nearest(), records are referred to by their indices
+        struct Candidate
+        {
+            double distance;
+            size_t index;
+            bool isEntry;
+
+            bool operator>(const Candidate& other) const { return distance > other.distance; }
+        };
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> queue;
+        queue.push({ boxOf(_nodes[0]).squaredDistance(p), 0, false });
+        while (!queue.empty() && closest.size() < k) {
+            const auto candidate = queue.top();
+            queue.pop();
+            if (candidate.isEntry) {
+                closest.push_back(entryOf(_entries[candidate.index]));
+                continue;
+            }
+            const auto& record = nodeAt(candidate.index);
+            const bool isLeaf = candidate.index >= _header->leafStart;
+            for (auto i = record.first; i < record.first + record.count; i++) {
+                const auto distance = isLeaf ? boxOf(_entries[i]).squaredDistance(p) : boxOf(_nodes[i]).squaredDistance(p);
+                queue.push({ distance, i, isLeaf });
+            }
+        }
+        return closest;
+    }
+
+    template<typename DataType, typename Coord>
+    auto MappedTree<DataType, Coord>::nodeAt(size_t node) const -> const node_record&
+    {
+        const auto& record = _nodes[node];
+        const bool isLeaf = node >= _header->leafStart;
+        const std::uint64_t limit = isLeaf ? _header->entryCount : _header->nodeCount;
+        // Children follow their parent in level order, which also rules out cycles
+        const bool valid = record.first <= limit && record.count <= limit - record.first && (isLeaf || record.first > node);
+        if (!valid) {
+            throw std::runtime_error("MappedTree error: node " + std::to_string(node) + " is corrupted");
+        }
+        return record;
+    }
+
+    template<typename DataType, typename Coord>
+    void MappedTree<DataType, Coord>::unmap()
+    {
+        if (_mapping) {
+            ::munmap(_mapping, _length);
+        }
+        _mapping = nullptr;
+        _length = 0;
+        _header = nullptr;
+        _nodes = nullptr;
+        _entries = nullptr;
+    }
+} // namespace rtree
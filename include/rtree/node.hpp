@@ -1,119 +1,240 @@
 #pragma once
 #include <algorithm>
-#include <memory>
+#include <cstdint>
+#include <type_traits>
 #include <vector>
 
-#include "bounding_box.h"
+#include "aggregate.hpp"
+#include "bounding_box.hpp"
+#include "box_array.hpp"
+#include "hilbert.hpp"
+#include "node_pool.hpp"
+#include "spin_lock.hpp"
+#include "static_vector.hpp"
 
 
 namespace rtree
 {
-    template<typename DataType>
+    template<typename DataType, size_t Capacity = DynamicCapacity, typename Coord = double, typename Aggregate = NoAggregate,
+             typename Lock = NoLock>
     class Node;
 
-    template<typename DataType>
-    using node_ptr = std::shared_ptr<Node<DataType>>;
+    // Nodes are owned by NodePool of the tree, so links between them are plain pointers
+    template<typename DataType, size_t Capacity = DynamicCapacity, typename Coord = double, typename Aggregate = NoAggregate,
+             typename Lock = NoLock>
+    using node_ptr = Node<DataType, Capacity, Coord, Aggregate, Lock>*;
 
 
-    template<typename DataType>
+    template<typename DataType, typename Coord = double>
     struct Entry
     {
-        BoundingBox box;
+        BasicBoundingBox<Coord> box;
         DataType data;
 
         bool operator==(const Entry& other) const { return box == other.box && data == other.data; }
     };
 
 
-    template<typename DataType>
+    template<typename DataType, typename Coord>
+    const BasicBoundingBox<Coord>& boxOf(const Entry<DataType, Coord>& entry)
+    {
+        return entry.box;
+    }
+
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    const BasicBoundingBox<Coord>& boxOf(const Node<DataType, Capacity, Coord, Aggregate, Lock>* node)
+    {
+        return node->getBoundingBox();
+    }
+
+
+    // Node with Capacity other than DynamicCapacity keeps its entries, children and their boxes
+    // in inline arrays, so the whole node is a single fixed-size block without heap allocations.
+    // Capacity has to leave room for one extra item that overflows the node before it is split.
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
     class Node
     {
-        using split_result = std::pair<node_ptr<DataType>, node_ptr<DataType>>;
     public:
+        using data_type = DataType;
+        using coord_type = Coord;
+        using box_type = BasicBoundingBox<Coord>;
+        using entry_type = Entry<DataType, Coord>;
+        // Lock other than NoLock is kept by the pool next to every node, see NodePool
+        using pool_type = NodePool<Node, Lock>;
+        using children_type = NodeStorage<Node*, Capacity>;
+        using entries_type = NodeStorage<entry_type, Capacity>;
+        using aggregate_type = SubtreeAggregate<Aggregate>;
+
+        static constexpr size_t capacity = Capacity;
+        // Whether nodes keep the number of entries and the aggregate value of their subtrees
+        static constexpr bool aggregated = !std::is_same<Aggregate, NoAggregate>::value;
+
         Node() {}
-        explicit Node(node_ptr<DataType> child); // TODO: rework because this can be thought of as a copy constructor
-        explicit Node(Entry<DataType> entry);
+        explicit Node(Node* child); // TODO: rework because this can be thought of as a copy constructor
+        explicit Node(entry_type entry);
 
-        static node_ptr<DataType> makeEmpty() { return std::make_shared<Node<DataType>>(); }
-        static node_ptr<DataType> makeNode(node_ptr<DataType> child) { return std::make_shared<Node<DataType>>(child); }
-        static node_ptr<DataType> makeNode(Entry<DataType> entry) { return std::make_shared<Node<DataType>>(entry); }
+        static Node* makeEmpty(pool_type& pool) { return pool.make(); }
+        static Node* makeNode(pool_type& pool, Node* child);
+        static Node* makeNode(pool_type& pool, entry_type entry) { return pool.make(entry); }
 
         template <typename Iter>
-        static node_ptr<DataType> makeInner(Iter begin, Iter end);
+        static Node* makeInner(pool_type& pool, Iter begin, Iter end);
 
         template <typename Iter>
-        static node_ptr<DataType> makeLeaf(Iter begin, Iter end);
-
-        void expandBoundingBox(BoundingBox b);
-        void insert(const Entry<DataType>& e);
-        bool remove(const Entry<DataType>& e);
+        static Node* makeLeaf(pool_type& pool, Iter begin, Iter end);
+
+        void expandBoundingBox(box_type b);
+        /**
+         * Add entry to a leaf. Unless propagate is false, bounding boxes of the leaf and all its ancestors
+         * are expanded to hold the entry, otherwise it is up to the caller to keep them covering it
+         */
+        void insert(const entry_type& e, bool propagate = true);
+        bool remove(const entry_type& e);
         bool remove(DataType data);
-        void insertChild(node_ptr<DataType> node);
-        void removeChild(node_ptr<DataType> node);
-        void setParent(node_ptr<DataType> node) { _parent = node; }
-        split_result split();
+        /**
+         * Remove entry at position i of a leaf. The last entry takes its place, so only its position changes.
+         * Unless propagate is false, bounding boxes of the leaf and all its ancestors are shrunk afterwards
+         */
+        void removeAt(size_t i, bool propagate = true);
+        /**
+         * Replace the box of entry at position i of a leaf.
+         * Bounding boxes of the leaf and its ancestors are left as they are, it is up to the caller to keep them covering it
+         */
+        void setEntryBox(size_t i, const box_type& b);
+        /**
+         * Replace the id of entry at position i of a leaf by an equal one, e.g. one carrying another weight.
+         * Aggregates of the leaf and all its ancestors are recomputed
+         */
+        void setEntryData(size_t i, const DataType& data);
+        /**
+         * Attach node as the last child. Unless propagate is false, bounding boxes of this node
+         * and all its ancestors are expanded to hold it
+         */
+        void insertChild(Node* node, bool propagate = true);
+        /**
+         * Detach child node. Unless propagate is false, bounding boxes of this node and all its ancestors are shrunk
+         */
+        void removeChild(Node* node, bool propagate = true);
+        void setParent(Node* node) { _parent = node; }
+        void setLargestHilbertValue(std::uint64_t value) { _largestHilbertValue = value; }
+        /**
+         * Recompute bounding box (and aggregate) of the node from its items, ancestors are left as they are
+         */
+        void updateBoundingBox();
         void updateBoundingBoxes();
 
-        size_t                                 depth() const;
-        const BoundingBox&                     getBoundingBox() const { return _boundingBox; }
-        const std::vector<node_ptr<DataType>>& getChildren() const { return _children; }
-        const std::vector<Entry<DataType>>&    getEntries() const { return _entries; }
-        node_ptr<DataType>                     getParent() const { return _parent; }
-        bool                                   isLeaf() const { return !_entries.empty(); }
-        size_t                                 size() const { return isLeaf() ? _entries.size() : _children.size(); }
+        size_t                           depth() const;
+        size_t                           height() const;
+        const box_type&                  getBoundingBox() const { return _boundingBox; }
+        const BoxArray<Capacity, Coord>& getBoxes() const { return _boxes; }
+        const children_type&             getChildren() const { return _children; }
+        const entries_type&              getEntries() const { return _entries; }
+        Node*                            getParent() const { return _parent; }
+        std::uint64_t                    getLargestHilbertValue() const { return _largestHilbertValue; }
+        /**
+         * Number of entries in the subtree of the node and their aggregate value, unless Aggregate is NoAggregate
+         */
+        const aggregate_type&            getAggregate() const { return _aggregate; }
+        bool                             isLeaf() const { return !_entries.empty(); }
+        size_t                           size() const { return isLeaf() ? _entries.size() : _children.size(); }
+        /**
+         * Whether the node or any node below it was modified since resetChanged() was called on it.
+         * New nodes are changed, so the flag is never reset unless someone keeps copies of the nodes
+         */
+        bool                             isChanged() const { return _changed; }
+        void                             resetChanged() const { _changed = false; }
 
     private:
-        BoundingBox _boundingBox;
-        node_ptr<DataType> _parent;
-        std::vector<node_ptr<DataType>> _children;
-        std::vector<Entry<DataType>> _entries;
-
-        split_result splitInner();
-        split_result splitLeaf();
-        void updateBoundingBox();
+        box_type _boundingBox;
+        Node* _parent = nullptr;
+        children_type _children;
+        entries_type _entries;
+        // Bounding boxes of entries (for leaf) or children (for inner node) in the same order
+        BoxArray<Capacity, Coord> _boxes;
+        // Position of the node among children of its parent
+        size_t _slot = 0;
+        // Maintained only by Hilbert-ordered split strategy
+        std::uint64_t _largestHilbertValue = UnknownHilbertValue;
+        // Insertions add to aggregates of ancestors on the way up, removals recompute them from items
+        aggregate_type _aggregate;
+        // Bookkeeping of the owner of node copies rather than the state of the node, hence mutable
+        mutable bool _changed = true;
+
+        void setBoundingBox(const box_type& b);
+        /**
+         * Mark the node and its ancestors as changed. Ancestors of a changed node are always changed too,
+         * so the walk stops at the first one that is already marked
+         */
+        void markChanged();
+        void rebuildBoxes();
+        void updateAggregate();
+        /**
+         * Add aggregate of new items of the node to the node and its ancestors.
+         * The walk stops at the first node that isn't attached to its parent yet:
+         * halves made by split strategies point at the parent of the split node before they replace it
+         */
+        void addAggregate(const aggregate_type& added);
     };
 
 
-    template<typename DataType>
-    Node<DataType>::Node(node_ptr<DataType> child)
-        : _boundingBox(child->getBoundingBox()), _children({ child })
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    Node<DataType, Capacity, Coord, Aggregate, Lock>::Node(node_ptr<DataType, Capacity, Coord, Aggregate, Lock> child)
+        : _boundingBox(child->getBoundingBox()), _children({ child }), _aggregate(child->_aggregate)
     {
+        child->_slot = 0;
+        _boxes.push_back(child->getBoundingBox());
     }
 
-    template<typename DataType>
-    Node<DataType>::Node(Entry<DataType> entry)
-        : _boundingBox(entry.box), _entries({ entry })
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    Node<DataType, Capacity, Coord, Aggregate, Lock>::Node(Entry<DataType, Coord> entry)
+        : _boundingBox(entry.box), _entries({ entry }), _aggregate(aggregate_type::of(entry.data))
     {
+        _boxes.push_back(entry.box);
     }
 
-    template<typename DataType>
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    node_ptr<DataType, Capacity, Coord, Aggregate, Lock> Node<DataType, Capacity, Coord, Aggregate, Lock>::makeNode(pool_type& pool, node_ptr<DataType, Capacity, Coord, Aggregate, Lock> child)
+    {
+        const auto node = pool.make(child);
+        child->setParent(node);
+        return node;
+    }
+
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
     template <typename Iter>
-    node_ptr<DataType> Node<DataType>::makeInner(Iter begin, Iter end)
+    node_ptr<DataType, Capacity, Coord, Aggregate, Lock> Node<DataType, Capacity, Coord, Aggregate, Lock>::makeInner(pool_type& pool, Iter begin, Iter end)
     {
-        const auto node = Node<DataType>::makeEmpty();
+        const auto node = Node<DataType, Capacity, Coord, Aggregate, Lock>::makeEmpty(pool);
         std::for_each(begin, end, [&](const auto& child) { node->insertChild(child); });
         return node;
     }
 
-    template<typename DataType>
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
     template <typename Iter>
-    node_ptr<DataType> Node<DataType>::makeLeaf(Iter begin, Iter end)
+    node_ptr<DataType, Capacity, Coord, Aggregate, Lock> Node<DataType, Capacity, Coord, Aggregate, Lock>::makeLeaf(pool_type& pool, Iter begin, Iter end)
     {
-        const auto node = Node<DataType>::makeEmpty();
+        const auto node = Node<DataType, Capacity, Coord, Aggregate, Lock>::makeEmpty(pool);
         std::for_each(begin, end, [&](const auto& entry) { node->insert(entry); });
         return node;
     }
 
-    template<typename DataType>
-    void Node<DataType>::expandBoundingBox(BoundingBox b)
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::expandBoundingBox(box_type b)
     {
-        _boundingBox = _boundingBox & b;
+        setBoundingBox(_boundingBox & b);
     }
 
-    template<typename DataType>
-    void Node<DataType>::insert(const Entry<DataType>& e)
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::insert(const Entry<DataType, Coord>& e, bool propagate)
     {
         _entries.push_back(e);
+        _boxes.push_back(e.box);
+        markChanged();
+        if (!propagate) {
+            _aggregate.add(aggregate_type::of(e.data));
+            return;
+        }
+        addAggregate(aggregate_type::of(e.data));
         expandBoundingBox(e.box);
         auto node = _parent;
         while (node) {
@@ -122,31 +243,80 @@ namespace rtree
         }
     }
 
-    template<typename DataType>
-    bool Node<DataType>::remove(const Entry<DataType>& e)
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    bool Node<DataType, Capacity, Coord, Aggregate, Lock>::remove(const Entry<DataType, Coord>& e)
     {
         const auto toErase = std::remove(_entries.begin(), _entries.end(), e);
         bool removed = toErase != _entries.end();
         _entries.erase(toErase, _entries.end());
+        markChanged();
+        rebuildBoxes();
         updateBoundingBoxes();
         return removed;
     }
 
-    template<typename DataType>
-    bool Node<DataType>::remove(DataType data)
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    bool Node<DataType, Capacity, Coord, Aggregate, Lock>::remove(DataType data)
     {
         const auto toErase = std::remove_if(_entries.begin(), _entries.end(),
             [&data](const auto& entry) { return entry.data == data; });
         bool removed = toErase != _entries.end();
         _entries.erase(toErase, _entries.end());
+        markChanged();
+        rebuildBoxes();
         updateBoundingBoxes();
         return removed;
     }
 
-    template<typename DataType>
-    void Node<DataType>::insertChild(node_ptr<DataType> n)
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::removeAt(size_t i, bool propagate)
     {
+        if (i + 1 != _entries.size()) {
+            _entries[i] = _entries.back();
+            _boxes.set(i, _entries[i].box);
+        }
+        _entries.pop_back();
+        _boxes.pop_back();
+        markChanged();
+        if (propagate) {
+            updateBoundingBoxes();
+        }
+        else {
+            updateAggregate();
+        }
+    }
+
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::setEntryBox(size_t i, const box_type& b)
+    {
+        _entries[i].box = b;
+        _boxes.set(i, b);
+        markChanged();
+    }
+
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::setEntryData(size_t i, const DataType& data)
+    {
+        _entries[i].data = data;
+        markChanged();
+        for (auto node = this; node; node = node->_parent) {
+            node->updateAggregate();
+        }
+    }
+
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::insertChild(node_ptr<DataType, Capacity, Coord, Aggregate, Lock> n, bool propagate)
+    {
+        n->_slot = _children.size();
         _children.push_back(n);
+        _boxes.push_back(n->getBoundingBox());
+        n->setParent(this);
+        markChanged();
+        if (!propagate) {
+            _aggregate.add(n->_aggregate);
+            return;
+        }
+        addAggregate(n->_aggregate);
         expandBoundingBox(n->getBoundingBox());
         auto node = _parent;
         while (node) {
@@ -155,30 +325,22 @@ namespace rtree
         }
     }
 
-    template<typename DataType>
-    void Node<DataType>::removeChild(node_ptr<DataType> n)
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::removeChild(node_ptr<DataType, Capacity, Coord, Aggregate, Lock> n, bool propagate)
     {
         _children.erase(std::remove(_children.begin(), _children.end(), n), _children.end());
-        updateBoundingBoxes();
-    }
-
-    template<typename DataType>
-    typename Node<DataType>::split_result Node<DataType>::split()
-    {
-        if (_entries.size() <= 1 && _children.size() <= 1) {
-            return std::make_pair(nullptr, nullptr);
-        }
-
-        if (isLeaf()) {
-            return splitLeaf();
+        markChanged();
+        rebuildBoxes();
+        if (propagate) {
+            updateBoundingBoxes();
         }
-        else { // not leaf
-            return splitInner();
+        else {
+            updateAggregate();
         }
     }
 
-    template<typename DataType>
-    void Node<DataType>::updateBoundingBoxes()
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::updateBoundingBoxes()
     {
         updateBoundingBox();
         auto node = _parent;
@@ -188,8 +350,8 @@ namespace rtree
         }
     }
 
-    template<typename DataType>
-    size_t Node<DataType>::depth() const
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    size_t Node<DataType, Capacity, Coord, Aggregate, Lock>::depth() const
     {
         size_t d = 0;
         auto parent = getParent();
@@ -200,83 +362,41 @@ namespace rtree
         return d;
     }
 
-    template<typename DataType>
-    typename Node<DataType>::split_result Node<DataType>::splitInner()
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    size_t Node<DataType, Capacity, Coord, Aggregate, Lock>::height() const
     {
-        std::pair<node_ptr<DataType>, node_ptr<DataType>> firstChildNodes = std::make_pair(nullptr, nullptr);
-        double maxDistance = -1.0;
-        for (auto it1 = _children.begin(); it1 != _children.end(); it1++) {
-            for (auto it2 = std::next(it1); it2 != _children.end(); it2++) {
-                const auto d = (*it1)->getBoundingBox().distance((*it2)->getBoundingBox());
-                if (maxDistance == -1.0 || d > maxDistance) {
-                    firstChildNodes = std::make_pair(*it1, *it2);
-                    maxDistance = d;
-                }
-            }
-        }
-        _children.erase(std::remove(_children.begin(), _children.end(), firstChildNodes.first), _children.end());
-        _children.erase(std::remove(_children.begin(), _children.end(), firstChildNodes.second), _children.end());
-        // This causes compilation error "declared using local type ... is used but never defined [-fpermissive]"
-        // _children.erase(std::remove_if(_children.begin(), _children.end(),
-        //         [&](const node_ptr<DataType>& child) { return child == firstChildNodes.first || child == firstChildNodes.second; }),
-        //     _children.end()); // maybe make a copy of _children to be able to revert easily
-
-        split_result ret = std::make_pair(makeNode(firstChildNodes.first), makeNode(firstChildNodes.second));
-        ret.first->setParent(getParent());
-        ret.second->setParent(getParent());
-        std::random_shuffle(std::begin(_children), std::end(_children));
-        for (const auto& child: _children) {
-            if ((ret.first->getBoundingBox() & child->getBoundingBox()).area() <
-                (ret.second->getBoundingBox() & child->getBoundingBox()).area()) {
-                ret.first->insertChild(child);
-            }
-            else {
-                ret.second->insertChild(child);
-            }
+        size_t h = 0;
+        auto node = this;
+        while (!node->isLeaf() && !node->getChildren().empty()) {
+            h++;
+            node = node->getChildren().front();
         }
-        return ret;
+        return h;
     }
 
-    template<typename DataType>
-    typename Node<DataType>::split_result Node<DataType>::splitLeaf()
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::setBoundingBox(const box_type& b)
     {
-        std::pair<Entry<DataType>, Entry<DataType>> firstEntries;
-        double maxDistance = -1.0;
-        for (auto it1 = _entries.begin(); it1 != _entries.end(); it1++) {
-            for (auto it2 = std::next(it1); it2 != _entries.end(); it2++) {
-                const auto d = it1->box.distance(it2->box);
-                if (maxDistance == -1.0 || d > maxDistance) {
-                    firstEntries = std::make_pair(*it1, *it2);
-                    maxDistance = d;
-                }
-            }
+        _boundingBox = b;
+        markChanged();
+        // Parent keeps its own copy of the box unless the node isn`t attached to it yet
+        if (_parent && _slot < _parent->_children.size() && _parent->_children[_slot] == this) {
+            _parent->_boxes.set(_slot, b);
         }
-        _entries.erase(std::remove(_entries.begin(), _entries.end(), firstEntries.first), _entries.end());
-        _entries.erase(std::remove(_entries.begin(), _entries.end(), firstEntries.second), _entries.end());
-        // This causes compilation error "declared using local type ... is used but never defined [-fpermissive]"
-        // _entries.erase(std::remove_if(_entries.begin(), _entries.end(),
-        //         [&](const Entry<DataType>& entry) { return entry == firstEntries.first || entry == firstEntries.second; }),
-        //     _entries.end());
-        
-        split_result ret = std::make_pair(makeNode(firstEntries.first), makeNode(firstEntries.second));
-        ret.first->setParent(getParent());
-        ret.second->setParent(getParent());
-        std::random_shuffle(std::begin(_entries), std::end(_entries));
-        for (const auto& entry: _entries) {
-            if ((ret.first->getBoundingBox() & entry.box).area() <
-                (ret.second->getBoundingBox() & entry.box).area()) {
-                ret.first->insert(entry);
-            }
-            else {
-                ret.second->insert(entry);
-            }
+    }
+
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::markChanged()
+    {
+        for (auto node = this; node && !node->_changed; node = node->_parent) {
+            node->_changed = true;
         }
-        return ret;
     }
 
-    template<typename DataType>
-    void Node<DataType>::updateBoundingBox()
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::updateBoundingBox()
     {
+        updateAggregate();
         if (_entries.empty() && _children.empty()) {
             return;
         }
@@ -286,14 +406,54 @@ namespace rtree
             for (const auto& entry: _entries) {
                 box = box & entry.box;
             }
-            _boundingBox = box;
+            setBoundingBox(box);
         }
         else {
             auto box = _children.front()->getBoundingBox();
             for (const auto& child: _children) {
                 box = box & child->getBoundingBox();
             }
-            _boundingBox = box;
+            setBoundingBox(box);
+        }
+    }
+
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::rebuildBoxes()
+    {
+        _boxes.clear();
+        for (const auto& entry: _entries) {
+            _boxes.push_back(entry.box);
+        }
+        for (size_t i = 0; i < _children.size(); i++) {
+            _children[i]->_slot = i;
+            _boxes.push_back(_children[i]->getBoundingBox());
+        }
+    }
+
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::updateAggregate()
+    {
+        if constexpr (aggregated) {
+            aggregate_type aggregate;
+            for (const auto& entry: _entries) {
+                aggregate.add(aggregate_type::of(entry.data));
+            }
+            for (const auto& child: _children) {
+                aggregate.add(child->_aggregate);
+            }
+            _aggregate = aggregate;
+        }
+    }
+
+    template<typename DataType, size_t Capacity, typename Coord, typename Aggregate, typename Lock>
+    void Node<DataType, Capacity, Coord, Aggregate, Lock>::addAggregate(const aggregate_type& added)
+    {
+        if constexpr (aggregated) {
+            _aggregate.add(added);
+            for (auto node = this; node->_parent && node->_slot < node->_parent->_children.size() &&
+                                   node->_parent->_children[node->_slot] == node; node = node->_parent) {
+                node->_parent->_aggregate.add(added);
+            }
         }
     }
-} // namespace rtree
\ No newline at end of file
+} // namespace rtree
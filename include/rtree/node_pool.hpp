@@ -0,0 +1,151 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "spin_lock.hpp"
+
+
+namespace rtree
+{
+    // Slab allocator that owns all nodes of a tree.
+    // Nodes are constructed in place inside fixed-size slabs and freed slots are reused
+    // through an intrusive free list, so allocation never touches the global heap
+    // once the pool has grown to the size of the tree.
+    // Lock other than NoLock is kept in every slot next to the node. It belongs to the slot rather than
+    // to the node, so it isn't reset when a freed slot gets a new node: a version lock goes on counting versions
+    // and threads still looking at the old node can tell that it is gone.
+    template<typename NodeType, typename Lock = NoLock>
+    class NodePool
+    {
+    public:
+        static constexpr size_t SlabSize = 256;
+
+        NodePool() = default;
+        NodePool(const NodePool&) = delete;
+        NodePool(NodePool&& other) noexcept;
+        ~NodePool() { release(); }
+
+        NodePool& operator=(const NodePool&) = delete;
+        NodePool& operator=(NodePool&& other) noexcept;
+
+        template<typename... Args>
+        NodeType* make(Args&&... args);
+        void destroy(NodeType* node);
+        /**
+         * Free all slabs at once without calling destructors of nodes that are still alive
+         */
+        void release();
+
+        size_t size() const { return _size; }
+        /**
+         * Lock of the slot of node. It stays valid after the node is destroyed as long as the pool keeps its slabs
+         */
+        static Lock& getLock(const NodeType* node);
+
+    private:
+        union Slot
+        {
+            Slot* next;
+            alignas(NodeType) unsigned char storage[sizeof(NodeType)];
+        };
+
+        struct LockedSlot
+        {
+            Slot slot;
+            Lock lock;
+        };
+
+        static constexpr bool Locked = !std::is_same<Lock, NoLock>::value;
+        using SlabItem = std::conditional_t<Locked, LockedSlot, Slot>;
+
+        static Slot* slotOf(Slot& item) { return &item; }
+        static Slot* slotOf(LockedSlot& item) { return &item.slot; }
+
+        std::vector<std::unique_ptr<SlabItem[]>> _slabs;
+        Slot* _free = nullptr;
+        size_t _slabUsed = SlabSize;
+        size_t _size = 0;
+    };
+
+
+    template<typename NodeType, typename Lock>
+    NodePool<NodeType, Lock>::NodePool(NodePool&& other) noexcept
+        : _slabs(std::move(other._slabs)),
+          _free(std::exchange(other._free, nullptr)),
+          _slabUsed(std::exchange(other._slabUsed, SlabSize)),
+          _size(std::exchange(other._size, 0))
+    {
+    }
+
+    template<typename NodeType, typename Lock>
+    NodePool<NodeType, Lock>& NodePool<NodeType, Lock>::operator=(NodePool&& other) noexcept
+    {
+        if (this != &other) {
+            release();
+            _slabs = std::move(other._slabs);
+            _free = std::exchange(other._free, nullptr);
+            _slabUsed = std::exchange(other._slabUsed, SlabSize);
+            _size = std::exchange(other._size, 0);
+        }
+        return *this;
+    }
+
+    template<typename NodeType, typename Lock>
+    template<typename... Args>
+    NodeType* NodePool<NodeType, Lock>::make(Args&&... args)
+    {
+        Slot* slot = nullptr;
+        if (_free) {
+            slot = _free;
+            _free = _free->next;
+        }
+        else {
+            if (_slabUsed == SlabSize) {
+                _slabs.emplace_back(new SlabItem[SlabSize]);
+                _slabUsed = 0;
+            }
+            slot = slotOf(_slabs.back()[_slabUsed++]);
+        }
+        try {
+            const auto node = new (slot->storage) NodeType(std::forward<Args>(args)...);
+            _size++;
+            return node;
+        }
+        catch (...) {
+            slot->next = _free;
+            _free = slot;
+            throw;
+        }
+    }
+
+    template<typename NodeType, typename Lock>
+    void NodePool<NodeType, Lock>::destroy(NodeType* node)
+    {
+        node->~NodeType();
+        const auto slot = reinterpret_cast<Slot*>(node);
+        slot->next = _free;
+        _free = slot;
+        _size--;
+    }
+
+    template<typename NodeType, typename Lock>
+    void NodePool<NodeType, Lock>::release()
+    {
+        _slabs.clear();
+        _free = nullptr;
+        _slabUsed = SlabSize;
+        _size = 0;
+    }
+
+    template<typename NodeType, typename Lock>
+    Lock& NodePool<NodeType, Lock>::getLock(const NodeType* node)
+    {
+        static_assert(Locked, "Nodes of the pool have no locks.");
+        // Node is built at the start of its slot and the slot at the start of LockedSlot
+        return reinterpret_cast<LockedSlot*>(const_cast<NodeType*>(node))->lock;
+    }
+} // namespace rtree
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bounding_box.hpp"
+#include "hilbert.hpp"
+#include "node.hpp"
+
+
+namespace rtree
+{
+    // Sort-Tile-Recursive packing.
+    // Items are sorted by x coordinate of their centers and cut into sqrt(P) vertical slices
+    // (P is the number of nodes needed for the level), then every slice is sorted by y coordinate
+    // so that consecutive runs of nodeCapacity items form square-like tiles.
+    class STRPacking
+    {
+    public:
+        template <typename Iter>
+        static void order(Iter begin, Iter end, size_t nodeCapacity);
+    };
+
+
+    template <typename Iter>
+    void STRPacking::order(Iter begin, Iter end, size_t nodeCapacity)
+    {
+        const size_t count = std::distance(begin, end);
+        if (count <= nodeCapacity) {
+            return;
+        }
+
+        const size_t nodeCount = (count + nodeCapacity - 1) / nodeCapacity;
+        const auto sliceCount = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(nodeCount))));
+        const size_t sliceSize = sliceCount * nodeCapacity;
+
+        std::sort(begin, end, [](const auto& l, const auto& r) {
+            return boxOf(l).center().x < boxOf(r).center().x;
+        });
+        for (auto slice = begin; slice != end;) {
+            const auto sliceEnd = std::next(slice, std::min<size_t>(sliceSize, std::distance(slice, end)));
+            std::sort(slice, sliceEnd, [](const auto& l, const auto& r) {
+                return boxOf(l).center().y < boxOf(r).center().y;
+            });
+            slice = sliceEnd;
+        }
+    }
+
+
+    // Hilbert packing.
+    // Items are sorted by Hilbert values of their centers computed over the extent of the level,
+    // so every node covers a contiguous piece of the Hilbert curve.
+    class HilbertPacking
+    {
+    public:
+        template <typename Iter>
+        static void order(Iter begin, Iter end, size_t nodeCapacity);
+    };
+
+
+    template <typename Iter>
+    void HilbertPacking::order(Iter begin, Iter end, size_t nodeCapacity)
+    {
+        const size_t count = std::distance(begin, end);
+        if (count <= nodeCapacity) {
+            return;
+        }
+
+        using Box = std::decay_t<decltype(boxOf(*begin))>;
+        Box extent;
+        std::for_each(begin, end, [&](const auto& item) {
+            const auto c = boxOf(item).center();
+            extent = extent & Box(c.x, c.y, 0, 0);
+        });
+
+        // Hilbert values are computed once per item rather than once per comparison
+        using value_type = typename std::iterator_traits<Iter>::value_type;
+        std::vector<std::pair<std::uint64_t, value_type>> keyed;
+        keyed.reserve(count);
+        std::for_each(begin, end, [&](auto& item) {
+            keyed.emplace_back(hilbertValue(boxOf(item), extent), std::move(item));
+        });
+        std::sort(keyed.begin(), keyed.end(), [](const auto& l, const auto& r) { return l.first < r.first; });
+        std::transform(keyed.begin(), keyed.end(), begin, [](auto& item) { return std::move(item.second); });
+    }
+} // namespace rtree
\ No newline at end of file
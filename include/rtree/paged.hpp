@@ -0,0 +1,809 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bounding_box.hpp"
+#include "box_array.hpp"
+#include "buffer_pool.hpp"
+#include "external_sort.hpp"
+#include "mapped.hpp"
+#include "node.hpp"
+#include "settings.h"
+#include "split.hpp"
+
+
+namespace rtree
+{
+    // File of a PagedTree is a sequence of pages of the same size.
+    // Page 0 holds the header, every other page is a node or a free page.
+    // A node page starts with PagedPage followed by entry records in leaves and child records in inner nodes.
+    // Free pages are linked through the page id stored right after their PagedPage.
+    struct PagedHeader
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrder;
+        std::uint32_t coordSize;
+        std::uint32_t entrySize;
+        std::uint64_t pageSize;
+        // Page of the root, 0 if the tree is empty
+        std::uint64_t root;
+        std::uint64_t height;
+        std::uint64_t size;
+        // First free page, 0 if there are none
+        std::uint64_t freeHead;
+    };
+
+    struct PagedPage
+    {
+        std::uint32_t count;
+        // Leaves are at level 0
+        std::uint32_t level;
+    };
+
+    template<typename Coord>
+    struct PagedChild
+    {
+        Coord x;
+        Coord y;
+        Coord w;
+        Coord h;
+        std::uint64_t page;
+    };
+
+    constexpr char PagedMagic[8] = { 'R', 'T', 'R', 'E', 'E', 'P', 'G', 'D' };
+    constexpr std::uint32_t PagedVersion = 1;
+
+    // Smallest buffer a PagedTree accepts, in pages. Every page on the path from the root
+    // to a leaf is pinned while the tree is modified, so the buffer must hold more pages than the tree is high
+    constexpr size_t MinBufferPages = 16;
+
+
+    // Tree whose nodes live in fixed-size pages of a file instead of memory.
+    // Only pages held by the buffer pool are in memory, so the size of the index is limited by the disk,
+    // and the memory it takes is limited by bufferBytes. Every node fills one page:
+    // fanout is the number of records that fit into it. Overflowing pages are split
+    // by SplitStrategy, underfull pages are dissolved and their records reinserted at the same level.
+    // Records are read from pages and written back rather than kept in nodes, so insertion and removal
+    // are implemented here and only the split of SplitStrategy is shared with Tree: strategies that also
+    // choose subtrees or ask for forced reinsertion (RStarSplit, HilbertSplit) are rejected.
+    // Subtree for a new record is the one whose box grows the least.
+    // There is no id index, so remove() takes the box of the entry to find the leaf that holds it.
+    // Pages are written back when they are evicted or flushed, the file is consistent only after flush()
+    // or destruction of the tree.
+    template<typename DataType, typename SplitStrategy = LinearSplit, typename Coord = double>
+    class PagedTree
+    {
+        static_assert(!HasChooseSubtree<SplitStrategy, Node<size_t, DynamicCapacity, Coord>>::value &&
+                      !HasForcedReinsert<SplitStrategy>::value,
+            "Paged tree uses only the split of the strategy, its choice of subtrees and forced reinsertion would be ignored.");
+
+    public:
+        using entry_type = Entry<DataType, Coord>;
+        using box_type = BasicBoundingBox<Coord>;
+        using page_id = BufferPool::page_id;
+
+        /**
+         * Open the tree stored in file path or create an empty one if the file doesn't exist.
+         * Throws std::runtime_error if the file can't be opened or holds a tree of other types or page size
+         */
+        PagedTree(const std::string& path, size_t bufferBytes, size_t pageSize = DefaultPageSize);
+        PagedTree(const PagedTree&) = delete;
+
+        PagedTree& operator=(const PagedTree&) = delete;
+
+        bool empty() const { return size() == 0; }
+        size_t size() const { return _header.size; }
+        size_t getHeight() const { return _header.height; }
+        size_t getMaxEntries() const { return capacity<entry_record>(); }
+
+        /**
+         * Replace the content of the tree with entries from [first, last), which is read once and may be an input range.
+         * Entries are ordered by Packing with an external sort that keeps about memoryBytes of them in memory
+         * and the rest in temporary files in directory. Pages are packed bottom-up to their capacity
+         * and written straight to the file, upper levels are ordered the same way as leaves
+         */
+        template<typename Packing = STRPacking, typename Iter>
+        void bulkLoad(Iter first, Iter last, size_t memoryBytes,
+                      const std::string& directory = std::filesystem::temp_directory_path().string());
+        void clear();
+        void insert(const box_type& b, const DataType& data);
+        /**
+         * Remove the entry with the box b and the id data. Returns false if there is no such entry.
+         * Unlike Tree::remove(), the box is required: only the pages it intersects are searched
+         */
+        bool remove(const box_type& b, const DataType& data);
+        /**
+         * Find all entries whose bounding boxes are intersected by b
+         */
+        std::vector<entry_type> find(const box_type& b) const;
+        /**
+         * Call visitor for every entry whose bounding box is intersected by b.
+         * If visitor returns bool, returning false stops the query.
+         * Returns false if the query was stopped by visitor
+         */
+        template<typename Visitor>
+        bool query(const box_type& b, Visitor&& visitor) const;
+
+        /**
+         * Write all modified pages back to the file
+         */
+        void flush() { _pool.flush(); }
+        const BufferPoolStats& getStats() const { return _pool.getStats(); }
+        void resetStats() { _pool.resetStats(); }
+
+    private:
+        using entry_record = MappedEntry<DataType, Coord>;
+        using child_record = PagedChild<Coord>;
+
+        // Result of inserting into a subtree: its new bounding box and a sibling page if it was split
+        struct Grown
+        {
+            box_type box;
+            std::optional<child_record> sibling;
+        };
+
+        // Records of dissolved pages. Children are kept with the level of the page they were in
+        struct Orphans
+        {
+            std::vector<entry_record> entries;
+            std::vector<std::pair<std::uint32_t, child_record>> children;
+        };
+
+        /**
+         * Pack items of the level written to input into pages and write their child entries to output
+         */
+        template<typename Packing, typename Record, typename Item>
+        void packLevel(TempFile& input, const SpillStats<Coord>& stats, std::uint32_t level, size_t memoryBytes,
+                       const std::string& directory, TempFile& output, SpillStats<Coord>& outputStats);
+
+        template<typename Record>
+        Grown insertInto(page_id id, const Record& record, std::uint32_t level);
+        /**
+         * Add record to the page, splitting it if it overflows
+         */
+        template<typename Record>
+        Grown append(PinnedPage& page, const PagedPage& header, const Record& record);
+        template<typename Record>
+        Grown split(PinnedPage& page, std::uint32_t level, const std::vector<Record>& records);
+        /**
+         * Insert record into a page at the level, growing a new root if the root splits
+         */
+        template<typename Record>
+        void insertRecord(const Record& record, std::uint32_t level);
+
+        bool removeFrom(page_id id, const box_type& b, const DataType& data, Orphans& orphans);
+        /**
+         * Move records of the page to orphans and free it
+         */
+        void dissolve(page_id id, Orphans& orphans);
+        /**
+         * Move all entries of the subtree to orphans and free its pages
+         */
+        void flatten(page_id id, Orphans& orphans);
+        /**
+         * Free all pages of the subtree
+         */
+        void freeSubtree(page_id id);
+        void shrinkRoot();
+
+        template<typename Visitor>
+        bool queryPage(page_id id, const box_type& b, Visitor& visitor) const;
+
+        page_id allocatePage();
+        void freePage(page_id id);
+        void writeHeader();
+        /**
+         * Number of buffer frames, checking the sizes before the buffer is allocated
+         */
+        static size_t frameCount(size_t bufferBytes, size_t pageSize);
+
+        template<typename Record>
+        size_t capacity() const { return (_pool.getPageSize() - sizeof(PagedPage)) / sizeof(Record); }
+        template<typename Record>
+        size_t minEntries() const { return std::max<size_t>(1, capacity<Record>() * DefaultMinEntries / DefaultMaxEntries); }
+
+        static PagedPage readPage(const char* page);
+        static void writePage(char* page, const PagedPage& header);
+        template<typename Record>
+        static std::vector<Record> readRecords(const char* page);
+        template<typename Record>
+        static void writeRecord(char* page, size_t i, const Record& record);
+
+        template<typename Record>
+        static box_type boxOf(const Record& record) { return box_type(record.x, record.y, record.w, record.h); }
+        template<typename Record>
+        static void setBox(Record& record, const box_type& box);
+        static void setPayload(entry_record& record, const DataType& data) { record.data = data; }
+        static void setPayload(child_record& record, page_id page) { record.page = page; }
+        template<typename Records>
+        static box_type boundsOf(const Records& records);
+
+        mutable BufferPool _pool;
+        // Copy of page 0
+        PagedHeader _header {};
+    };
+
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    PagedTree<DataType, SplitStrategy, Coord>::PagedTree(const std::string& path, size_t bufferBytes, size_t pageSize)
+        : _pool(path, pageSize, frameCount(bufferBytes, pageSize))
+    {
+        static_assert(std::is_trivially_copyable<DataType>::value, "Only trivially copyable ids can be written to a file.");
+        if (_pool.getPageCount() == 0) {
+            std::memcpy(_header.magic, PagedMagic, sizeof(_header.magic));
+            _header.version = PagedVersion;
+            _header.byteOrder = MappedByteOrder;
+            _header.coordSize = sizeof(Coord);
+            _header.entrySize = sizeof(entry_record);
+            _header.pageSize = pageSize;
+            _pool.allocate();
+            writeHeader();
+            return;
+        }
+
+        {
+            const PinnedPage page(_pool, 0);
+            std::memcpy(&_header, page.bytes(), sizeof(_header));
+        }
+        const bool valid = std::memcmp(_header.magic, PagedMagic, sizeof(PagedMagic)) == 0 &&
+            _header.version == PagedVersion && _header.byteOrder == MappedByteOrder &&
+            _header.coordSize == sizeof(Coord) && _header.entrySize == sizeof(entry_record) &&
+            _header.pageSize == pageSize;
+        if (!valid) {
+            throw std::runtime_error("PagedTree error: " + path + " is not a tree file of these types and page size");
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    size_t PagedTree<DataType, SplitStrategy, Coord>::frameCount(size_t bufferBytes, size_t pageSize)
+    {
+        const size_t minPageSize = sizeof(PagedPage) + 2 * DefaultMinEntries * std::max(sizeof(entry_record), sizeof(child_record));
+        if (pageSize < minPageSize) {
+            throw std::invalid_argument("PagedTree error: page size is too small");
+        }
+        if (bufferBytes / pageSize < MinBufferPages) {
+            throw std::invalid_argument("PagedTree error: buffer must hold at least " + std::to_string(MinBufferPages) + " pages");
+        }
+        return bufferBytes / pageSize;
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    template<typename Packing, typename Iter>
+    void PagedTree<DataType, SplitStrategy, Coord>::bulkLoad(Iter first, Iter last, size_t memoryBytes,
+                                                             const std::string& directory)
+    {
+        clear();
+        TempFile entries(directory);
+        SpillStats<Coord> stats;
+        for (; first != last; ++first) {
+            const entry_type entry = *first;
+            entries.write(&entry, 1);
+            stats.add(entry.box);
+        }
+        if (stats.count == 0) {
+            writeHeader();
+            return;
+        }
+
+        // Every level is a file of child entries pointing to the pages of the level below
+        using child_entry = Entry<page_id, Coord>;
+        TempFile level(directory);
+        SpillStats<Coord> levelStats;
+        packLevel<Packing, entry_record, entry_type>(entries, stats, 0, memoryBytes, directory, level, levelStats);
+        _header.height = 1;
+        while (levelStats.count > 1) {
+            TempFile upper(directory);
+            SpillStats<Coord> upperStats;
+            packLevel<Packing, child_record, child_entry>(level, levelStats, _header.height, memoryBytes, directory,
+                                                           upper, upperStats);
+            level = std::move(upper);
+            levelStats = upperStats;
+            _header.height++;
+        }
+
+        child_entry root;
+        level.rewind();
+        level.read(&root, 1);
+        _header.root = root.data;
+        _header.size = stats.count;
+        writeHeader();
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    void PagedTree<DataType, SplitStrategy, Coord>::clear()
+    {
+        if (_header.root) {
+            freeSubtree(_header.root);
+        }
+        _header.root = 0;
+        _header.height = 0;
+        _header.size = 0;
+        writeHeader();
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    void PagedTree<DataType, SplitStrategy, Coord>::insert(const box_type& b, const DataType& data)
+    {
+        entry_record record {};
+        setBox(record, b);
+        record.data = data;
+        insertRecord(record, 0);
+        _header.size++;
+        writeHeader();
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    bool PagedTree<DataType, SplitStrategy, Coord>::remove(const box_type& b, const DataType& data)
+    {
+        Orphans orphans;
+        if (!_header.root || !removeFrom(_header.root, b, data, orphans)) {
+            return false;
+        }
+        _header.size--;
+
+        // Root that lost its only child can't lead to the levels of orphans anymore
+        bool lostRoot = false;
+        if (_header.height > 1) {
+            const PinnedPage root(_pool, _header.root);
+            lostRoot = readPage(root.bytes()).count == 0;
+        }
+        if (lostRoot) {
+            freePage(_header.root);
+            _header.root = 0;
+            _header.height = 0;
+        }
+
+        // The highest orphans go first, so that the tree is high enough for them
+        std::sort(orphans.children.begin(), orphans.children.end(),
+            [](const auto& l, const auto& r) { return l.first > r.first; });
+        for (const auto& [level, child]: orphans.children) {
+            if (level < _header.height) {
+                insertRecord(child, level);
+            }
+            else {
+                flatten(child.page, orphans);
+            }
+        }
+        for (const auto& entry: orphans.entries) {
+            insertRecord(entry, 0);
+        }
+        shrinkRoot();
+        writeHeader();
+        return true;
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    auto PagedTree<DataType, SplitStrategy, Coord>::find(const box_type& b) const -> std::vector<entry_type>
+    {
+        std::vector<entry_type> found;
+        query(b, [&found](const entry_type& entry) { found.push_back(entry); });
+        return found;
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    template<typename Visitor>
+    bool PagedTree<DataType, SplitStrategy, Coord>::query(const box_type& b, Visitor&& visitor) const
+    {
+        if (!_header.root) {
+            return true;
+        }
+        return queryPage(_header.root, b, visitor);
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    template<typename Packing, typename Record, typename Item>
+    void PagedTree<DataType, SplitStrategy, Coord>::packLevel(TempFile& input, const SpillStats<Coord>& stats,
+                                                              std::uint32_t level, size_t memoryBytes,
+                                                              const std::string& directory, TempFile& output,
+                                                              SpillStats<Coord>& outputStats)
+    {
+        // Same sizes as Tree::packLevel() gives: full pages, and the last two share the rest if it would be underfull
+        const std::uint64_t pageCapacity = capacity<Record>();
+        const std::uint64_t pageCount = (stats.count + pageCapacity - 1) / pageCapacity;
+        const std::uint64_t rest = pageCount > 1 ? stats.count - (pageCount - 2) * pageCapacity : stats.count;
+        const std::uint64_t firstOfTwo = pageCount > 1 && rest - pageCapacity < minEntries<Record>() ? rest - rest / 2 : pageCapacity;
+        std::uint64_t written = 0;
+        const auto pageSize = [&]() -> std::uint64_t {
+            if (written + 2 < pageCount) {
+                return pageCapacity;
+            }
+            if (written + 2 == pageCount) {
+                return firstOfTwo;
+            }
+            return pageCount > 1 ? rest - firstOfTwo : rest;
+        };
+
+        std::vector<Record> records;
+        records.reserve(pageCapacity);
+        box_type bounds;
+        ExternalPacking<Packing>::template order<Item>(input, stats, pageCapacity, memoryBytes, directory, [&](const Item& item) {
+            Record record {};
+            setBox(record, item.box);
+            setPayload(record, item.data);
+            records.push_back(record);
+            bounds = bounds & item.box;
+            if (records.size() < pageSize()) {
+                return;
+            }
+
+            const Entry<page_id, Coord> child { bounds, allocatePage() };
+            {
+                PinnedPage page(_pool, child.data);
+                writePage(page.modify(), { std::uint32_t(records.size()), level });
+                for (size_t i = 0; i < records.size(); i++) {
+                    writeRecord(page.modify(), i, records[i]);
+                }
+            }
+            output.write(&child, 1);
+            outputStats.add(bounds);
+            records.clear();
+            bounds = box_type();
+            written++;
+        });
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    template<typename Record>
+    auto PagedTree<DataType, SplitStrategy, Coord>::insertInto(page_id id, const Record& record, std::uint32_t level) -> Grown
+    {
+        PinnedPage page(_pool, id);
+        const auto header = readPage(page.bytes());
+        if (header.level == level) {
+            return append(page, header, record);
+        }
+
+        // Same choice as Tree makes by default: the child whose box grows the least
+        auto children = readRecords<child_record>(page.bytes());
+        BoxArray<DynamicCapacity, Coord> boxes;
+        for (const auto& child: children) {
+            boxes.push_back(boxOf(child));
+        }
+        const auto i = boxes.leastGrowth(boxOf(record));
+        const auto grown = insertInto(children[i].page, record, level);
+        setBox(children[i], grown.box);
+        writeRecord(page.modify(), i, children[i]);
+        if (grown.sibling) {
+            return append(page, header, *grown.sibling);
+        }
+        return { boundsOf(children), std::nullopt };
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    template<typename Record>
+    auto PagedTree<DataType, SplitStrategy, Coord>::append(PinnedPage& page, const PagedPage& header, const Record& record) -> Grown
+    {
+        auto records = readRecords<Record>(page.bytes());
+        records.push_back(record);
+        if (records.size() > capacity<Record>()) {
+            return split(page, header.level, records);
+        }
+        writeRecord(page.modify(), header.count, record);
+        writePage(page.modify(), { header.count + 1, header.level });
+        return { boundsOf(records), std::nullopt };
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    template<typename Record>
+    auto PagedTree<DataType, SplitStrategy, Coord>::split(PinnedPage& page, std::uint32_t level,
+                                                          const std::vector<Record>& records) -> Grown
+    {
+        // Split strategy works on nodes, it gets a node whose entries are boxes of records with their indices
+        using scratch_node = Node<size_t, DynamicCapacity, Coord>;
+        typename scratch_node::pool_type scratch;
+        std::vector<typename scratch_node::entry_type> items;
+        items.reserve(records.size());
+        for (size_t i = 0; i < records.size(); i++) {
+            items.push_back({ boxOf(records[i]), i });
+        }
+        const auto node = scratch_node::makeLeaf(scratch, items.begin(), items.end());
+        split_result<scratch_node> halves;
+        if constexpr (HasMinEntriesSplit<SplitStrategy, scratch_node>::value) {
+            halves = SplitStrategy::splitLeaf(node, scratch, minEntries<Record>());
+        }
+        else {
+            halves = SplitStrategy::splitLeaf(node, scratch);
+        }
+
+        const auto fill = [&records, level](char* bytes, const scratch_node* half) {
+            const auto& entries = half->getEntries();
+            writePage(bytes, { std::uint32_t(entries.size()), level });
+            for (size_t i = 0; i < entries.size(); i++) {
+                writeRecord(bytes, i, records[entries[i].data]);
+            }
+        };
+        child_record sibling {};
+        sibling.page = allocatePage();
+        {
+            PinnedPage siblingPage(_pool, sibling.page);
+            fill(siblingPage.modify(), halves.second);
+        }
+        fill(page.modify(), halves.first);
+        setBox(sibling, halves.second->getBoundingBox());
+        const Grown grown { halves.first->getBoundingBox(), sibling };
+
+        for (const auto scratchNode: { node, halves.first, halves.second }) {
+            scratch.destroy(scratchNode);
+        }
+        return grown;
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    template<typename Record>
+    void PagedTree<DataType, SplitStrategy, Coord>::insertRecord(const Record& record, std::uint32_t level)
+    {
+        if (!_header.root) {
+            _header.root = allocatePage();
+            _header.height = 1;
+        }
+        const auto grown = insertInto(_header.root, record, level);
+        if (!grown.sibling) {
+            return;
+        }
+
+        child_record old {};
+        setBox(old, grown.box);
+        old.page = _header.root;
+        _header.root = allocatePage();
+        PinnedPage root(_pool, _header.root);
+        writePage(root.modify(), { 2, std::uint32_t(_header.height) });
+        writeRecord(root.modify(), 0, old);
+        writeRecord(root.modify(), 1, *grown.sibling);
+        _header.height++;
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    bool PagedTree<DataType, SplitStrategy, Coord>::removeFrom(page_id id, const box_type& b, const DataType& data,
+                                                               Orphans& orphans)
+    {
+        PinnedPage page(_pool, id);
+        const auto header = readPage(page.bytes());
+        if (header.level == 0) {
+            const auto entries = readRecords<entry_record>(page.bytes());
+            const auto it = std::find_if(entries.begin(), entries.end(),
+                [&](const auto& entry) { return boxOf(entry) == b && entry.data == data; });
+            if (it == entries.end()) {
+                return false;
+            }
+            writeRecord(page.modify(), it - entries.begin(), entries.back());
+            writePage(page.modify(), { header.count - 1, header.level });
+            return true;
+        }
+
+        const auto children = readRecords<child_record>(page.bytes());
+        for (size_t i = 0; i < children.size(); i++) {
+            const auto box = boxOf(children[i]);
+            if ((box & b) != box || !removeFrom(children[i].page, b, data, orphans)) {
+                continue;
+            }
+
+            PagedPage childHeader;
+            box_type childBox;
+            {
+                const PinnedPage child(_pool, children[i].page);
+                childHeader = readPage(child.bytes());
+                childBox = childHeader.level == 0 ? boundsOf(readRecords<entry_record>(child.bytes()))
+                                                  : boundsOf(readRecords<child_record>(child.bytes()));
+            }
+            const auto minCount = childHeader.level == 0 ? minEntries<entry_record>() : minEntries<child_record>();
+            if (childHeader.count < minCount) {
+                dissolve(children[i].page, orphans);
+                writeRecord(page.modify(), i, children.back());
+                writePage(page.modify(), { header.count - 1, header.level });
+            }
+            else {
+                auto updated = children[i];
+                setBox(updated, childBox);
+                writeRecord(page.modify(), i, updated);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    void PagedTree<DataType, SplitStrategy, Coord>::dissolve(page_id id, Orphans& orphans)
+    {
+        {
+            const PinnedPage page(_pool, id);
+            const auto header = readPage(page.bytes());
+            if (header.level == 0) {
+                const auto entries = readRecords<entry_record>(page.bytes());
+                orphans.entries.insert(orphans.entries.end(), entries.begin(), entries.end());
+            }
+            else {
+                for (const auto& child: readRecords<child_record>(page.bytes())) {
+                    orphans.children.emplace_back(header.level, child);
+                }
+            }
+        }
+        freePage(id);
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    void PagedTree<DataType, SplitStrategy, Coord>::flatten(page_id id, Orphans& orphans)
+    {
+        std::vector<child_record> children;
+        {
+            const PinnedPage page(_pool, id);
+            if (readPage(page.bytes()).level == 0) {
+                const auto entries = readRecords<entry_record>(page.bytes());
+                orphans.entries.insert(orphans.entries.end(), entries.begin(), entries.end());
+            }
+            else {
+                children = readRecords<child_record>(page.bytes());
+            }
+        }
+        freePage(id);
+        for (const auto& child: children) {
+            flatten(child.page, orphans);
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    void PagedTree<DataType, SplitStrategy, Coord>::freeSubtree(page_id id)
+    {
+        std::vector<child_record> children;
+        {
+            const PinnedPage page(_pool, id);
+            if (readPage(page.bytes()).level > 0) {
+                children = readRecords<child_record>(page.bytes());
+            }
+        }
+        freePage(id);
+        for (const auto& child: children) {
+            freeSubtree(child.page);
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    void PagedTree<DataType, SplitStrategy, Coord>::shrinkRoot()
+    {
+        while (_header.root) {
+            PagedPage header;
+            page_id child = 0;
+            {
+                const PinnedPage root(_pool, _header.root);
+                header = readPage(root.bytes());
+                if (header.level > 0 && header.count == 1) {
+                    child = readRecords<child_record>(root.bytes()).front().page;
+                }
+            }
+            if (header.count == 0) {
+                freePage(_header.root);
+                _header.root = 0;
+                _header.height = 0;
+            }
+            else if (child) {
+                freePage(_header.root);
+                _header.root = child;
+                _header.height--;
+            }
+            else {
+                return;
+            }
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    template<typename Visitor>
+    bool PagedTree<DataType, SplitStrategy, Coord>::queryPage(page_id id, const box_type& b, Visitor& visitor) const
+    {
+        PinnedPage page(_pool, id);
+        if (readPage(page.bytes()).level == 0) {
+            for (const auto& record: readRecords<entry_record>(page.bytes())) {
+                if (!boxOf(record).intersects(b)) {
+                    continue;
+                }
+                const entry_type entry { boxOf(record), record.data };
+                if constexpr (std::is_same<std::invoke_result_t<Visitor&, const entry_type&>, bool>::value) {
+                    if (!visitor(entry)) {
+                        return false;
+                    }
+                }
+                else {
+                    visitor(entry);
+                }
+            }
+            return true;
+        }
+        for (const auto& child: readRecords<child_record>(page.bytes())) {
+            if (boxOf(child).intersects(b) && !queryPage(child.page, b, visitor)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    auto PagedTree<DataType, SplitStrategy, Coord>::allocatePage() -> page_id
+    {
+        if (!_header.freeHead) {
+            return _pool.allocate();
+        }
+        const auto id = _header.freeHead;
+        PinnedPage page(_pool, id);
+        std::memcpy(&_header.freeHead, page.bytes() + sizeof(PagedPage), sizeof(_header.freeHead));
+        writePage(page.modify(), { 0, 0 });
+        return id;
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    void PagedTree<DataType, SplitStrategy, Coord>::freePage(page_id id)
+    {
+        PinnedPage page(_pool, id);
+        writePage(page.modify(), { 0, 0 });
+        std::memcpy(page.modify() + sizeof(PagedPage), &_header.freeHead, sizeof(_header.freeHead));
+        _header.freeHead = id;
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    void PagedTree<DataType, SplitStrategy, Coord>::writeHeader()
+    {
+        PinnedPage page(_pool, 0);
+        std::memcpy(page.modify(), &_header, sizeof(_header));
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    PagedPage PagedTree<DataType, SplitStrategy, Coord>::readPage(const char* page)
+    {
+        PagedPage header;
+        std::memcpy(&header, page, sizeof(header));
+        return header;
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    void PagedTree<DataType, SplitStrategy, Coord>::writePage(char* page, const PagedPage& header)
+    {
+        std::memcpy(page, &header, sizeof(header));
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    template<typename Record>
+    std::vector<Record> PagedTree<DataType, SplitStrategy, Coord>::readRecords(const char* page)
+    {
+        // Records are copied out, page bytes have no alignment guarantees for them
+        std::vector<Record> records(readPage(page).count);
+        if (!records.empty()) {
+            std::memcpy(records.data(), page + sizeof(PagedPage), records.size() * sizeof(Record));
+        }
+        return records;
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    template<typename Record>
+    void PagedTree<DataType, SplitStrategy, Coord>::writeRecord(char* page, size_t i, const Record& record)
+    {
+        std::memcpy(page + sizeof(PagedPage) + i * sizeof(Record), &record, sizeof(Record));
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    template<typename Record>
+    void PagedTree<DataType, SplitStrategy, Coord>::setBox(Record& record, const box_type& box)
+    {
+        record.x = box.x;
+        record.y = box.y;
+        record.w = box.w;
+        record.h = box.h;
+    }
+
+    template<typename DataType, typename SplitStrategy, typename Coord>
+    template<typename Records>
+    auto PagedTree<DataType, SplitStrategy, Coord>::boundsOf(const Records& records) -> box_type
+    {
+        box_type bounds;
+        for (const auto& record: records) {
+            bounds = bounds & boxOf(record);
+        }
+        return bounds;
+    }
+} // namespace rtree
@@ -1,17 +1,32 @@
 #pragma once
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <iterator>
 #include <limits>
-#include <map>
+#include <numeric>
 #include <optional>
+#include <queue>
+#include <random>
 #include <stack>
 #include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "exception.h"
+#include "id_index.hpp"
 #include "iterator.hpp"
+#include "join.hpp"
 #include "node.hpp"
+#include "packing.hpp"
 #include "settings.h"
 #include "split.hpp"
+#include "thread_pool.hpp"
+#include "versioned.hpp"
 
 
 namespace rtree
@@ -31,63 +46,367 @@ namespace rtree
     }
 
 
-    template<typename DataType, typename SplitStrategy = LinearSplit>
+    /**
+     * Results of a batch of queries laid out in one array.
+     * Entries found by query i are entries[offsets[i]] ... entries[offsets[i + 1] - 1]
+     */
+    template<typename EntryType>
+    struct BatchResult
+    {
+        std::vector<size_t> offsets;
+        std::vector<EntryType> entries;
+    };
+
+
+    /**
+     * Fanout is configured at runtime by default. Setting MaxEntries (and optionally MinEntries)
+     * fixes it at compile time: nodes then store their items in inline arrays of MaxEntries + 1 slots
+     * and the tree can't be reconfigured with Tree(minEntries, maxEntries).
+     * Coord is the type of box coordinates, e.g. float or std::int32_t instead of the default double.
+     * Aggregate other than NoAggregate makes every node keep the number of entries in its subtree
+     * and their aggregate value (see aggregate.hpp), which count() and aggregate() use to skip whole subtrees.
+     * Lock other than NoLock is kept by the node pool for every node, the tree itself never takes it (see ConcurrentTree)
+     */
+    template<typename DataType, typename SplitStrategy = LinearSplit,
+             size_t MaxEntries = DynamicCapacity, size_t MinEntries = DynamicCapacity,
+             typename Coord = double, typename Aggregate = NoAggregate, typename Lock = NoLock>
     class Tree
-    {    
+    {
+        static constexpr bool StaticFanout = MaxEntries != DynamicCapacity;
+        static constexpr size_t StaticMinEntries = MinEntries != DynamicCapacity ? MinEntries :
+            std::max<size_t>(1, MaxEntries * DefaultMinEntries / DefaultMaxEntries);
+
+        static_assert(!StaticFanout || (StaticMinEntries > 0 && StaticMinEntries <= MaxEntries / 2),
+            "Minimum number of node entries must be positive and less or equal to maximum number divided by 2.");
+        static_assert(StaticFanout || MinEntries == DynamicCapacity,
+            "Minimum number of node entries can be fixed only together with the maximum number.");
+
     public:
+        // Room for one item more than allowed, it overflows the node right before the split
+        static constexpr size_t NodeCapacity = StaticFanout ? MaxEntries + 1 : DynamicCapacity;
+        using node_type = Node<DataType, NodeCapacity, Coord, Aggregate, Lock>;
+        using entry_type = Entry<DataType, Coord>;
+        using box_type = BasicBoundingBox<Coord>;
+        using point_type = BasicPoint<Coord>;
+        using split_strategy = SplitStrategy;
+        using aggregate_type = SubtreeAggregate<Aggregate>;
+
         Tree()
-            : _minEntries(DefaultMinEntries), _maxEntries(DefaultMaxEntries) {}
+            : _minEntries(StaticFanout ? StaticMinEntries : DefaultMinEntries),
+              _maxEntries(StaticFanout ? MaxEntries : DefaultMaxEntries) {}
         Tree(size_t minEntries, size_t maxEntries);
+        template<typename Iter,
+                 typename = typename std::iterator_traits<Iter>::iterator_category>
+        Tree(Iter first, Iter last)
+            : Tree() { bulkLoad(first, last); }
+        Tree(const Tree&) = delete;
+        Tree(Tree&& other) noexcept;
+        ~Tree() { clear(); }
+
+        Tree& operator=(const Tree&) = delete;
+        Tree& operator=(Tree&& other) noexcept;
+
+        /**
+         * Remove all entries. Nodes are freed together with the pool that owns them
+         */
+        void clear();
         void remove(DataType data);
-        void insert(BoundingBox b, DataType data);
+        void insert(box_type b, DataType data);
+        /**
+         * Tell the tree that the weight of id data changed: the id held by the tree is replaced by data
+         * (which may carry the new weight, see Prioritized) and aggregates of its leaf and ancestors are recomputed.
+         * Does nothing if the tree doesn't hold the id
+         */
+        void setWeight(DataType data);
+        /**
+         * Move the entry with id data to box b, or insert it if the tree doesn't hold it.
+         * A box that stays inside the bounding box of its leaf is replaced in place,
+         * a box that still intersects it is kept in the leaf and boxes of the leaf and its ancestors are refit
+         * bottom-up while they change. Entries that left their leaves or would stretch the box of the rest
+         * of their leaf by more than UpdateStretchLimit are removed and inserted again
+         */
+        void update(DataType data, box_type b);
+        /**
+         * Margin that update() adds around a moved box when boxes of nodes have to grow for it.
+         * Node boxes are then looser than their content, but small moves afterwards fit into them
+         * and don't touch any node. Zero keeps node boxes tight
+         */
+        void setFatMargin(Coord margin) { _fatMargin = margin; }
+        Coord getFatMargin() const { return _fatMargin; }
+        /**
+         * Let fn(data, box) rewrite the box of every entry in place, then recompute bounding boxes of all nodes
+         * in the same post-order pass, each one once. Entries stay in their leaves whatever their new boxes are,
+         * so the tree only gets slower to query as entries drift apart, see overlapRatio()
+         */
+        template<typename Fn>
+        void refit(Fn&& fn);
+        /**
+         * Same as refit(fn), but subtrees are refit in parallel by all threads of pool.
+         * fn is called concurrently for different entries
+         */
+        template<typename Fn>
+        void refit(Fn&& fn, ThreadPool& pool);
+        /**
+         * Area where bounding boxes of sibling nodes overlap relative to the total area of all nodes below the root.
+         * It is close to 0 right after a good build and grows as moved entries stretch nodes over each other,
+         * comparing it with its value after the build tells when the tree is worth rebuilding
+         */
+        double overlapRatio() const;
+        /**
+         * Bounding box of the entry with id data, found through the id index without descending the tree
+         */
+        std::optional<box_type> getBoundingBox(DataType data) const;
+        /**
+         * Replace content of the tree with entries from [first, last).
+         * Nodes are packed bottom-up to their maximum capacity in the order given by Packing
+         */
+        template<typename Packing = STRPacking, typename Iter>
+        void bulkLoad(Iter first, Iter last);
+        /**
+         * Apply a change set at once: entries with ids from removes are removed, entries from updates
+         * get their new boxes (or are inserted if the tree doesn't hold them) and entries from inserts are added.
+         * Removals are grouped by leaf and new entries are routed to leaves in one shared descent that buckets
+         * them by subtree at every level. Overflowing leaves are split without forced reinsertion.
+         * Boxes of all touched nodes are recomputed once at the end, bottom-up.
+         * Throws DuplicateEntryException and leaves the tree intact if an inserted id is already in the tree
+         * (and isn't removed by the same batch) or an id repeats among inserts and updates
+         */
+        void applyBatch(const std::vector<entry_type>& inserts, const std::vector<DataType>& removes,
+                        const std::vector<entry_type>& updates = {});
 
         bool empty() const { return begin() == end(); }
         /**
          * Find all entries whose bounding boxes are intersected by b
          */
-        std::vector<Entry<DataType>> find(BoundingBox b) const;
+        std::vector<entry_type> find(box_type b) const;
+        /**
+         * Call visitor for every entry whose bounding box is intersected by b.
+         * Subtrees whose bounding boxes are not intersected by b are skipped.
+         * If visitor returns bool, returning false stops the query.
+         * Returns false if the query was stopped by visitor
+         */
+        template<typename Visitor,
+                 std::enable_if_t<std::is_invocable<Visitor&, const entry_type&>::value, int> = 0>
+        bool query(const box_type& b, Visitor&& visitor) const;
+        /**
+         * Copy every entry whose bounding box is intersected by b into out
+         */
+        template<typename OutputIt,
+                 std::enable_if_t<not std::is_invocable<OutputIt&, const entry_type&>::value, int> = 0>
+        OutputIt query(const box_type& b, OutputIt out) const;
+        /**
+         * Number of entries whose bounding boxes are intersected by b.
+         * With an aggregate, subtrees whose bounding boxes lie inside b are counted without descending into them
+         */
+        size_t count(const box_type& b) const;
+        /**
+         * Number and aggregate value of entries whose bounding boxes are intersected by b,
+         * gathered from whole subtrees like count(). Requires Aggregate other than NoAggregate
+         */
+        aggregate_type aggregate(const box_type& b) const;
+        /**
+         * Pick min(k, count(b)) distinct entries intersected by b uniformly at random, returned in the order of the tree.
+         * Subtree counts are used to find every picked entry by its rank, so only the border of b
+         * and the paths to the picked entries are visited. Requires Aggregate other than NoAggregate
+         */
+        template<typename URBG>
+        std::vector<entry_type> sample(const box_type& b, size_t k, URBG&& rng) const;
+        /**
+         * Find entries intersected by every box of random access range [first, last) using all threads of pool.
+         * Threads take queries in small chunks and collect the results in their own buffers,
+         * which are then copied in parallel into the layout of BatchResult.
+         * The tree must not be modified until the batch is done
+         */
+        template<typename Iter>
+        BatchResult<entry_type> findBatch(Iter first, Iter last, ThreadPool& pool) const;
+        /**
+         * Find at most k entries closest to p, ordered by distance.
+         * Nodes are visited best-first by the distance from p to their bounding boxes,
+         * so the traversal stops as soon as k entries are closer than any unvisited node
+         */
+        std::vector<entry_type> nearest(const point_type& p, size_t k) const;
+        /**
+         * Find at most k entries intersected by b with the largest priorities, ordered by priority.
+         * Priority of an entry is its value under Aggregate, which has to be MaxAggregate (e.g. PriorityAggregate
+         * of Prioritized ids), so every node keeps the largest priority below it. Nodes are visited best-first by that priority,
+         * so the traversal stops as soon as k entries beat every unvisited node
+         */
+        std::vector<entry_type> topK(const box_type& b, size_t k) const;
+        /**
+         * Call callback(entryA, entryB) once for every unordered pair of distinct entries whose bounding boxes intersect
+         */
+        template<typename Callback>
+        void selfJoin(Callback&& callback) const;
+        /**
+         * Find all entries whose bounding boxes are not farther from p than r.
+         * Subtrees whose bounding boxes are farther than r are skipped
+         */
+        std::vector<entry_type> withinDistance(const point_type& p, double r) const;
+
+        /**
+         * Start or stop recording ids of inserted, removed and updated entries for takeChanges()
+         */
+        void trackChanges(bool enabled);
+        /**
+         * Ids of entries changed since the previous call, possibly repeated.
+         * Returns nothing if the whole content of the tree was replaced (by clear(), bulkLoad() or refit())
+         */
+        std::optional<std::vector<DataType>> takeChanges();
+
+        /**
+         * Root node, nullptr if the tree is empty
+         */
+        const node_type* getRoot() const { return _root; }
 
-        Iterator<DataType> begin() const { return Iterator<DataType>(_root); }
-        Iterator<DataType> end() const { return Iterator<DataType>(); }
+        Iterator<DataType, NodeCapacity, Coord, Aggregate, Lock> begin() const { return Iterator<DataType, NodeCapacity, Coord, Aggregate, Lock>(_root); }
+        Iterator<DataType, NodeCapacity, Coord, Aggregate, Lock> end() const { return Iterator<DataType, NodeCapacity, Coord, Aggregate, Lock>(); }
 
-        size_t getMinEntries() const { return _minEntries; }
-        size_t getMaxEntries() const { return _maxEntries; }
+        size_t getMinEntries() const { return StaticFanout ? StaticMinEntries : _minEntries; }
+        size_t getMaxEntries() const { return StaticFanout ? MaxEntries : _maxEntries; }
 
     private:
-        void condense(node_ptr<DataType> node);
-        void insertIgnoreCache(BoundingBox b, DataType data);
+        template<typename> friend class ConcurrentTree;
+
+        template<typename Visitor>
+        static bool queryNode(const node_type& node, const box_type& b, Visitor& visitor);
+        /**
+         * Pass every subtree of node that lies inside b to whole(node) and every other entry intersected by b
+         * to single(entry), so that each entry intersected by b is covered once
+         */
+        template<typename Whole, typename Single>
+        static void coverNode(const node_type& node, const box_type& b, Whole& whole, Single& single);
+
+        void condense(node_type* node);
+        /**
+         * Recompute bounding boxes of node and its ancestors, stopping at the first one that doesn't change
+         */
+        void refitUpward(node_type* node);
+        /**
+         * Whether box b of entry at slot of leaf stretches the box of the other entries of the leaf
+         * by more than UpdateStretchLimit of its margin, so that the entry is better reinserted than kept in the leaf
+         */
+        bool strays(const node_type* leaf, size_t slot, const box_type& b) const;
+        /**
+         * Move entries of the subtree with fn and recompute boxes of its nodes children first
+         */
+        template<typename Fn>
+        static void refitSubtree(node_type* node, Fn& fn);
+        /**
+         * Forget recorded changes and report the whole content of the tree as replaced by takeChanges()
+         */
+        void resetChanges();
+        /**
+         * Replace root by its only child while root is an inner node with a single child
+         */
+        void shrinkRoot();
+        /**
+         * Cut ordered range into runs of at most getMaxEntries() items and make a node of each run.
+         * The last two runs are rebalanced so that none of them has less than getMinEntries() items
+         */
+        template<typename Iter, typename MakeNode>
+        std::vector<node_type*> packLevel(Iter begin, Iter end, MakeNode makeNode) const;
+        /**
+         * Insert entry into a leaf.
+         * reinserted marks levels (counted from leaves) where overflow was already treated by reinsertion
+         */
+        void insertEntry(const entry_type& e, std::vector<bool>& reinserted);
+        /**
+         * Insert subtree of given height into a node at the level above it
+         */
+        void insertSubtree(node_type* subtree, size_t height, std::vector<bool>& reinserted);
+        /**
+         * Split node of given height and its ancestors while they have too many entries.
+         * If split strategy asks for it, entries of the node are reinserted instead of split
+         * on the first overflow at its level
+         */
+        void treatOverflow(node_type* node, size_t height, std::vector<bool>& reinserted);
+        /**
+         * Put two halves of node made by split strategy in place of the node
+         */
+        split_result<node_type> replaceBySplit(node_type* node);
+        /**
+         * Split overflowing node and then its ancestors while they overflow. Returns halves of the original node
+         */
+        split_result<node_type> splitUpward(node_type* node);
+        /**
+         * Remove entries with given ids, each one is paired with the leaf it held before the batch.
+         * Ids of entries from the leaves whose boxes are left stale are added to touched
+         */
+        void removeBatch(std::vector<std::pair<node_type*, DataType>>& removals, std::vector<DataType>& touched);
+        /**
+         * Insert entries whose ids are already in the index, leaving boxes of the filled leaves stale
+         */
+        void insertBatch(std::vector<entry_type>& entries, std::vector<DataType>& touched);
         /**
-         * Find node whose bounding box area will be increased as little as possible
+         * Distribute entries [begin, end) among leaves under node in one descent
+         */
+        template<typename Iter>
+        void route(node_type* node, Iter begin, Iter end, std::vector<DataType>& touched);
+        /**
+         * Add entries to the leaf. If it overflows, the rest of the entries goes to its halves
+         */
+        template<typename Iter>
+        void fillLeaf(node_type* leaf, Iter begin, Iter end, std::vector<DataType>& touched);
+        /**
+         * Recompute boxes of the leaves that hold entries with given ids and then of their ancestors,
+         * level by level, so that every node is recomputed once
+         */
+        void refitLeaves(const std::vector<DataType>& ids);
+        void reinsert(node_type* node, size_t height, std::vector<bool>& reinserted);
+        /**
+         * Find node of given height whose bounding box area will be increased as little as possible
          * after insertion of entry represented by b
         */
-        node_ptr<DataType> findInsertCandidate(BoundingBox b) const;
+        node_type* findInsertCandidate(box_type b, size_t height = 0) const;
         /**
-         * Find node that is containing entry e
+         * Choose child of node to insert entry represented by b into
         */
-        node_ptr<DataType> findContaining(Entry<DataType> e) const;
-
-        bool needSplit(node_ptr<DataType> node) const
+        node_type* chooseSubtree(node_type* node, box_type b) const;
+        bool needSplit(node_type* node) const
         {
             return node->size() > getMaxEntries();
         }
 
-        split_result<DataType> split(node_ptr<DataType> node) const;
+        split_result<node_type> split(node_type* node);
 
-        std::optional<BoundingBox> getFromCache(DataType data) const;
-        void removeFromCache(DataType data);
-        void saveToCache(DataType data, BoundingBox b);
+        // Leaf that holds an entry and position of the entry among entries of the leaf
+        struct EntryLocation
+        {
+            node_type* leaf;
+            size_t slot;
+        };
+
+        /**
+         * Point the id index at entry number slot of leaf.
+         * Has to be called whenever an entry is added to a leaf or moved inside it
+         */
+        void indexEntry(node_type* leaf, size_t slot);
+        void indexLeaf(node_type* leaf);
+        void logChange(DataType data)
+        {
+            if (_trackChanges) {
+                _changes.push_back(data);
+            }
+        }
 
-        node_ptr<DataType> _root;
-        std::map<DataType, BoundingBox> _cache;
+        typename node_type::pool_type _pool;
+        node_type* _root = nullptr;
+        IdIndex<DataType, EntryLocation> _index;
         size_t _minEntries;
         size_t _maxEntries;
+        Coord _fatMargin = Coord();
+        std::vector<DataType> _changes;
+        bool _trackChanges = false;
+        // Set when the content is replaced as a whole while changes are tracked
+        bool _changesReset = false;
     };
 
 
-    template<typename DataType, typename SplitStrategy>
-    Tree<DataType, SplitStrategy>::Tree(size_t minEntries, size_t maxEntries)
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::Tree(size_t minEntries, size_t maxEntries)
         : _minEntries(minEntries), _maxEntries(maxEntries)
     {
+        static_assert(!StaticFanout, "Fanout of the tree is fixed by its template parameters.");
         if (_minEntries == 0) {
             _minEntries = 1;
         }
@@ -102,247 +421,1151 @@ namespace rtree
     }
 
 
-    template<typename DataType, typename SplitStrategy>
-    void Tree<DataType, SplitStrategy>::remove(DataType data)
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::Tree(Tree&& other) noexcept
+        : _pool(std::move(other._pool)),
+          _root(std::exchange(other._root, nullptr)),
+          _index(std::move(other._index)),
+          _minEntries(other._minEntries),
+          _maxEntries(other._maxEntries),
+          _fatMargin(other._fatMargin),
+          _changes(std::move(other._changes)),
+          _trackChanges(std::exchange(other._trackChanges, false)),
+          _changesReset(std::exchange(other._changesReset, false))
     {
-        const auto cachedBox = getFromCache(data);
-        removeFromCache(data);
+    }
 
-        // Find and remove entry by its id
-        node_ptr<DataType> node = nullptr;
-        if (cachedBox.has_value()) {
-            const auto boxToDelete = cachedBox.value();
-            Entry<DataType> target = { .box=boxToDelete, .data=data };
-            node = findContaining(target);
-            if (!node) {
-                return;
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>& Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::operator=(Tree&& other) noexcept
+    {
+        if (this != &other) {
+            clear();
+            _pool = std::move(other._pool);
+            _root = std::exchange(other._root, nullptr);
+            _index = std::move(other._index);
+            _minEntries = other._minEntries;
+            _maxEntries = other._maxEntries;
+            _fatMargin = other._fatMargin;
+            _changes = std::move(other._changes);
+            _trackChanges = std::exchange(other._trackChanges, false);
+            _changesReset = std::exchange(other._changesReset, false);
+        }
+        return *this;
+    }
+
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::clear()
+    {
+        // Pool can drop its slabs at once only if nodes have nothing to free themselves
+        if constexpr (!std::is_trivially_destructible<node_type>::value) {
+            for (auto nodeIt = begin(); nodeIt != end();) {
+                const auto node = nodeIt.get();
+                ++nodeIt;
+                _pool.destroy(node);
+            }
+        }
+        _pool.release();
+        _root = nullptr;
+        _index.clear();
+        resetChanges();
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::setWeight(DataType data)
+    {
+        const auto location = _index.find(data);
+        if (!location) {
+            return;
+        }
+        logChange(data);
+        location->leaf->setEntryData(location->slot, data);
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::remove(DataType data)
+    {
+        const auto location = _index.find(data);
+        if (!location) {
+            return;
+        }
+        const auto node = location->leaf;
+        const auto slot = location->slot;
+        _index.erase(data);
+        logChange(data);
+        node->removeAt(slot);
+        if (slot < node->size()) {
+            indexEntry(node, slot);
+        }
+        condense(node);
+        shrinkRoot();
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::insert(box_type b, DataType data)
+    {
+        if (!_index.insert(data, { nullptr, 0 })) {
+            throw DuplicateEntryException("insert() error: entry " + toString(data) + " is already exists");
+        }
+        logChange(data);
+        std::vector<bool> reinserted;
+        insertEntry({ .box=b, .data=data }, reinserted);
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::update(DataType data, box_type b)
+    {
+        const auto location = _index.find(data);
+        if (!location) {
+            insert(b, data);
+            return;
+        }
+        const auto leaf = location->leaf;
+        const auto slot = location->slot;
+        const auto leafBox = leaf->getBoundingBox();
+        const bool grows = (leafBox & b) != leafBox;
+        if (!leafBox.intersects(b) || (grows && strays(leaf, slot, b))) {
+            remove(data);
+            insert(b, data);
+            return;
+        }
+
+        logChange(data);
+        const auto old = leaf->getEntries()[slot].box;
+        leaf->setEntryBox(slot, b);
+        if constexpr (std::is_same<SplitStrategy, HilbertSplit>::value) {
+            // Hilbert value of the entry changed, LHVs of the leaf and its ancestors are computed again when needed.
+            // Unknown LHVs are computed children first, so ancestors of a node with unknown LHV have unknown LHVs too
+            for (auto node = leaf; node && node->getLargestHilbertValue() != UnknownHilbertValue; node = node->getParent()) {
+                node->setLargestHilbertValue(UnknownHilbertValue);
+            }
+        }
+        if (!grows) {
+            // Leaf can shrink only if the old box lay on its border
+            const bool inner = old.bl().x > leafBox.bl().x && old.bl().y > leafBox.bl().y &&
+                               old.tr().x < leafBox.tr().x && old.tr().y < leafBox.tr().y;
+            if (_fatMargin == Coord() && !inner) {
+                refitUpward(leaf);
             }
-            node->remove(target);
+            return;
+        }
+        if (_fatMargin == Coord()) {
+            refitUpward(leaf);
+            return;
+        }
+        const auto bl = b.bl();
+        const auto tr = b.tr();
+        const box_type fat(bl.x - _fatMargin, bl.y - _fatMargin, tr.x - bl.x + 2 * _fatMargin, tr.y - bl.y + 2 * _fatMargin);
+        for (auto node = leaf; node && (node->getBoundingBox() & fat) != node->getBoundingBox(); node = node->getParent()) {
+            node->expandBoundingBox(fat);
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename Fn>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::refit(Fn&& fn)
+    {
+        resetChanges();
+        if (_root) {
+            refitSubtree(_root, fn);
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename Fn>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::refit(Fn&& fn, ThreadPool& pool)
+    {
+        resetChanges();
+        if (!_root) {
+            return;
+        }
+
+        // Levels are opened from the root until there are several subtrees per thread to balance them
+        std::vector<node_type*> upper;
+        std::vector<node_type*> subtrees { _root };
+        while (subtrees.size() < 4 * pool.size() && !subtrees.front()->isLeaf()) {
+            std::vector<node_type*> below;
+            for (const auto node: subtrees) {
+                below.insert(below.end(), node->getChildren().begin(), node->getChildren().end());
+            }
+            upper.insert(upper.end(), subtrees.begin(), subtrees.end());
+            subtrees = std::move(below);
+        }
+
+        // Marking nodes as changed goes up to the first node that already is, so roots of subtrees are marked
+        // beforehand and workers never touch the flags of nodes above them
+        for (const auto subtree: subtrees) {
+            subtree->updateBoundingBox();
+        }
+        std::atomic<size_t> next { 0 };
+        pool.run([&](size_t) {
+            for (auto i = next++; i < subtrees.size(); i = next++) {
+                refitSubtree(subtrees[i], fn);
+            }
+        });
+        for (auto it = upper.rbegin(); it != upper.rend(); ++it) {
+            (*it)->setLargestHilbertValue(UnknownHilbertValue);
+            (*it)->updateBoundingBox();
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    double Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::overlapRatio() const
+    {
+        double overlap = 0.0;
+        double area = 0.0;
+        for (auto nodeIt = begin(); nodeIt != end(); ++nodeIt) {
+            const auto& children = nodeIt->getChildren();
+            for (size_t i = 0; i < children.size(); i++) {
+                const auto& box = children[i]->getBoundingBox();
+                area += box.area();
+                for (size_t j = i + 1; j < children.size(); j++) {
+                    overlap += (box | children[j]->getBoundingBox()).area();
+                }
+            }
+        }
+        return area > 0.0 ? overlap / area : 0.0;
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::getBoundingBox(DataType data) const
+        -> std::optional<box_type>
+    {
+        const auto location = _index.find(data);
+        if (!location) {
+            return {};
+        }
+        return location->leaf->getEntries()[location->slot].box;
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename Packing, typename Iter>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::bulkLoad(Iter first, Iter last)
+    {
+        std::vector<entry_type> entries(first, last);
+
+        // Ids are checked before the tree is touched, so it is left intact if some of them repeat
+        IdIndex<DataType, EntryLocation> index;
+        index.reserve(entries.size());
+        for (const auto& entry: entries) {
+            if (!index.insert(entry.data, { nullptr, 0 })) {
+                throw DuplicateEntryException("bulkLoad() error: entry " + toString(entry.data) + " is already exists");
+            }
+        }
+        clear();
+        _index = std::move(index);
+        if (entries.empty()) {
+            return;
+        }
+
+        Packing::order(entries.begin(), entries.end(), getMaxEntries());
+        auto level = packLevel(entries.begin(), entries.end(),
+            [this](auto begin, auto end) { return node_type::makeLeaf(_pool, begin, end); });
+        std::for_each(level.begin(), level.end(), [this](auto leaf) { indexLeaf(leaf); });
+        while (level.size() > 1) {
+            Packing::order(level.begin(), level.end(), getMaxEntries());
+            level = packLevel(level.begin(), level.end(),
+                [this](auto begin, auto end) { return node_type::makeInner(_pool, begin, end); });
+        }
+        _root = level.front();
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::applyBatch(const std::vector<entry_type>& inserts,
+                                                                                      const std::vector<DataType>& removes,
+                                                                                      const std::vector<entry_type>& updates)
+    {
+        // Ids are checked before the tree is touched, so it is left intact if some of them repeat
+        std::vector<std::pair<node_type*, DataType>> removals;
+        IdIndex<DataType, bool> leaving;
+        const auto leave = [&](DataType data) {
+            const auto location = _index.find(data);
+            if (location && leaving.insert(data, true)) {
+                removals.emplace_back(location->leaf, data);
+            }
+        };
+        std::for_each(removes.begin(), removes.end(), leave);
+        std::for_each(updates.begin(), updates.end(), [&leave](const auto& entry) { leave(entry.data); });
+
+        IdIndex<DataType, bool> coming;
+        coming.reserve(inserts.size() + updates.size());
+        for (const auto& entry: inserts) {
+            if (!coming.insert(entry.data, true) || (_index.find(entry.data) && !leaving.find(entry.data))) {
+                throw DuplicateEntryException("applyBatch() error: entry " + toString(entry.data) + " is already exists");
+            }
+        }
+        for (const auto& entry: updates) {
+            if (!coming.insert(entry.data, true)) {
+                throw DuplicateEntryException("applyBatch() error: entry " + toString(entry.data) + " repeats in the batch");
+            }
+        }
+
+        // Edits leave boxes of the touched leaves and their ancestors stale, they are fixed together at the end
+        std::vector<DataType> touched;
+        removeBatch(removals, touched);
+        std::vector<entry_type> entries;
+        entries.reserve(inserts.size() + updates.size());
+        entries.insert(entries.end(), inserts.begin(), inserts.end());
+        entries.insert(entries.end(), updates.begin(), updates.end());
+        if (_trackChanges) {
+            std::for_each(removals.begin(), removals.end(), [this](const auto& removal) { logChange(removal.second); });
+            std::for_each(entries.begin(), entries.end(), [this](const auto& entry) { logChange(entry.data); });
+        }
+        insertBatch(entries, touched);
+        refitLeaves(touched);
+        shrinkRoot();
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::find(box_type b) const
+        -> std::vector<entry_type>
+    {
+        std::vector<entry_type> intersected;
+        query(b, std::back_inserter(intersected));
+        return intersected;
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename Visitor,
+             std::enable_if_t<std::is_invocable<Visitor&, const Entry<DataType, Coord>&>::value, int>>
+    bool Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::query(const box_type& b, Visitor&& visitor) const
+    {
+        if (!_root || !_root->getBoundingBox().intersects(b)) {
+            return true;
+        }
+        return queryNode(*_root, b, visitor);
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename OutputIt,
+             std::enable_if_t<not std::is_invocable<OutputIt&, const Entry<DataType, Coord>&>::value, int>>
+    OutputIt Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::query(const box_type& b, OutputIt out) const
+    {
+        query(b, [&out](const entry_type& entry) { *out++ = entry; });
+        return out;
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    size_t Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::count(const box_type& b) const
+    {
+        if constexpr (node_type::aggregated) {
+            return aggregate(b).count;
         }
         else {
-            const auto nodeIt = std::find_if(begin(), end(), [&data](auto& node) {
-                if (!node.isLeaf()) {
-                    return false;
+            size_t found = 0;
+            query(b, [&found](const entry_type&) { found++; });
+            return found;
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::aggregate(const box_type& b) const
+        -> aggregate_type
+    {
+        static_assert(node_type::aggregated, "Tree keeps no aggregate, Aggregate must not be NoAggregate.");
+        aggregate_type result;
+        if (_root && _root->getBoundingBox().intersects(b)) {
+            auto whole = [&result](const node_type& node) { result.add(node.getAggregate()); };
+            auto single = [&result](const entry_type& entry) { result.add(aggregate_type::of(entry.data)); };
+            coverNode(*_root, b, whole, single);
+        }
+        return result;
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename URBG>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::sample(const box_type& b, size_t k, URBG&& rng) const
+        -> std::vector<entry_type>
+    {
+        static_assert(node_type::aggregated, "Sampling needs subtree counts, Aggregate must not be NoAggregate.");
+        // Entries intersected by b, ranked in the order of the cover: whole subtrees have their counts, single entries count 1
+        struct Part
+        {
+            const node_type* subtree;
+            const entry_type* entry;
+            size_t count;
+        };
+        std::vector<Part> parts;
+        size_t total = 0;
+        if (_root && _root->getBoundingBox().intersects(b)) {
+            auto whole = [&](const node_type& node) {
+                parts.push_back({ &node, nullptr, node.getAggregate().count });
+                total += node.getAggregate().count;
+            };
+            auto single = [&](const entry_type& entry) {
+                parts.push_back({ nullptr, &entry, 1 });
+                total++;
+            };
+            coverNode(*_root, b, whole, single);
+        }
+        k = std::min(k, total);
+
+        // Floyd's algorithm picks k distinct ranks out of total with k random numbers
+        std::unordered_set<size_t> picked;
+        picked.reserve(k);
+        for (size_t j = total - k; j < total; j++) {
+            const auto r = std::uniform_int_distribution<size_t>(0, j)(rng);
+            picked.insert(picked.count(r) ? j : r);
+        }
+        std::vector<size_t> ranks(picked.begin(), picked.end());
+        std::sort(ranks.begin(), ranks.end());
+
+        std::vector<entry_type> sampled;
+        sampled.reserve(k);
+        auto part = parts.begin();
+        size_t partStart = 0;
+        for (auto rank: ranks) {
+            while (rank >= partStart + part->count) {
+                partStart += part->count;
+                part++;
+            }
+            if (part->entry) {
+                sampled.push_back(*part->entry);
+                continue;
+            }
+            // Descend to the entry by counts of children
+            rank -= partStart;
+            auto node = part->subtree;
+            while (!node->isLeaf()) {
+                for (const auto child: node->getChildren()) {
+                    if (rank < child->getAggregate().count) {
+                        node = child;
+                        break;
+                    }
+                    rank -= child->getAggregate().count;
                 }
-                return node.remove(data);
-            });
-            if (nodeIt == end()) {
-                return;
             }
-            node = nodeIt.get();
+            sampled.push_back(node->getEntries()[rank]);
         }
-        condense(node);
-        if (!empty() && !_root->isLeaf() && _root->size() == 1) {
-            _root = _root->getChildren()[0];
+        return sampled;
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename Iter>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::findBatch(Iter first, Iter last, ThreadPool& pool) const
+        -> BatchResult<entry_type>
+    {
+        // Chunks are small enough to balance expensive queries between threads
+        // and big enough to keep the shared counter out of the way
+        constexpr size_t ChunkSize = 16;
+        const size_t count = std::distance(first, last);
+        const size_t chunkCount = (count + ChunkSize - 1) / ChunkSize;
+        const auto chunkEnd = [count](size_t chunk) { return std::min(count, (chunk + 1) * ChunkSize); };
+
+        BatchResult<entry_type> result;
+        result.offsets.assign(count + 1, 0);
+        if (count == 0) {
+            return result;
+        }
+
+        // Where results of every chunk start in the buffer of the thread that ran it
+        struct ChunkLocation
+        {
+            size_t worker;
+            size_t begin;
+        };
+        std::vector<ChunkLocation> chunks(chunkCount);
+        std::vector<std::vector<entry_type>> buffers(pool.size());
+        std::atomic<size_t> nextChunk { 0 };
+        pool.run([&](size_t worker) {
+            auto& buffer = buffers[worker];
+            for (auto chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++) {
+                chunks[chunk] = { worker, buffer.size() };
+                for (auto i = chunk * ChunkSize; i < chunkEnd(chunk); i++) {
+                    const auto before = buffer.size();
+                    query(*std::next(first, i), std::back_inserter(buffer));
+                    result.offsets[i + 1] = buffer.size() - before;
+                }
+            }
+        });
+
+        std::partial_sum(result.offsets.begin(), result.offsets.end(), result.offsets.begin());
+        result.entries.resize(result.offsets.back());
+        nextChunk = 0;
+        pool.run([&](size_t) {
+            for (auto chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++) {
+                const auto from = result.offsets[chunk * ChunkSize];
+                const auto to = result.offsets[chunkEnd(chunk)];
+                const auto source = std::next(buffers[chunks[chunk].worker].begin(), chunks[chunk].begin);
+                std::copy(source, std::next(source, to - from), std::next(result.entries.begin(), from));
+            }
+        });
+        return result;
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::nearest(const point_type& p, size_t k) const
+        -> std::vector<entry_type>
+    {
+        std::vector<entry_type> closest;
+        if (!_root || k == 0) {
+            return closest;
+        }
+
+        // Queue holds both nodes and entries: an entry popped before any node is closer than
+        // everything under that node, so entries come out in the order of their distance
+        struct Candidate
+        {
+            double distance;
+            const node_type* node;
+            const entry_type* entry;
+
+            bool operator>(const Candidate& other) const { return distance > other.distance; }
+        };
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> queue;
+        queue.push({ _root->getBoundingBox().squaredDistance(p), _root, nullptr });
+        while (!queue.empty() && closest.size() < k) {
+            const auto candidate = queue.top();
+            queue.pop();
+            if (candidate.entry) {
+                closest.push_back(*candidate.entry);
+            }
+            else if (candidate.node->isLeaf()) {
+                for (const auto& entry: candidate.node->getEntries()) {
+                    queue.push({ entry.box.squaredDistance(p), nullptr, &entry });
+                }
+            }
+            else {
+                for (const auto child: candidate.node->getChildren()) {
+                    queue.push({ child->getBoundingBox().squaredDistance(p), child, nullptr });
+                }
+            }
         }
+        return closest;
     }
 
-    template<typename DataType, typename SplitStrategy>
-    void Tree<DataType, SplitStrategy>::insert(BoundingBox b, DataType data)
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::topK(const box_type& b, size_t k) const
+        -> std::vector<entry_type>
     {
-        saveToCache(data, b);
-        insertIgnoreCache(b, data);
+        static_assert(IsMaxAggregate<Aggregate>::value, "Search by priority needs the largest priority of every subtree, Aggregate must be MaxAggregate.");
+        std::vector<entry_type> best;
+        if (!_root || k == 0 || !_root->getBoundingBox().intersects(b)) {
+            return best;
+        }
+
+        // Queue holds both nodes and entries: an entry popped before any node has a priority
+        // no entry under that node can exceed, so entries come out in the order of their priorities
+        using priority_type = typename aggregate_type::value_type;
+        struct Candidate
+        {
+            priority_type priority;
+            const node_type* node;
+            const entry_type* entry;
+
+            bool operator<(const Candidate& other) const { return priority < other.priority; }
+        };
+        std::priority_queue<Candidate> queue;
+        queue.push({ _root->getAggregate().value, _root, nullptr });
+        while (!queue.empty() && best.size() < k) {
+            const auto candidate = queue.top();
+            queue.pop();
+            if (candidate.entry) {
+                best.push_back(*candidate.entry);
+            }
+            else if (candidate.node->isLeaf()) {
+                const auto& entries = candidate.node->getEntries();
+                candidate.node->getBoxes().forEachIntersecting(b, [&](size_t i) {
+                    queue.push({ Aggregate::of(entries[i].data), nullptr, &entries[i] });
+                    return true;
+                });
+            }
+            else {
+                const auto& children = candidate.node->getChildren();
+                candidate.node->getBoxes().forEachIntersecting(b, [&](size_t i) {
+                    queue.push({ children[i]->getAggregate().value, children[i], nullptr });
+                    return true;
+                });
+            }
+        }
+        return best;
     }
 
-    template<typename DataType, typename SplitStrategy>
-    std::vector<Entry<DataType>> Tree<DataType, SplitStrategy>::find(BoundingBox b) const
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename Callback>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::selfJoin(Callback&& callback) const
     {
-        std::vector<Entry<DataType>> intersected;
-        std::stack<node_ptr<DataType>> stack { { _root } };
+        if (_root) {
+            selfJoinNode(_root, _root->height(), callback);
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::withinDistance(const point_type& p, double r) const
+        -> std::vector<entry_type>
+    {
+        std::vector<entry_type> found;
+        if (!_root || r < 0) {
+            return found;
+        }
+        const auto maxDistance = r * r;
+        std::stack<const node_type*> stack { { _root } };
         while (!stack.empty()) {
             const auto node = stack.top();
             stack.pop();
             if (node->isLeaf()) {
                 for (const auto& entry: node->getEntries()) {
-                    const auto box = entry.box;
-                    if (box.intersects(b)) {
-                        intersected.push_back(entry);
+                    if (entry.box.squaredDistance(p) <= maxDistance) {
+                        found.push_back(entry);
                     }
                 }
             }
             else {
-                const auto& children = node->getChildren();
-                for (const auto& child: children) {
-                    stack.emplace(child); // TODO: emplace only if children is intersected
+                for (const auto child: node->getChildren()) {
+                    if (child->getBoundingBox().squaredDistance(p) <= maxDistance) {
+                        stack.push(child);
+                    }
                 }
             }
         }
-        return intersected;
+        return found;
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename Visitor>
+    bool Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::queryNode(const node_type& node, const box_type& b, Visitor& visitor)
+    {
+        // Recursion depth is bounded by the tree height, so no traversal stack has to be allocated
+        if (node.isLeaf()) {
+            const auto& entries = node.getEntries();
+            return node.getBoxes().forEachIntersecting(b, [&](size_t i) {
+                if constexpr (std::is_same<std::invoke_result_t<Visitor&, const entry_type&>, bool>::value) {
+                    return visitor(entries[i]);
+                }
+                else {
+                    visitor(entries[i]);
+                    return true;
+                }
+            });
+        }
+
+        const auto& children = node.getChildren();
+        return node.getBoxes().forEachIntersecting(b, [&](size_t i) {
+            return queryNode(*children[i], b, visitor);
+        });
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename Whole, typename Single>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::coverNode(const node_type& node, const box_type& b,
+                                                                                                 Whole& whole, Single& single)
+    {
+        // Every entry of a node that lies inside b is intersected by it
+        if ((b & node.getBoundingBox()) == b) {
+            whole(node);
+            return;
+        }
+        if (node.isLeaf()) {
+            const auto& entries = node.getEntries();
+            node.getBoxes().forEachIntersecting(b, [&](size_t i) {
+                single(entries[i]);
+                return true;
+            });
+            return;
+        }
+
+        const auto& children = node.getChildren();
+        node.getBoxes().forEachIntersecting(b, [&](size_t i) {
+            coverNode(*children[i], b, whole, single);
+            return true;
+        });
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename Fn>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::refitSubtree(node_type* node, Fn& fn)
+    {
+        if (node->isLeaf()) {
+            for (size_t i = 0; i < node->size(); i++) {
+                auto box = node->getEntries()[i].box;
+                fn(node->getEntries()[i].data, box);
+                node->setEntryBox(i, box);
+            }
+        }
+        else {
+            for (const auto child: node->getChildren()) {
+                refitSubtree(child, fn);
+            }
+        }
+        node->setLargestHilbertValue(UnknownHilbertValue);
+        node->updateBoundingBox();
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::resetChanges()
+    {
+        if (_trackChanges) {
+            _changes.clear();
+            _changesReset = true;
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::refitUpward(node_type* node)
+    {
+        while (node) {
+            const auto before = node->getBoundingBox();
+            node->updateBoundingBox();
+            if (node->getBoundingBox() == before) {
+                return;
+            }
+            node = node->getParent();
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    bool Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::strays(const node_type* leaf, size_t slot,
+                                                                                              const box_type& b) const
+    {
+        // Other entries don't move with the entry, so an entry drifting away a little at a time strays eventually
+        box_type others;
+        const auto& entries = leaf->getEntries();
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (i != slot) {
+                others = others & entries[i].box;
+            }
+        }
+        return !others.isEmpty() && (others & b).margin() > others.margin() * (1 + UpdateStretchLimit);
     }
 
-    template<typename DataType, typename SplitStrategy>
-    void Tree<DataType, SplitStrategy>::condense(node_ptr<DataType> node)
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::condense(node_type* node)
     {
-        std::vector<node_ptr<DataType>> removed;
+        std::vector<std::pair<node_type*, size_t>> removed;
         auto current = node;
+        size_t height = 0;
         // Go all the way up till we find node that doesn`t need to be reinserted
         while (current != _root) {
             const auto parent = current->getParent();
-            if (current->size() < DefaultMinEntries) {
+            if (current->size() < getMinEntries()) {
                 parent->removeChild(current);
-                removed.push_back(current);
+                removed.emplace_back(current, height);
             }
             else {
                 current->updateBoundingBoxes();
                 break;
             }
             current = parent;
-        }
-        for (const auto& node: removed) {
-            for (const auto& entry: node->getEntries()) {
-                insertIgnoreCache(entry.box, entry.data);
-            }
+            height++;
         }
         if (_root->size() == 0) {
+            _pool.destroy(_root);
             _root = nullptr;
         }
+        // Orphaned subtrees are reinserted at their own levels, the highest ones go first
+        std::vector<bool> reinserted;
+        for (auto it = removed.rbegin(); it != removed.rend(); it++) {
+            const auto& [orphan, orphanHeight] = *it;
+            if (orphan->isLeaf()) {
+                for (const auto& entry: orphan->getEntries()) {
+                    insertEntry(entry, reinserted);
+                }
+            }
+            else {
+                for (const auto& child: orphan->getChildren()) {
+                    insertSubtree(child, orphanHeight - 1, reinserted);
+                }
+            }
+            _pool.destroy(orphan);
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::trackChanges(bool enabled)
+    {
+        _trackChanges = enabled;
+        _changes.clear();
+        _changesReset = false;
     }
 
-    template<typename DataType, typename SplitStrategy>
-    void Tree<DataType, SplitStrategy>::insertIgnoreCache(BoundingBox b, DataType data)
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::takeChanges()
+        -> std::optional<std::vector<DataType>>
+    {
+        if (std::exchange(_changesReset, false)) {
+            _changes.clear();
+            return {};
+        }
+        return std::exchange(_changes, {});
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::shrinkRoot()
+    {
+        while (!empty() && !_root->isLeaf() && _root->size() == 1) {
+            const auto oldRoot = _root;
+            _root = _root->getChildren()[0];
+            _root->setParent(nullptr);
+            _pool.destroy(oldRoot);
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename Iter, typename MakeNode>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::packLevel(Iter begin, Iter end, MakeNode makeNode) const
+        -> std::vector<node_type*>
+    {
+        const size_t count = std::distance(begin, end);
+        const size_t nodeCount = (count + getMaxEntries() - 1) / getMaxEntries();
+        std::vector<node_type*> nodes;
+        nodes.reserve(nodeCount);
+        for (size_t i = 0; i + 2 < nodeCount; i++) {
+            nodes.push_back(makeNode(begin, std::next(begin, getMaxEntries())));
+            begin = std::next(begin, getMaxEntries());
+        }
+        const size_t rest = std::distance(begin, end);
+        if (nodeCount > 1) {
+            const auto lastSize = rest - getMaxEntries();
+            const auto firstOfTwo = lastSize < getMinEntries() ? rest - rest / 2 : getMaxEntries();
+            nodes.push_back(makeNode(begin, std::next(begin, firstOfTwo)));
+            begin = std::next(begin, firstOfTwo);
+        }
+        nodes.push_back(makeNode(begin, end));
+        return nodes;
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::insertEntry(const entry_type& e, std::vector<bool>& reinserted)
     {
-        Entry<DataType> e = { .box=b, .data=data };
         if (!_root) {
-            _root = Node<DataType>::makeNode(e);
+            _root = node_type::makeNode(_pool, e);
+            indexEntry(_root, 0);
             return;
         }
 
-        auto nodeToInsert = findInsertCandidate(b);
+        auto nodeToInsert = findInsertCandidate(e.box);
         nodeToInsert->insert(e);
-        auto node = nodeToInsert;
+        indexEntry(nodeToInsert, nodeToInsert->size() - 1);
+        treatOverflow(nodeToInsert, 0, reinserted);
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::insertSubtree(node_type* subtree, size_t height,
+                                                      std::vector<bool>& reinserted)
+    {
+        if (!_root) {
+            _root = subtree;
+            _root->setParent(nullptr);
+            return;
+        }
+
+        auto nodeToInsert = findInsertCandidate(subtree->getBoundingBox(), height + 1);
+        nodeToInsert->insertChild(subtree);
+        treatOverflow(nodeToInsert, height + 1, reinserted);
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::treatOverflow(node_type* node, size_t height,
+                                                      std::vector<bool>& reinserted)
+    {
         while (needSplit(node)) {
-            auto parent = node->getParent();
-            const auto splitnodes = split(node);
-            if (splitnodes.first && splitnodes.second) {
-                if (parent) {
-                    parent->removeChild(node); // TODO: can optimize here by skipping updateBoundingBox() call
-                    parent->insertChild(splitnodes.first);
-                    parent->insertChild(splitnodes.second);
-                    splitnodes.first->setParent(parent);
-                    splitnodes.second->setParent(parent);
+            if constexpr (HasForcedReinsert<SplitStrategy>::value) {
+                if (reinserted.size() <= height) {
+                    reinserted.resize(height + 1, false);
                 }
-                else { // node is a root
-                    auto newRoot = Node<DataType>::makeNode(splitnodes.first);
-                    newRoot->insertChild(splitnodes.second);
-                    splitnodes.first->setParent(newRoot);
-                    splitnodes.second->setParent(newRoot);
-                    _root = newRoot;
-                    break;
+                if (node != _root && !reinserted[height]) {
+                    reinserted[height] = true;
+                    reinsert(node, height, reinserted);
+                    return;
                 }
             }
-            node = parent;
+
+            const auto parent = node->getParent();
+            const auto halves = replaceBySplit(node);
+            node = halves.first ? halves.first->getParent() : parent;
+            height++;
         }
     }
 
-    template<typename DataType, typename SplitStrategy>
-    node_ptr<DataType> Tree<DataType, SplitStrategy>::findInsertCandidate(BoundingBox b) const
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::replaceBySplit(node_type* node)
+        -> split_result<node_type>
     {
-        auto node = _root;
-        while (node->getEntries().empty()) {
-            double minArea = 0.0;
-            node_ptr<DataType> bestChild = nullptr;
-            const auto& children = node->getChildren();
-            if (children.empty()) {
-                throw std::logic_error("Node has no children. Tree is probably corrupted");
+        const auto parent = node->getParent();
+        const auto halves = split(node);
+        if (!halves.first || !halves.second) {
+            return halves;
+        }
+        if (node->isLeaf()) {
+            indexLeaf(halves.first);
+            indexLeaf(halves.second);
+        }
+        if (parent) {
+            parent->removeChild(node); // TODO: can optimize here by skipping updateBoundingBox() call
+            parent->insertChild(halves.first);
+            parent->insertChild(halves.second);
+        }
+        else { // node is a root
+            _root = node_type::makeNode(_pool, halves.first);
+            _root->insertChild(halves.second);
+        }
+        _pool.destroy(node);
+        return halves;
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::splitUpward(node_type* node)
+        -> split_result<node_type>
+    {
+        const auto halves = replaceBySplit(node);
+        auto ancestor = halves.first->getParent();
+        while (needSplit(ancestor)) {
+            ancestor = replaceBySplit(ancestor).first->getParent();
+        }
+        return halves;
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::removeBatch(
+        std::vector<std::pair<node_type*, DataType>>& removals, std::vector<DataType>& touched)
+    {
+        std::sort(removals.begin(), removals.end(), [](const auto& l, const auto& r) {
+            return std::less<node_type*>()(l.first, r.first);
+        });
+
+        // Condensing a leaf moves entries of other leaves around, so the leaf is looked up by id every time
+        node_type* leaf = nullptr;
+        const auto settle = [&]() {
+            if (!leaf) {
+                return;
             }
-            for (const auto child: children) {
-                const auto areaAfterInsert = (child->getBoundingBox() & b).area();
-                if (!bestChild) {
-                    bestChild = child;
-                    minArea = areaAfterInsert;
-                }
-                else if (areaAfterInsert < minArea) {
-                    bestChild = child;
-                    minArea = areaAfterInsert;
-                }
-                else if (areaAfterInsert == minArea &&
-                         child->getBoundingBox().area() < bestChild->getBoundingBox().area()) {
-                    bestChild = child;
-                    minArea = areaAfterInsert;
-                }
+            if (leaf == _root ? leaf->size() == 0 : leaf->size() < getMinEntries()) {
+                // Root has to keep at least two children, otherwise orphans of the next condense
+                // could be reinserted at the level of the root
+                condense(leaf);
+                shrinkRoot();
+            }
+            else {
+                touched.push_back(leaf->getEntries().front().data);
+            }
+        };
+        for (const auto& removal: removals) {
+            auto location = _index.find(removal.second);
+            if (location->leaf != leaf) {
+                settle();
+                location = _index.find(removal.second);
+                leaf = location->leaf;
+            }
+            const auto slot = location->slot;
+            _index.erase(removal.second);
+            leaf->removeAt(slot, false);
+            if (slot < leaf->size()) {
+                indexEntry(leaf, slot);
             }
-            node = bestChild;
         }
-        return node;
+        settle();
     }
 
-    template<typename DataType, typename SplitStrategy>
-    node_ptr<DataType> Tree<DataType, SplitStrategy>::findContaining(Entry<DataType> e) const
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::insertBatch(std::vector<entry_type>& entries,
+                                                                                       std::vector<DataType>& touched)
     {
-        if (!_root->getBoundingBox().overlaps(e.box)) {
-            return nullptr;
+        if (entries.empty()) {
+            return;
+        }
+        _index.reserve(_index.size() + entries.size());
+        for (const auto& entry: entries) {
+            _index.insert(entry.data, { nullptr, 0 });
         }
 
-        if (_root->isLeaf()) {
-            return std::find(_root->getEntries().begin(), _root->getEntries().end(), e) != 
-                   _root->getEntries().end() ?
-                _root :
-                nullptr;
+        auto first = entries.begin();
+        if (!_root) {
+            std::vector<bool> reinserted;
+            insertEntry(*first++, reinserted);
         }
+        route(_root, first, entries.end(), touched);
+    }
 
-        std::stack<node_ptr<DataType>> stack { { _root } };
-        while (!stack.empty()) {
-            const auto node = stack.top();
-            stack.pop();
-            if (!node->isLeaf()) {
-                const auto& children = node->getChildren();
-                for (auto it = children.begin(); it != children.end(); it++) {
-                    if ((*it)->getBoundingBox().overlaps(e.box)) {
-                        if ((*it)->isLeaf()) {
-                            if (std::find((*it)->getEntries().begin(), (*it)->getEntries().end(), e) !=
-                                (*it)->getEntries().end()) {
-                                return (*it);
-                            }
-                        }
-                        else {
-                            stack.emplace((*it));
-                        }
-                    }
-                }
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename Iter>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::route(node_type* node, Iter begin, Iter end,
+                                                                                 std::vector<DataType>& touched)
+    {
+        if (begin == end) {
+            return;
+        }
+        if (node->isLeaf()) {
+            fillLeaf(node, begin, end, touched);
+            return;
+        }
+
+        // Entries are bucketed by the child they go to, which sorts them spatially one level at a time.
+        // Splits below may replace the node, but never its children, so they are remembered beforehand
+        const auto& nodeChildren = node->getChildren();
+        const std::vector<node_type*> children(nodeChildren.begin(), nodeChildren.end());
+        const size_t count = std::distance(begin, end);
+        std::vector<size_t> target(count);
+        std::vector<size_t> offsets(children.size() + 1, 0);
+        for (size_t i = 0; i < count; i++) {
+            const auto& box = std::next(begin, i)->box;
+            if constexpr (HasChooseSubtree<SplitStrategy, node_type>::value) {
+                const auto child = SplitStrategy::chooseSubtree(node, box);
+                target[i] = std::distance(nodeChildren.begin(), std::find(nodeChildren.begin(), nodeChildren.end(), child));
+            }
+            else {
+                target[i] = node->getBoxes().leastGrowth(box);
             }
+            offsets[target[i] + 1]++;
+        }
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        std::vector<entry_type> bucketed(count);
+        auto position = offsets;
+        for (size_t i = 0; i < count; i++) {
+            bucketed[position[target[i]]++] = *std::next(begin, i);
+        }
+        std::copy(bucketed.begin(), bucketed.end(), begin);
+
+        for (size_t c = 0; c < children.size(); c++) {
+            route(children[c], std::next(begin, offsets[c]), std::next(begin, offsets[c + 1]), touched);
         }
-        return nullptr;
     }
 
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    template<typename Iter>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::fillLeaf(node_type* leaf, Iter begin, Iter end,
+                                                                                    std::vector<DataType>& touched)
+    {
+        // Split destroys only the leaf and its ancestors, so the halves can be filled one after another
+        std::vector<std::tuple<node_type*, Iter, Iter>> pending { { leaf, begin, end } };
+        while (!pending.empty()) {
+            auto [node, it, last] = pending.back();
+            pending.pop_back();
+            for (; it != last; ++it) {
+                node->insert(*it, false);
+                indexEntry(node, node->size() - 1);
+                if (needSplit(node)) {
+                    break;
+                }
+            }
+            if (it == last) {
+                touched.push_back(node->getEntries().front().data);
+                continue;
+            }
 
-    template<typename DataType, typename SplitStrategy>
-    split_result<DataType> Tree<DataType, SplitStrategy>::split(node_ptr<DataType> node) const
+            const auto halves = splitUpward(node);
+            BoxArray<DynamicCapacity, Coord> boxes;
+            boxes.push_back(halves.first->getBoundingBox());
+            boxes.push_back(halves.second->getBoundingBox());
+            const auto middle = std::stable_partition(std::next(it), last,
+                [&boxes](const auto& entry) { return boxes.leastGrowth(entry.box) == 0; });
+            pending.emplace_back(halves.first, std::next(it), middle);
+            pending.emplace_back(halves.second, middle, last);
+        }
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::refitLeaves(const std::vector<DataType>& ids)
     {
-        if (node->size() <= 1) {
-            return std::make_pair(nullptr, nullptr);
+        std::vector<node_type*> level;
+        for (const auto& data: ids) {
+            if (const auto location = _index.find(data)) {
+                level.push_back(location->leaf);
+            }
+        }
+        while (!level.empty()) {
+            std::sort(level.begin(), level.end(), std::less<node_type*>());
+            level.erase(std::unique(level.begin(), level.end()), level.end());
+            std::vector<node_type*> parents;
+            for (const auto node: level) {
+                node->updateBoundingBox();
+                if (node->getParent()) {
+                    parents.push_back(node->getParent());
+                }
+            }
+            level = std::move(parents);
         }
+    }
 
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::reinsert(node_type* node, size_t height,
+                                                 std::vector<bool>& reinserted)
+    {
+        const auto count = static_cast<size_t>(std::ceil(node->size() * SplitStrategy::reinsertFraction));
+        const auto center = node->getBoundingBox().center();
+        const auto byDistance = [&center](const auto& l, const auto& r) {
+            const auto lv = boxOf(l).center() - center;
+            const auto rv = boxOf(r).center() - center;
+            return lv.x * lv.x + lv.y * lv.y < rv.x * rv.x + rv.y * rv.y;
+        };
+
+        // Entries farthest from the center are removed and then reinserted starting from the closest one
         if (node->isLeaf()) {
-            return SplitStrategy::splitLeaf(node);
+            auto entries = node->getEntries();
+            std::sort(entries.begin(), entries.end(), byDistance);
+            const auto first = std::prev(entries.end(), count);
+            std::for_each(first, entries.end(), [&node](const auto& entry) { node->remove(entry); });
+            indexLeaf(node);
+            std::for_each(first, entries.end(), [&](const auto& entry) { insertEntry(entry, reinserted); });
         }
-        else { // not leaf
-            return SplitStrategy::splitInner(node);
+        else {
+            auto children = node->getChildren();
+            std::sort(children.begin(), children.end(), byDistance);
+            const auto first = std::prev(children.end(), count);
+            std::for_each(first, children.end(), [&node](const auto& child) { node->removeChild(child); });
+            std::for_each(first, children.end(), [&](const auto& child) { insertSubtree(child, height - 1, reinserted); });
         }
     }
 
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::findInsertCandidate(box_type b, size_t height) const
+        -> node_type*
+    {
+        auto node = _root;
+        for (auto nodeHeight = _root->height(); nodeHeight > height; nodeHeight--) {
+            if (node->getChildren().empty()) {
+                throw std::logic_error("Node has no children. Tree is probably corrupted");
+            }
+            node = chooseSubtree(node, b);
+        }
+        return node;
+    }
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::chooseSubtree(node_type* node, box_type b) const
+        -> node_type*
+    {
+        if constexpr (HasChooseSubtree<SplitStrategy, node_type>::value) {
+            return SplitStrategy::chooseSubtree(node, b);
+        }
+        else {
+            return node->getChildren()[node->getBoxes().leastGrowth(b)];
+        }
+    }
 
-    template<typename DataType, typename SplitStrategy>
-    std::optional<BoundingBox> Tree<DataType, SplitStrategy>::getFromCache(DataType data) const
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    auto Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::split(node_type* node)
+        -> split_result<node_type>
     {
-        const auto it = _cache.find(data);
-        if (it != _cache.end()) {
-            return it->second;
+        if (node->size() <= 1) {
+            return std::make_pair(nullptr, nullptr);
+        }
+
+        if constexpr (HasMinEntriesSplit<SplitStrategy, node_type>::value) {
+            if (node->isLeaf()) {
+                return SplitStrategy::splitLeaf(node, _pool, getMinEntries());
+            }
+            return SplitStrategy::splitInner(node, _pool, getMinEntries());
+        }
+        else if (node->isLeaf()) {
+            return SplitStrategy::splitLeaf(node, _pool);
+        }
+        else { // not leaf
+            return SplitStrategy::splitInner(node, _pool);
         }
-        return {};
     }
 
-    template<typename DataType, typename SplitStrategy>
-    void Tree<DataType, SplitStrategy>::removeFromCache(DataType data)
+
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::indexEntry(node_type* leaf, size_t slot)
     {
-        _cache.erase(data);
+        *_index.find(leaf->getEntries()[slot].data) = { leaf, slot };
     }
 
-    template<typename DataType, typename SplitStrategy>
-    void Tree<DataType, SplitStrategy>::saveToCache(DataType data, BoundingBox b)
+    template<typename DataType, typename SplitStrategy, size_t MaxEntries, size_t MinEntries, typename Coord, typename Aggregate, typename Lock>
+    void Tree<DataType, SplitStrategy, MaxEntries, MinEntries, Coord, Aggregate, Lock>::indexLeaf(node_type* leaf)
     {
-        const auto inserted = _cache.insert(std::make_pair(data, b));
-        if (!inserted.second) {
-            throw DuplicateEntryException("saveToCache() error: entry " + toString(data) + " is already exists");
+        for (size_t slot = 0; slot < leaf->size(); slot++) {
+            indexEntry(leaf, slot);
         }
     }
 } // namespace rtree
\ No newline at end of file
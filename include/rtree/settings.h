@@ -6,6 +6,12 @@ namespace rtree
 {
     constexpr size_t DefaultMinEntries = 2;
     constexpr size_t DefaultMaxEntries = 10;
+    // Marks fanout that is chosen at runtime instead of being a template parameter
+    constexpr size_t DynamicCapacity = 0;
+    // Share of the margin of other entries of a leaf that a moved entry may add to it before it is reinserted
+    constexpr double UpdateStretchLimit = 0.5;
+    // Size of a node page of a file-backed tree
+    constexpr size_t DefaultPageSize = 4096;
 
     static_assert(DefaultMinEntries <= DefaultMaxEntries / 2,
         "Minimum number of node entries must be less or equal to maximum number divided by 2.");
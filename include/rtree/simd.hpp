@@ -0,0 +1,372 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "bounding_box.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RTREE_SIMD_X86
+#include <immintrin.h>
+#endif
+
+
+namespace rtree
+{
+    // Kernels that test a whole node worth of boxes stored as separate
+    // minX/minY/maxX/maxY arrays against one query box.
+    // The widest instruction set supported by the CPU is picked once at runtime.
+    // Vector kernels exist for double, float and 32-bit integer coordinates,
+    // other coordinate types fall back to the scalar ones.
+    namespace simd
+    {
+        template<typename Coord>
+        struct Query
+        {
+            Coord minX;
+            Coord minY;
+            Coord maxX;
+            Coord maxY;
+        };
+
+        template<typename Coord>
+        using IntersectKernel = std::uint64_t (*)(const Coord* minX, const Coord* minY,
+                                                  const Coord* maxX, const Coord* maxY,
+                                                  size_t count, const Query<Coord>& q);
+        template<typename Coord>
+        using GrowthKernel = size_t (*)(const Coord* minX, const Coord* minY,
+                                        const Coord* maxX, const Coord* maxY,
+                                        size_t count, const Query<Coord>& q);
+
+
+        /**
+         * Bit i of the result is set if box i intersects q. count must not exceed 64
+         */
+        template<typename Coord>
+        std::uint64_t intersectMaskScalar(const Coord* minX, const Coord* minY,
+                                          const Coord* maxX, const Coord* maxY,
+                                          size_t count, const Query<Coord>& q)
+        {
+            std::uint64_t mask = 0;
+            for (size_t i = 0; i < count; i++) {
+                const bool hit = (minX[i] <= q.maxX) & (q.minX <= maxX[i]) &
+                                 (minY[i] <= q.maxY) & (q.minY <= maxY[i]);
+                mask |= std::uint64_t(hit) << i;
+            }
+            return mask;
+        }
+
+        /**
+         * Compare growth candidates the same way as Tree::chooseSubtree() does:
+         * the smallest enlargement of the area wins, ties are resolved by the smallest area
+         */
+        template<typename Area>
+        void pickLeastGrowth(const Area* growth, const Area* area, size_t offset, size_t count,
+                             size_t& best, Area& bestGrowth, Area& bestArea)
+        {
+            for (size_t i = 0; i < count; i++) {
+                if (best == size_t(-1) || growth[i] < bestGrowth ||
+                    (growth[i] == bestGrowth && area[i] < bestArea)) {
+                    best = offset + i;
+                    bestGrowth = growth[i];
+                    bestArea = area[i];
+                }
+            }
+        }
+
+        template<typename Coord>
+        void pickLeastGrowthScalar(const Coord* minX, const Coord* minY,
+                                   const Coord* maxX, const Coord* maxY,
+                                   size_t begin, size_t end, const Query<Coord>& q,
+                                   size_t& best, area_t<Coord>& bestGrowth, area_t<Coord>& bestArea)
+        {
+            using Area = area_t<Coord>;
+            for (size_t i = begin; i < end; i++) {
+                const Area unionArea = (Area(std::max(maxX[i], q.maxX)) - std::min(minX[i], q.minX)) *
+                                       (Area(std::max(maxY[i], q.maxY)) - std::min(minY[i], q.minY));
+                const Area area = (Area(maxX[i]) - minX[i]) * (Area(maxY[i]) - minY[i]);
+                const Area growth = unionArea - area;
+                pickLeastGrowth(&growth, &area, i, 1, best, bestGrowth, bestArea);
+            }
+        }
+
+        /**
+         * Index of the box whose area grows the least after being extended with q
+         */
+        template<typename Coord>
+        size_t leastGrowthScalar(const Coord* minX, const Coord* minY,
+                                 const Coord* maxX, const Coord* maxY,
+                                 size_t count, const Query<Coord>& q)
+        {
+            size_t best = -1;
+            area_t<Coord> bestGrowth = 0;
+            area_t<Coord> bestArea = 0;
+            pickLeastGrowthScalar(minX, minY, maxX, maxY, 0, count, q, best, bestGrowth, bestArea);
+            return best;
+        }
+
+#ifdef RTREE_SIMD_X86
+        inline std::uint64_t intersectMaskSse2(const double* minX, const double* minY,
+                                               const double* maxX, const double* maxY,
+                                               size_t count, const Query<double>& q)
+        {
+            const auto qMinX = _mm_set1_pd(q.minX);
+            const auto qMinY = _mm_set1_pd(q.minY);
+            const auto qMaxX = _mm_set1_pd(q.maxX);
+            const auto qMaxY = _mm_set1_pd(q.maxY);
+            std::uint64_t mask = 0;
+            size_t i = 0;
+            for (; i + 2 <= count; i += 2) {
+                const auto hit = _mm_and_pd(
+                    _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(minX + i), qMaxX), _mm_cmple_pd(qMinX, _mm_loadu_pd(maxX + i))),
+                    _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(minY + i), qMaxY), _mm_cmple_pd(qMinY, _mm_loadu_pd(maxY + i))));
+                mask |= std::uint64_t(_mm_movemask_pd(hit)) << i;
+            }
+            if (i < count) {
+                mask |= intersectMaskScalar(minX + i, minY + i, maxX + i, maxY + i, count - i, q) << i;
+            }
+            return mask;
+        }
+
+        inline std::uint64_t intersectMaskSse2(const float* minX, const float* minY,
+                                               const float* maxX, const float* maxY,
+                                               size_t count, const Query<float>& q)
+        {
+            const auto qMinX = _mm_set1_ps(q.minX);
+            const auto qMinY = _mm_set1_ps(q.minY);
+            const auto qMaxX = _mm_set1_ps(q.maxX);
+            const auto qMaxY = _mm_set1_ps(q.maxY);
+            std::uint64_t mask = 0;
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const auto hit = _mm_and_ps(
+                    _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(minX + i), qMaxX), _mm_cmple_ps(qMinX, _mm_loadu_ps(maxX + i))),
+                    _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(minY + i), qMaxY), _mm_cmple_ps(qMinY, _mm_loadu_ps(maxY + i))));
+                mask |= std::uint64_t(_mm_movemask_ps(hit)) << i;
+            }
+            if (i < count) {
+                mask |= intersectMaskScalar(minX + i, minY + i, maxX + i, maxY + i, count - i, q) << i;
+            }
+            return mask;
+        }
+
+        inline std::uint64_t intersectMaskSse2(const std::int32_t* minX, const std::int32_t* minY,
+                                               const std::int32_t* maxX, const std::int32_t* maxY,
+                                               size_t count, const Query<std::int32_t>& q)
+        {
+            const auto qMinX = _mm_set1_epi32(q.minX);
+            const auto qMinY = _mm_set1_epi32(q.minY);
+            const auto qMaxX = _mm_set1_epi32(q.maxX);
+            const auto qMaxY = _mm_set1_epi32(q.maxY);
+            std::uint64_t mask = 0;
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const auto bMinX = _mm_loadu_si128(reinterpret_cast<const __m128i*>(minX + i));
+                const auto bMinY = _mm_loadu_si128(reinterpret_cast<const __m128i*>(minY + i));
+                const auto bMaxX = _mm_loadu_si128(reinterpret_cast<const __m128i*>(maxX + i));
+                const auto bMaxY = _mm_loadu_si128(reinterpret_cast<const __m128i*>(maxY + i));
+                // Integers have only "greater than" comparison, so lanes that miss the query are collected
+                const auto miss = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpgt_epi32(bMinX, qMaxX), _mm_cmpgt_epi32(qMinX, bMaxX)),
+                    _mm_or_si128(_mm_cmpgt_epi32(bMinY, qMaxY), _mm_cmpgt_epi32(qMinY, bMaxY)));
+                mask |= std::uint64_t(~_mm_movemask_ps(_mm_castsi128_ps(miss)) & 0xF) << i;
+            }
+            if (i < count) {
+                mask |= intersectMaskScalar(minX + i, minY + i, maxX + i, maxY + i, count - i, q) << i;
+            }
+            return mask;
+        }
+
+        __attribute__((target("avx2")))
+        inline std::uint64_t intersectMaskAvx2(const double* minX, const double* minY,
+                                               const double* maxX, const double* maxY,
+                                               size_t count, const Query<double>& q)
+        {
+            const auto qMinX = _mm256_set1_pd(q.minX);
+            const auto qMinY = _mm256_set1_pd(q.minY);
+            const auto qMaxX = _mm256_set1_pd(q.maxX);
+            const auto qMaxY = _mm256_set1_pd(q.maxY);
+            std::uint64_t mask = 0;
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const auto hit = _mm256_and_pd(
+                    _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(minX + i), qMaxX, _CMP_LE_OQ),
+                                  _mm256_cmp_pd(qMinX, _mm256_loadu_pd(maxX + i), _CMP_LE_OQ)),
+                    _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(minY + i), qMaxY, _CMP_LE_OQ),
+                                  _mm256_cmp_pd(qMinY, _mm256_loadu_pd(maxY + i), _CMP_LE_OQ)));
+                mask |= std::uint64_t(_mm256_movemask_pd(hit)) << i;
+            }
+            if (i < count) {
+                mask |= intersectMaskScalar(minX + i, minY + i, maxX + i, maxY + i, count - i, q) << i;
+            }
+            return mask;
+        }
+
+        __attribute__((target("avx2")))
+        inline std::uint64_t intersectMaskAvx2(const float* minX, const float* minY,
+                                               const float* maxX, const float* maxY,
+                                               size_t count, const Query<float>& q)
+        {
+            const auto qMinX = _mm256_set1_ps(q.minX);
+            const auto qMinY = _mm256_set1_ps(q.minY);
+            const auto qMaxX = _mm256_set1_ps(q.maxX);
+            const auto qMaxY = _mm256_set1_ps(q.maxY);
+            std::uint64_t mask = 0;
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                const auto hit = _mm256_and_ps(
+                    _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(minX + i), qMaxX, _CMP_LE_OQ),
+                                  _mm256_cmp_ps(qMinX, _mm256_loadu_ps(maxX + i), _CMP_LE_OQ)),
+                    _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(minY + i), qMaxY, _CMP_LE_OQ),
+                                  _mm256_cmp_ps(qMinY, _mm256_loadu_ps(maxY + i), _CMP_LE_OQ)));
+                mask |= std::uint64_t(_mm256_movemask_ps(hit)) << i;
+            }
+            if (i < count) {
+                mask |= intersectMaskScalar(minX + i, minY + i, maxX + i, maxY + i, count - i, q) << i;
+            }
+            return mask;
+        }
+
+        __attribute__((target("avx2")))
+        inline std::uint64_t intersectMaskAvx2(const std::int32_t* minX, const std::int32_t* minY,
+                                               const std::int32_t* maxX, const std::int32_t* maxY,
+                                               size_t count, const Query<std::int32_t>& q)
+        {
+            const auto qMinX = _mm256_set1_epi32(q.minX);
+            const auto qMinY = _mm256_set1_epi32(q.minY);
+            const auto qMaxX = _mm256_set1_epi32(q.maxX);
+            const auto qMaxY = _mm256_set1_epi32(q.maxY);
+            std::uint64_t mask = 0;
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                const auto bMinX = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(minX + i));
+                const auto bMinY = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(minY + i));
+                const auto bMaxX = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(maxX + i));
+                const auto bMaxY = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(maxY + i));
+                const auto miss = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpgt_epi32(bMinX, qMaxX), _mm256_cmpgt_epi32(qMinX, bMaxX)),
+                    _mm256_or_si256(_mm256_cmpgt_epi32(bMinY, qMaxY), _mm256_cmpgt_epi32(qMinY, bMaxY)));
+                mask |= std::uint64_t(~_mm256_movemask_ps(_mm256_castsi256_ps(miss)) & 0xFF) << i;
+            }
+            if (i < count) {
+                mask |= intersectMaskScalar(minX + i, minY + i, maxX + i, maxY + i, count - i, q) << i;
+            }
+            return mask;
+        }
+
+        __attribute__((target("avx2")))
+        inline size_t leastGrowthAvx2(const double* minX, const double* minY,
+                                      const double* maxX, const double* maxY,
+                                      size_t count, const Query<double>& q)
+        {
+            const auto qMinX = _mm256_set1_pd(q.minX);
+            const auto qMinY = _mm256_set1_pd(q.minY);
+            const auto qMaxX = _mm256_set1_pd(q.maxX);
+            const auto qMaxY = _mm256_set1_pd(q.maxY);
+            size_t best = -1;
+            double bestGrowth = 0.0;
+            double bestArea = 0.0;
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                const auto bMinX = _mm256_loadu_pd(minX + i);
+                const auto bMinY = _mm256_loadu_pd(minY + i);
+                const auto bMaxX = _mm256_loadu_pd(maxX + i);
+                const auto bMaxY = _mm256_loadu_pd(maxY + i);
+                const auto unionArea = _mm256_mul_pd(
+                    _mm256_sub_pd(_mm256_max_pd(bMaxX, qMaxX), _mm256_min_pd(bMinX, qMinX)),
+                    _mm256_sub_pd(_mm256_max_pd(bMaxY, qMaxY), _mm256_min_pd(bMinY, qMinY)));
+                const auto boxArea = _mm256_mul_pd(_mm256_sub_pd(bMaxX, bMinX), _mm256_sub_pd(bMaxY, bMinY));
+                alignas(32) double growth[4];
+                alignas(32) double area[4];
+                _mm256_store_pd(growth, _mm256_sub_pd(unionArea, boxArea));
+                _mm256_store_pd(area, boxArea);
+                pickLeastGrowth(growth, area, i, 4, best, bestGrowth, bestArea);
+            }
+            pickLeastGrowthScalar(minX, minY, maxX, maxY, i, count, q, best, bestGrowth, bestArea);
+            return best;
+        }
+
+        __attribute__((target("avx2")))
+        inline size_t leastGrowthAvx2(const float* minX, const float* minY,
+                                      const float* maxX, const float* maxY,
+                                      size_t count, const Query<float>& q)
+        {
+            const auto qMinX = _mm256_set1_ps(q.minX);
+            const auto qMinY = _mm256_set1_ps(q.minY);
+            const auto qMaxX = _mm256_set1_ps(q.maxX);
+            const auto qMaxY = _mm256_set1_ps(q.maxY);
+            size_t best = -1;
+            float bestGrowth = 0.0f;
+            float bestArea = 0.0f;
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                const auto bMinX = _mm256_loadu_ps(minX + i);
+                const auto bMinY = _mm256_loadu_ps(minY + i);
+                const auto bMaxX = _mm256_loadu_ps(maxX + i);
+                const auto bMaxY = _mm256_loadu_ps(maxY + i);
+                const auto unionArea = _mm256_mul_ps(
+                    _mm256_sub_ps(_mm256_max_ps(bMaxX, qMaxX), _mm256_min_ps(bMinX, qMinX)),
+                    _mm256_sub_ps(_mm256_max_ps(bMaxY, qMaxY), _mm256_min_ps(bMinY, qMinY)));
+                const auto boxArea = _mm256_mul_ps(_mm256_sub_ps(bMaxX, bMinX), _mm256_sub_ps(bMaxY, bMinY));
+                alignas(32) float growth[8];
+                alignas(32) float area[8];
+                _mm256_store_ps(growth, _mm256_sub_ps(unionArea, boxArea));
+                _mm256_store_ps(area, boxArea);
+                pickLeastGrowth(growth, area, i, 8, best, bestGrowth, bestArea);
+            }
+            pickLeastGrowthScalar(minX, minY, maxX, maxY, i, count, q, best, bestGrowth, bestArea);
+            return best;
+        }
+#endif
+
+        template<typename Coord>
+        IntersectKernel<Coord> selectIntersectKernel()
+        {
+#ifdef RTREE_SIMD_X86
+            if constexpr (std::is_same<Coord, double>::value || std::is_same<Coord, float>::value ||
+                          std::is_same<Coord, std::int32_t>::value) {
+                if (__builtin_cpu_supports("avx2")) {
+                    return intersectMaskAvx2;
+                }
+                if (__builtin_cpu_supports("sse2")) {
+                    return intersectMaskSse2;
+                }
+            }
+#endif
+            return intersectMaskScalar<Coord>;
+        }
+
+        template<typename Coord>
+        GrowthKernel<Coord> selectGrowthKernel()
+        {
+#ifdef RTREE_SIMD_X86
+            // Areas of integer boxes need 64-bit products, they are left to the scalar kernel
+            if constexpr (std::is_same<Coord, double>::value || std::is_same<Coord, float>::value) {
+                if (__builtin_cpu_supports("avx2")) {
+                    return leastGrowthAvx2;
+                }
+            }
+#endif
+            return leastGrowthScalar<Coord>;
+        }
+
+        template<typename Coord>
+        std::uint64_t intersectMask(const Coord* minX, const Coord* minY,
+                                    const Coord* maxX, const Coord* maxY,
+                                    size_t count, const Query<Coord>& q)
+        {
+            static const IntersectKernel<Coord> kernel = selectIntersectKernel<Coord>();
+            return kernel(minX, minY, maxX, maxY, count, q);
+        }
+
+        template<typename Coord>
+        size_t leastGrowth(const Coord* minX, const Coord* minY,
+                           const Coord* maxX, const Coord* maxY,
+                           size_t count, const Query<Coord>& q)
+        {
+            static const GrowthKernel<Coord> kernel = selectGrowthKernel<Coord>();
+            return kernel(minX, minY, maxX, maxY, count, q);
+        }
+    } // namespace simd
+} // namespace rtree
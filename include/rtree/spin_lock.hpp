@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+
+namespace rtree
+{
+    // Nodes have no locks, the default
+    struct NoLock {};
+
+    // Lock of a single version word for optimistic readers. Readers never write to it:
+    // they take the version, read what it guards and validate that the version stayed the same,
+    // starting over if it didn't. A writer locks by setting the lowest bit of the version from a version
+    // it has seen and unlocks by carrying the bit into the version, so every write makes readers
+    // that overlapped with it fail validation. Waiting threads yield instead of sleeping,
+    // locks are meant to be held for a short time.
+    class VersionLock
+    {
+    public:
+        /**
+         * Take the version unless the lock is held by a writer
+         */
+        bool tryReadVersion(std::uint64_t& version) const;
+        /**
+         * Take the version, waiting while the lock is held by a writer
+         */
+        std::uint64_t readVersion() const;
+        /**
+         * Whether nothing was written since version was taken. Reads made before are ordered before the check
+         */
+        bool validate(std::uint64_t version) const;
+        /**
+         * Lock for writing unless something was written since version was taken
+         */
+        bool tryUpgrade(std::uint64_t version);
+        void lock();
+        void unlock() { _version.fetch_add(1, std::memory_order_release); }
+
+    private:
+        static constexpr std::uint64_t Locked = 1;
+
+        std::atomic<std::uint64_t> _version { 0 };
+    };
+
+
+    inline bool VersionLock::tryReadVersion(std::uint64_t& version) const
+    {
+        version = _version.load(std::memory_order_acquire);
+        return !(version & Locked);
+    }
+
+    inline std::uint64_t VersionLock::readVersion() const
+    {
+        std::uint64_t version;
+        while (!tryReadVersion(version)) {
+            std::this_thread::yield();
+        }
+        return version;
+    }
+
+    inline bool VersionLock::validate(std::uint64_t version) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return _version.load(std::memory_order_relaxed) == version;
+    }
+
+    inline bool VersionLock::tryUpgrade(std::uint64_t version)
+    {
+        return _version.compare_exchange_strong(version, version | Locked, std::memory_order_acquire,
+                                                std::memory_order_relaxed);
+    }
+
+    inline void VersionLock::lock()
+    {
+        while (!tryUpgrade(readVersion())) {}
+    }
+} // namespace rtree
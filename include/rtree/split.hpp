@@ -1,10 +1,14 @@
 #pragma once
 #include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <iterator>
 #include <numeric>
+#include <tuple>
+#include <type_traits>
 #include <utility>
 
+#include "hilbert.hpp"
 #include "node.hpp"
 #include "settings.h"
 
@@ -12,134 +16,173 @@
 namespace rtree {
 
 
-    template <typename T>
-    class Node;
+    template <typename NodeType>
+    using split_result = std::pair<NodeType*, NodeType*>;
 
-    template <typename T>
-    struct Entry;
 
-    template <typename T>
-    using node_ptr = std::shared_ptr<Node<T>>;
+    // Split strategy may provide its own choice of a subtree for a new entry:
+    //     template <typename NodeType>
+    //     static NodeType* chooseSubtree(NodeType* node, const typename NodeType::box_type& b);
+    // Otherwise the child whose bounding box area grows the least is chosen
+    template <typename Strategy, typename NodeType, typename = void>
+    struct HasChooseSubtree : std::false_type {};
 
-    template <typename T>
-    using split_result = std::pair<node_ptr<T>, node_ptr<T>>;
+    template <typename Strategy, typename NodeType>
+    struct HasChooseSubtree<Strategy, NodeType,
+                            std::void_t<decltype(Strategy::chooseSubtree(std::declval<NodeType*>(),
+                                                                         std::declval<typename NodeType::box_type>()))>>
+        : std::true_type {};
 
+    // Split strategy may ask the tree to reinsert a share of entries of an overflowing node
+    // instead of splitting it (once per level for every insertion):
+    //     static constexpr double reinsertFraction;
+    template <typename Strategy, typename = void>
+    struct HasForcedReinsert : std::false_type {};
 
+    template <typename Strategy>
+    struct HasForcedReinsert<Strategy, std::void_t<decltype(Strategy::reinsertFraction)>> : std::true_type {};
+
+    // Split strategy may take the minimum number of entries of the tree to fill both halves up to it:
+    //     template <typename NodeType>
+    //     static split_result<NodeType> splitLeaf(NodeType* node, typename NodeType::pool_type& pool, size_t minEntries);
+    // and the same for splitInner
+    template <typename Strategy, typename NodeType, typename = void>
+    struct HasMinEntriesSplit : std::false_type {};
+
+    template <typename Strategy, typename NodeType>
+    struct HasMinEntriesSplit<Strategy, NodeType,
+                              std::void_t<decltype(Strategy::splitLeaf(std::declval<NodeType*>(),
+                                                                       std::declval<typename NodeType::pool_type&>(),
+                                                                       size_t()))>>
+        : std::true_type {};
+
+
+    // Guttman's linear split: seeds are the pair of items with the greatest normalized separation
+    // along any axis, the rest is assigned in one pass to the group that needs the least enlargement,
+    // unless a group needs all remaining items to reach minEntries.
     class LinearSplit
     {
     public:
-        template <typename T>
-        static split_result<T> splitInner(node_ptr<T> node);
+        template <typename NodeType>
+        static split_result<NodeType> splitInner(NodeType* node, typename NodeType::pool_type& pool, size_t minEntries = 1);
 
-        template <typename T>
-        static split_result<T> splitLeaf(node_ptr<T> node);
+        template <typename NodeType>
+        static split_result<NodeType> splitLeaf(NodeType* node, typename NodeType::pool_type& pool, size_t minEntries = 1);
 
     private:
-        template <typename T>
-        static decltype(std::declval<T>()->getBoundingBox().distance(std::declval<BoundingBox>())) distance(const T& l, const T& r)
-        {
-            return l->getBoundingBox().distance(r->getBoundingBox());
-        }
+        /**
+         * Indices of two distinct items whose boxes are separated the most relative to the extent of all items
+         */
+        template <typename Items>
+        static std::pair<size_t, size_t> pickSeeds(const Items& items);
 
-        template <typename T>
-        static decltype(std::declval<T>().box.distance(std::declval<BoundingBox>())) distance(const T& l, const T& r)
-        {
-            return l.box.distance(r.box);
-        }
+        template <typename NodeType, typename Items>
+        static split_result<NodeType> distribute(NodeType* node, typename NodeType::pool_type& pool, const Items& items,
+                                                 size_t minEntries);
 
-        template <typename Iter>
-        static std::pair <typename std::iterator_traits<Iter>::value_type,
-                          typename std::iterator_traits<Iter>::value_type>
-            pickSeeds(Iter begin, Iter end);
+        template <typename NodeType>
+        static void add(NodeType* node, NodeType* child) { node->insertChild(child); }
+
+        template <typename NodeType>
+        static void add(NodeType* node, const typename NodeType::entry_type& entry) { node->insert(entry); }
     };
 
 
-    template <typename T>
-    split_result<T> LinearSplit::splitInner(node_ptr<T> node)
+    template <typename NodeType>
+    split_result<NodeType> LinearSplit::splitInner(NodeType* node, typename NodeType::pool_type& pool, size_t minEntries)
     {
-        const auto& children = node->getChildren();
-        const auto seeds = pickSeeds(children.begin(), children.end());
+        return distribute(node, pool, node->getChildren(), minEntries);
+    }
 
-        std::vector<node_ptr<T>> otherChildren(children.size() - 2);
-        std::remove_copy_if(children.begin(), children.end(),
-                            otherChildren.begin(),
-                            [&](const auto& child) {
-                                return child == seeds.first || child == seeds.second;
-                            });
+    template <typename NodeType>
+    split_result<NodeType> LinearSplit::splitLeaf(NodeType* node, typename NodeType::pool_type& pool, size_t minEntries)
+    {
+        return distribute(node, pool, node->getEntries(), minEntries);
+    }
 
-        auto ret = std::make_pair(Node<T>::makeNode(seeds.first), Node<T>::makeNode(seeds.second));
-        ret.first->setParent(node->getParent());
-        ret.second->setParent(node->getParent());
-        std::random_shuffle(std::begin(otherChildren), std::end(otherChildren));
-        for (const auto& child: otherChildren) {
-            if ((ret.first->getBoundingBox() & child->getBoundingBox()).area() <
-                (ret.second->getBoundingBox() & child->getBoundingBox()).area()) {
-                ret.first->insertChild(child);
+    template <typename Items>
+    std::pair<size_t, size_t> LinearSplit::pickSeeds(const Items& items)
+    {
+        std::pair<size_t, size_t> seeds(0, 1);
+        double maxSeparation = 0.0;
+        bool found = false;
+        for (const auto byX: { true, false }) {
+            const auto low = [byX](const auto& item) { return byX ? boxOf(item).bl().x : boxOf(item).bl().y; };
+            const auto high = [byX](const auto& item) { return byX ? boxOf(item).tr().x : boxOf(item).tr().y; };
+
+            // Item with the highest low side and the other one with the lowest high side
+            size_t highestLow = 0;
+            for (size_t i = 1; i < items.size(); i++) {
+                if (low(items[i]) > low(items[highestLow])) {
+                    highestLow = i;
+                }
             }
-            else {
-                ret.second->insertChild(child);
+            size_t lowestHigh = highestLow == 0 ? 1 : 0;
+            auto minLow = low(items[0]);
+            auto maxHigh = high(items[0]);
+            for (size_t i = 0; i < items.size(); i++) {
+                if (i != highestLow && high(items[i]) < high(items[lowestHigh])) {
+                    lowestHigh = i;
+                }
+                minLow = std::min(minLow, low(items[i]));
+                maxHigh = std::max(maxHigh, high(items[i]));
+            }
+
+            const double width = double(maxHigh) - minLow;
+            const double separation = (double(low(items[highestLow])) - high(items[lowestHigh])) /
+                                      (width > 0 ? width : 1.0);
+            if (!found || separation > maxSeparation) {
+                seeds = std::make_pair(lowestHigh, highestLow);
+                maxSeparation = separation;
+                found = true;
             }
         }
-        return ret;
+        return seeds;
     }
 
-    template <typename T>
-    split_result<T> LinearSplit::splitLeaf(node_ptr<T> node)
+    template <typename NodeType, typename Items>
+    split_result<NodeType> LinearSplit::distribute(NodeType* node, typename NodeType::pool_type& pool, const Items& items,
+                                                   size_t minEntries)
     {
-        const auto& entries = node->getEntries();
-        const auto seeds = pickSeeds(entries.begin(), entries.end());
-
-        std::vector<Entry<T>> otherEntries(entries.size() - 2);
-        std::remove_copy_if(entries.begin(), entries.end(),
-                            otherEntries.begin(),
-                            [&](const auto& entry) {
-                                return entry == seeds.first || entry == seeds.second;
-                            });
-        
-        auto ret = std::make_pair(Node<T>::makeNode(seeds.first), Node<T>::makeNode(seeds.second));
+        const auto seeds = pickSeeds(items);
+        auto ret = std::make_pair(NodeType::makeNode(pool, items[seeds.first]), NodeType::makeNode(pool, items[seeds.second]));
         ret.first->setParent(node->getParent());
         ret.second->setParent(node->getParent());
-        std::random_shuffle(std::begin(otherEntries), std::end(otherEntries));
-        for (const auto& entry: otherEntries) {
-            if ((ret.first->getBoundingBox() & entry.box).area() <
-                (ret.second->getBoundingBox() & entry.box).area()) {
-                ret.first->insert(entry);
+
+        const size_t minFill = std::min(minEntries, items.size() / 2);
+        size_t remaining = items.size() - 2;
+        for (size_t i = 0; i < items.size(); i++) {
+            if (i == seeds.first || i == seeds.second) {
+                continue;
             }
-            else {
-                ret.second->insert(entry);
+            // The least enlargement wins, ties go to the smaller group box and then to the group with fewer items
+            const auto& box = boxOf(items[i]);
+            const auto cost = [&box](const NodeType* group) {
+                const auto& groupBox = group->getBoundingBox();
+                return std::make_tuple((groupBox & box).area() - groupBox.area(), groupBox.area(), group->size());
+            };
+            auto target = cost(ret.first) <= cost(ret.second) ? ret.first : ret.second;
+            if (ret.first->size() + remaining <= minFill) {
+                target = ret.first;
             }
-        }
-        return ret;
-    }
-
-    template <typename Iter>
-    std::pair <typename std::iterator_traits<Iter>::value_type,
-               typename std::iterator_traits<Iter>::value_type>
-        LinearSplit::pickSeeds(Iter begin, Iter end)
-    {
-        decltype(std::declval<LinearSplit>().pickSeeds(begin, end)) seeds;
-        double maxDistance = -1.0;
-        for (auto it1 = begin; it1 != end; it1++) {
-            for (auto it2 = std::next(it1); it2 != end; it2++) {
-                const auto dist = distance(*it1, *it2);
-                if (maxDistance == -1.0 || dist > maxDistance) {
-                    seeds = std::make_pair(*it1, *it2);
-                    maxDistance = dist;
-                }
+            else if (ret.second->size() + remaining <= minFill) {
+                target = ret.second;
             }
+            add(target, items[i]);
+            remaining--;
         }
-        return seeds;
+        return ret;
     }
 
 
     class QuadraticSplit
     {
     public:
-        template <typename T>
-        static split_result<T> splitInner(node_ptr<T> node);
+        template <typename NodeType>
+        static split_result<NodeType> splitInner(NodeType* node, typename NodeType::pool_type& pool);
 
-        template <typename T>
-        static split_result<T> splitLeaf(node_ptr<T> node);
+        template <typename NodeType>
+        static split_result<NodeType> splitLeaf(NodeType* node, typename NodeType::pool_type& pool);
 
     private:
         template <typename Bounded>
@@ -183,20 +226,20 @@ namespace rtree {
     };
 
 
-    template <typename T>
-    split_result<T> QuadraticSplit::splitInner(node_ptr<T> node)
+    template <typename NodeType>
+    split_result<NodeType> QuadraticSplit::splitInner(NodeType* node, typename NodeType::pool_type& pool)
     {
         const auto& children = node->getChildren();
         const auto seeds = pickSeeds(children.begin(), children.end());
 
-        std::vector<node_ptr<T>> otherChildren(children.size() - 2);
+        std::vector<NodeType*> otherChildren(children.size() - 2);
         std::remove_copy_if(children.begin(), children.end(),
                             otherChildren.begin(),
                             [&](const auto& child) {
                                 return child == seeds.first || child == seeds.second;
                             });
 
-        auto ret = std::make_pair(Node<T>::makeNode(seeds.first), Node<T>::makeNode(seeds.second));
+        auto ret = std::make_pair(NodeType::makeNode(pool, seeds.first), NodeType::makeNode(pool, seeds.second));
         ret.first->setParent(node->getParent());
         ret.second->setParent(node->getParent());
         while (!otherChildren.empty()) {
@@ -228,20 +271,20 @@ namespace rtree {
         return ret;
     }
 
-    template <typename T>
-    split_result<T> QuadraticSplit::splitLeaf(node_ptr<T> node)
+    template <typename NodeType>
+    split_result<NodeType> QuadraticSplit::splitLeaf(NodeType* node, typename NodeType::pool_type& pool)
     {
         const auto& entries = node->getEntries();
         const auto seeds = pickSeeds(entries.begin(), entries.end());
 
-        std::vector<Entry<T>> otherEntries(entries.size() - 2);
+        std::vector<typename NodeType::entry_type> otherEntries(entries.size() - 2);
         std::remove_copy_if(entries.begin(), entries.end(),
                             otherEntries.begin(),
                             [&](const auto& entry) {
                                 return entry == seeds.first || entry == seeds.second;
                             });
         
-        auto ret = std::make_pair(Node<T>::makeNode(seeds.first), Node<T>::makeNode(seeds.second));
+        auto ret = std::make_pair(NodeType::makeNode(pool, seeds.first), NodeType::makeNode(pool, seeds.second));
         ret.first->setParent(node->getParent());
         ret.second->setParent(node->getParent());
         while (!otherEntries.empty()) {
@@ -278,18 +321,18 @@ namespace rtree {
     class ExponentialSplit
     {
     public:
-        template <typename T>
-        static split_result<T> splitInner(node_ptr<T> node);
+        template <typename NodeType>
+        static split_result<NodeType> splitInner(NodeType* node, typename NodeType::pool_type& pool);
 
-        template <typename T>
-        static split_result<T> splitLeaf(node_ptr<T> node);
+        template <typename NodeType>
+        static split_result<NodeType> splitLeaf(NodeType* node, typename NodeType::pool_type& pool);
 
     private:
     };
 
 
-    template <typename T>
-    split_result<T> ExponentialSplit::splitInner(node_ptr<T> node)
+    template <typename NodeType>
+    split_result<NodeType> ExponentialSplit::splitInner(NodeType* node, typename NodeType::pool_type& pool)
     {
         const auto& children = node->getChildren();
         std::vector<size_t> perm(children.size());
@@ -299,8 +342,8 @@ namespace rtree {
         std::vector<size_t> bestPermutation;
         do {
             for (size_t separator = 1; separator < children.size(); separator++) {
-                BoundingBox firstbox;
-                BoundingBox secondbox;
+                typename NodeType::box_type firstbox;
+                typename NodeType::box_type secondbox;
                 std::for_each(perm.begin(), perm.begin() + separator,
                     [&](auto val) { firstbox = firstbox & children[val]->getBoundingBox(); });
                 std::for_each(perm.begin() + separator, perm.end(),
@@ -314,20 +357,20 @@ namespace rtree {
                 }
             }
         } while (std::next_permutation(perm.begin(), perm.end()));
-        std::vector<node_ptr<T>> firstNodeChildren(bestSeparator);
-        std::vector<node_ptr<T>> secondNodeChildren(children.size() - bestSeparator);
+        std::vector<NodeType*> firstNodeChildren(bestSeparator);
+        std::vector<NodeType*> secondNodeChildren(children.size() - bestSeparator);
         std::transform(bestPermutation.begin(), bestPermutation.begin() + bestSeparator,
                        firstNodeChildren.begin(),
                        [&](const auto& val) { return children[val]; });
         std::transform(bestPermutation.begin() + bestSeparator, bestPermutation.end(),
                        secondNodeChildren.begin(),
                        [&](const auto& val) { return children[val]; });
-        return std::make_pair(Node<T>::makeInner(firstNodeChildren.begin(), firstNodeChildren.end()),
-                              Node<T>::makeInner(secondNodeChildren.begin(), secondNodeChildren.end()));
+        return std::make_pair(NodeType::makeInner(pool, firstNodeChildren.begin(), firstNodeChildren.end()),
+                              NodeType::makeInner(pool, secondNodeChildren.begin(), secondNodeChildren.end()));
     }
 
-    template <typename T>
-    split_result<T> ExponentialSplit::splitLeaf(node_ptr<T> node)
+    template <typename NodeType>
+    split_result<NodeType> ExponentialSplit::splitLeaf(NodeType* node, typename NodeType::pool_type& pool)
     {
         const auto& entries = node->getEntries();
         std::vector<size_t> perm(entries.size());
@@ -337,8 +380,8 @@ namespace rtree {
         std::vector<size_t> bestPermutation;
         do {
             for (size_t separator = 1; separator < entries.size(); separator++) {
-                BoundingBox firstbox;
-                BoundingBox secondbox;
+                typename NodeType::box_type firstbox;
+                typename NodeType::box_type secondbox;
                 std::for_each(perm.begin(), perm.begin() + separator,
                     [&](auto val) { firstbox = firstbox & entries[val].box; });
                 std::for_each(perm.begin() + separator, perm.end(),
@@ -353,15 +396,300 @@ namespace rtree {
             }
             std::cout << "Next permutation" << perm.front() << perm.back() << std::endl;
         } while (std::next_permutation(perm.begin(), perm.end()));
-        std::vector<Entry<T>> firstNodeEntries(bestSeparator);
-        std::vector<Entry<T>> secondNodeEntries(entries.size() - bestSeparator);
+        std::vector<typename NodeType::entry_type> firstNodeEntries(bestSeparator);
+        std::vector<typename NodeType::entry_type> secondNodeEntries(entries.size() - bestSeparator);
         std::transform(bestPermutation.begin(), bestPermutation.begin() + bestSeparator,
                        firstNodeEntries.begin(),
                        [&](const auto& val) { return entries[val]; });
         std::transform(bestPermutation.begin() + bestSeparator, bestPermutation.end(),
                        secondNodeEntries.begin(),
                        [&](const auto& val) { return entries[val]; });
-        return std::make_pair(Node<T>::makeLeaf(firstNodeEntries.begin(), firstNodeEntries.end()),
-                              Node<T>::makeLeaf(secondNodeEntries.begin(), secondNodeEntries.end()));
+        return std::make_pair(NodeType::makeLeaf(pool, firstNodeEntries.begin(), firstNodeEntries.end()),
+                              NodeType::makeLeaf(pool, secondNodeEntries.begin(), secondNodeEntries.end()));
+    }
+
+
+    // Hilbert R-tree.
+    // Every node keeps the largest Hilbert value (LHV) of entry centers in its subtree.
+    // New entry is routed to the child with the smallest LHV that is not less than
+    // Hilbert value of the entry, so inserts follow the Hilbert curve,
+    // and overflowing node is cut in half along the curve.
+    // Hilbert values are computed without knowing the extent of the data (see hilbertCoordinate()).
+    class HilbertSplit
+    {
+    public:
+        template <typename NodeType>
+        static NodeType* chooseSubtree(NodeType* node, const typename NodeType::box_type& b);
+
+        template <typename NodeType>
+        static split_result<NodeType> splitInner(NodeType* node, typename NodeType::pool_type& pool);
+
+        template <typename NodeType>
+        static split_result<NodeType> splitLeaf(NodeType* node, typename NodeType::pool_type& pool);
+
+        /**
+         * Get LHV of the node computing it first if it is unknown (e.g. node was made by bulk load)
+         */
+        template <typename NodeType>
+        static std::uint64_t largestHilbertValue(NodeType* node);
+    };
+
+
+    template <typename NodeType>
+    NodeType* HilbertSplit::chooseSubtree(NodeType* node, const typename NodeType::box_type& b)
+    {
+        const auto h = hilbertValue(b);
+        NodeType* best = nullptr;
+        NodeType* largest = nullptr;
+        auto bestValue = UnknownHilbertValue;
+        auto largestValue = std::uint64_t(0);
+        for (const auto& child: node->getChildren()) {
+            const auto value = largestHilbertValue(child);
+            if (value >= h && (!best || value < bestValue)) {
+                best = child;
+                bestValue = value;
+            }
+            if (!largest || value >= largestValue) {
+                largest = child;
+                largestValue = value;
+            }
+        }
+        if (!best) {
+            // Entry is past every child on the curve, so it extends the last one
+            best = largest;
+            best->setLargestHilbertValue(h);
+        }
+        return best;
+    }
+
+    template <typename NodeType>
+    split_result<NodeType> HilbertSplit::splitInner(NodeType* node, typename NodeType::pool_type& pool)
+    {
+        std::vector<std::pair<std::uint64_t, NodeType*>> children;
+        children.reserve(node->getChildren().size());
+        for (const auto& child: node->getChildren()) {
+            children.emplace_back(largestHilbertValue(child), child);
+        }
+        std::sort(children.begin(), children.end(), [](const auto& l, const auto& r) { return l.first < r.first; });
+
+        const auto half = std::next(children.begin(), children.size() / 2);
+        std::vector<NodeType*> first;
+        std::vector<NodeType*> second;
+        std::transform(children.begin(), half, std::back_inserter(first), [](const auto& c) { return c.second; });
+        std::transform(half, children.end(), std::back_inserter(second), [](const auto& c) { return c.second; });
+
+        auto ret = std::make_pair(NodeType::makeInner(pool, first.begin(), first.end()),
+                                  NodeType::makeInner(pool, second.begin(), second.end()));
+        ret.first->setParent(node->getParent());
+        ret.second->setParent(node->getParent());
+        ret.first->setLargestHilbertValue(std::prev(half)->first);
+        ret.second->setLargestHilbertValue(children.back().first);
+        return ret;
+    }
+
+    template <typename NodeType>
+    split_result<NodeType> HilbertSplit::splitLeaf(NodeType* node, typename NodeType::pool_type& pool)
+    {
+        std::vector<std::pair<std::uint64_t, typename NodeType::entry_type>> entries;
+        entries.reserve(node->getEntries().size());
+        for (const auto& entry: node->getEntries()) {
+            entries.emplace_back(hilbertValue(entry.box), entry);
+        }
+        std::sort(entries.begin(), entries.end(), [](const auto& l, const auto& r) { return l.first < r.first; });
+
+        const auto half = std::next(entries.begin(), entries.size() / 2);
+        std::vector<typename NodeType::entry_type> first;
+        std::vector<typename NodeType::entry_type> second;
+        std::transform(entries.begin(), half, std::back_inserter(first), [](const auto& e) { return e.second; });
+        std::transform(half, entries.end(), std::back_inserter(second), [](const auto& e) { return e.second; });
+
+        auto ret = std::make_pair(NodeType::makeLeaf(pool, first.begin(), first.end()),
+                                  NodeType::makeLeaf(pool, second.begin(), second.end()));
+        ret.first->setParent(node->getParent());
+        ret.second->setParent(node->getParent());
+        ret.first->setLargestHilbertValue(std::prev(half)->first);
+        ret.second->setLargestHilbertValue(entries.back().first);
+        return ret;
+    }
+
+    template <typename NodeType>
+    std::uint64_t HilbertSplit::largestHilbertValue(NodeType* node)
+    {
+        if (node->getLargestHilbertValue() != UnknownHilbertValue) {
+            return node->getLargestHilbertValue();
+        }
+
+        std::uint64_t value = 0;
+        if (node->isLeaf()) {
+            for (const auto& entry: node->getEntries()) {
+                value = std::max(value, hilbertValue(entry.box));
+            }
+        }
+        else {
+            for (const auto& child: node->getChildren()) {
+                value = std::max(value, largestHilbertValue(child));
+            }
+        }
+        node->setLargestHilbertValue(value);
+        return value;
+    }
+
+
+    // R*-tree.
+    // Subtree for a new entry is chosen by the least overlap enlargement at the level above leaves
+    // and by the least area enlargement elsewhere.
+    // Split axis is chosen by the least sum of margins of all allowed distributions
+    // and the distribution on that axis is chosen by the least overlap, then by the least area.
+    // Allowed distributions give every group at least 40% of the items and at least minEntries.
+    // On the first overflow at every level the tree reinserts reinsertFraction of node entries
+    // that are farthest from its center instead of splitting it.
+    class RStarSplit
+    {
+    public:
+        static constexpr double reinsertFraction = 0.3;
+
+        template <typename NodeType>
+        static NodeType* chooseSubtree(NodeType* node, const typename NodeType::box_type& b);
+
+        template <typename NodeType>
+        static split_result<NodeType> splitInner(NodeType* node, typename NodeType::pool_type& pool, size_t minEntries = 1);
+
+        template <typename NodeType>
+        static split_result<NodeType> splitLeaf(NodeType* node, typename NodeType::pool_type& pool, size_t minEntries = 1);
+
+    private:
+        /**
+         * Order items along the best split axis and return the size of the first group
+         */
+        template <typename Items>
+        static size_t chooseSplit(Items& items, size_t minEntries);
+    };
+
+
+    template <typename NodeType>
+    NodeType* RStarSplit::chooseSubtree(NodeType* node, const typename NodeType::box_type& b)
+    {
+        const auto& children = node->getChildren();
+        const bool pointsToLeaves = children.front()->isLeaf();
+        NodeType* best = nullptr;
+        auto bestCost = std::make_tuple(0.0, 0.0, 0.0);
+        for (const auto& child: children) {
+            const auto& box = child->getBoundingBox();
+            const auto enlarged = box & b;
+            double overlapEnlargement = 0.0;
+            if (pointsToLeaves) {
+                for (const auto& other: children) {
+                    if (other != child) {
+                        overlapEnlargement += (enlarged | other->getBoundingBox()).area() -
+                            (box | other->getBoundingBox()).area();
+                    }
+                }
+            }
+            const auto cost = std::make_tuple(overlapEnlargement, enlarged.area() - box.area(), box.area());
+            if (!best || cost < bestCost) {
+                best = child;
+                bestCost = cost;
+            }
+        }
+        return best;
+    }
+
+    template <typename NodeType>
+    split_result<NodeType> RStarSplit::splitInner(NodeType* node, typename NodeType::pool_type& pool, size_t minEntries)
+    {
+        auto children = node->getChildren();
+        const auto firstSize = chooseSplit(children, minEntries);
+        const auto separator = std::next(children.begin(), firstSize);
+        auto ret = std::make_pair(NodeType::makeInner(pool, children.begin(), separator),
+                                  NodeType::makeInner(pool, separator, children.end()));
+        ret.first->setParent(node->getParent());
+        ret.second->setParent(node->getParent());
+        return ret;
+    }
+
+    template <typename NodeType>
+    split_result<NodeType> RStarSplit::splitLeaf(NodeType* node, typename NodeType::pool_type& pool, size_t minEntries)
+    {
+        auto entries = node->getEntries();
+        const auto firstSize = chooseSplit(entries, minEntries);
+        const auto separator = std::next(entries.begin(), firstSize);
+        auto ret = std::make_pair(NodeType::makeLeaf(pool, entries.begin(), separator),
+                                  NodeType::makeLeaf(pool, separator, entries.end()));
+        ret.first->setParent(node->getParent());
+        ret.second->setParent(node->getParent());
+        return ret;
+    }
+
+    template <typename Items>
+    size_t RStarSplit::chooseSplit(Items& items, size_t minEntries)
+    {
+        const size_t count = items.size();
+        // Every group gets at least 40% of maximum number of entries and no less than the minimum of the tree
+        const size_t minFill = std::min(std::max<size_t>({ 1, minEntries, (count - 1) * 2 / 5 }), count / 2);
+
+        // Items are ordered by all bounds so that equal keys can only belong to equal boxes
+        // and sorting again gives the same distributions
+        const auto sortAlong = [&items](bool byX, bool byUpper) {
+            const auto key = [byX, byUpper](const auto& box) {
+                const auto bl = box.bl();
+                const auto tr = box.tr();
+                return byX ? std::make_tuple(byUpper ? tr.x : bl.x, byUpper ? bl.x : tr.x, bl.y, tr.y)
+                           : std::make_tuple(byUpper ? tr.y : bl.y, byUpper ? bl.y : tr.y, bl.x, tr.x);
+            };
+            std::sort(items.begin(), items.end(), [&key](const auto& l, const auto& r) {
+                return key(boxOf(l)) < key(boxOf(r));
+            });
+        };
+        // leading[k] covers first k+1 items, trailing[k] covers items from k to the end
+        using Box = std::decay_t<decltype(boxOf(items.front()))>;
+        std::vector<Box> leading(count);
+        std::vector<Box> trailing(count);
+        const auto coverGroups = [&]() {
+            leading.front() = boxOf(items.front());
+            for (size_t i = 1; i < count; i++) {
+                leading[i] = leading[i - 1] & boxOf(items[i]);
+            }
+            trailing.back() = boxOf(items.back());
+            for (size_t i = count - 1; i > 0; i--) {
+                trailing[i - 1] = trailing[i] & boxOf(items[i - 1]);
+            }
+        };
+
+        bool splitByX = true;
+        double minMargin = -1.0;
+        for (const auto byX: { true, false }) {
+            double margin = 0.0;
+            for (const auto byUpper: { false, true }) {
+                sortAlong(byX, byUpper);
+                coverGroups();
+                for (size_t k = minFill; k <= count - minFill; k++) {
+                    margin += leading[k - 1].margin() + trailing[k].margin();
+                }
+            }
+            if (minMargin == -1.0 || margin < minMargin) {
+                minMargin = margin;
+                splitByX = byX;
+            }
+        }
+
+        bool splitByUpper = false;
+        size_t firstSize = minFill;
+        using Area = typename Box::area_type;
+        auto minCost = std::make_pair(Area(-1), Area(-1));
+        for (const auto byUpper: { false, true }) {
+            sortAlong(splitByX, byUpper);
+            coverGroups();
+            for (size_t k = minFill; k <= count - minFill; k++) {
+                const auto cost = std::make_pair((leading[k - 1] | trailing[k]).area(),
+                                                 leading[k - 1].area() + trailing[k].area());
+                if (minCost.first == -1 || cost < minCost) {
+                    minCost = cost;
+                    splitByUpper = byUpper;
+                    firstSize = k;
+                }
+            }
+        }
+        sortAlong(splitByX, splitByUpper);
+        return firstSize;
     }
-} // namespace rtree
+} // namespace rtree
\ No newline at end of file
@@ -0,0 +1,100 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+#include "settings.h"
+
+
+namespace rtree
+{
+    // Vector with inline storage for at most Capacity elements.
+    // It never allocates and stays trivially destructible if T is, so nodes built from it
+    // occupy one contiguous block of memory whose size is known at compile time.
+    template<typename T, size_t Capacity>
+    class StaticVector
+    {
+    public:
+        using value_type = T;
+        using size_type = size_t;
+        using reference = T&;
+        using const_reference = const T&;
+        using iterator = T*;
+        using const_iterator = const T*;
+        using reverse_iterator = std::reverse_iterator<iterator>;
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+        StaticVector() = default;
+        StaticVector(std::initializer_list<T> values);
+
+        static constexpr size_t capacity() { return Capacity; }
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+
+        T*       data() { return _values.data(); }
+        const T* data() const { return _values.data(); }
+
+        iterator       begin() { return data(); }
+        const_iterator begin() const { return data(); }
+        iterator       end() { return data() + _size; }
+        const_iterator end() const { return data() + _size; }
+
+        reverse_iterator       rbegin() { return reverse_iterator(end()); }
+        const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+        reverse_iterator       rend() { return reverse_iterator(begin()); }
+        const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+        T&       operator[](size_t i) { return _values[i]; }
+        const T& operator[](size_t i) const { return _values[i]; }
+        T&       front() { return _values[0]; }
+        const T& front() const { return _values[0]; }
+        T&       back() { return _values[_size - 1]; }
+        const T& back() const { return _values[_size - 1]; }
+
+        void clear() { _size = 0; }
+        void push_back(const T& value);
+        void pop_back() { _size--; }
+        iterator erase(const_iterator first, const_iterator last);
+        iterator erase(const_iterator pos) { return erase(pos, std::next(pos)); }
+
+    private:
+        std::array<T, Capacity> _values;
+        size_t _size = 0;
+    };
+
+
+    template<typename T, size_t Capacity>
+    StaticVector<T, Capacity>::StaticVector(std::initializer_list<T> values)
+    {
+        for (const auto& value: values) {
+            push_back(value);
+        }
+    }
+
+    template<typename T, size_t Capacity>
+    void StaticVector<T, Capacity>::push_back(const T& value)
+    {
+        assert(_size < Capacity);
+        _values[_size++] = value;
+    }
+
+    template<typename T, size_t Capacity>
+    typename StaticVector<T, Capacity>::iterator StaticVector<T, Capacity>::erase(const_iterator first,
+                                                                                const_iterator last)
+    {
+        const auto from = begin() + (first - begin());
+        const auto to = begin() + (last - begin());
+        std::move(to, end(), from);
+        _size -= to - from;
+        return from;
+    }
+
+
+    template<typename T, size_t Capacity>
+    using NodeStorage = std::conditional_t<Capacity == DynamicCapacity, std::vector<T>, StaticVector<T, Capacity>>;
+} // namespace rtree
\ No newline at end of file
@@ -0,0 +1,191 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace rtree
+{
+    // Fixed set of worker threads that run one task at a time on all of them.
+    // A task is called once on every worker with the index of the worker, so it can keep
+    // per-thread state in plain arrays and hand out the actual work by itself.
+    class ThreadPool
+    {
+    public:
+        explicit ThreadPool(size_t threadCount = std::thread::hardware_concurrency());
+        ThreadPool(const ThreadPool&) = delete;
+        ~ThreadPool();
+
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /**
+         * Call task(worker) on every worker and wait until all calls return.
+         * The first exception thrown by the task is rethrown here
+         */
+        void run(const std::function<void(size_t)>& task);
+
+        size_t size() const { return _threads.size(); }
+
+    private:
+        void work(size_t worker);
+
+        std::vector<std::thread> _threads;
+        std::mutex _mutex;
+        std::condition_variable _started;
+        std::condition_variable _finished;
+        const std::function<void(size_t)>* _task = nullptr;
+        std::exception_ptr _error;
+        // Incremented for every task, so a worker can tell a new task from the one it has already run
+        size_t _generation = 0;
+        size_t _running = 0;
+        bool _stopping = false;
+    };
+
+
+    // Task deques of workers for work stealing.
+    // A worker pushes and takes its tasks at the back of its own deque, so it goes depth-first
+    // through the work it has spawned. A worker without tasks steals from the front of other deques,
+    // where the oldest and usually the biggest tasks are.
+    template<typename Task>
+    class WorkStealingQueues
+    {
+    public:
+        explicit WorkStealingQueues(size_t workerCount) : _queues(workerCount) {}
+
+        void push(size_t worker, const Task& task);
+        /**
+         * Take a task of the worker or steal one from the others.
+         * Waits while other workers still run tasks that may spawn new ones.
+         * Returns false when all tasks are done. Every taken task has to be reported with done()
+         */
+        bool pop(size_t worker, Task& task);
+        void done() { _pending--; }
+
+    private:
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<Queue> _queues;
+        // Tasks pushed but not done yet
+        std::atomic<size_t> _pending { 0 };
+    };
+
+
+    template<typename Task>
+    void WorkStealingQueues<Task>::push(size_t worker, const Task& task)
+    {
+        _pending++;
+        std::lock_guard<std::mutex> lock(_queues[worker].mutex);
+        _queues[worker].tasks.push_back(task);
+    }
+
+    template<typename Task>
+    bool WorkStealingQueues<Task>::pop(size_t worker, Task& task)
+    {
+        while (true) {
+            {
+                auto& own = _queues[worker];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (!own.tasks.empty()) {
+                    task = own.tasks.back();
+                    own.tasks.pop_back();
+                    return true;
+                }
+            }
+            for (size_t i = 1; i < _queues.size(); i++) {
+                auto& victim = _queues[(worker + i) % _queues.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.tasks.empty()) {
+                    task = victim.tasks.front();
+                    victim.tasks.pop_front();
+                    return true;
+                }
+            }
+            if (_pending == 0) {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+
+    inline ThreadPool::ThreadPool(size_t threadCount)
+    {
+        threadCount = std::max<size_t>(1, threadCount);
+        _threads.reserve(threadCount);
+        for (size_t i = 0; i < threadCount; i++) {
+            _threads.emplace_back([this, i]() { work(i); });
+        }
+    }
+
+    inline ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _started.notify_all();
+        for (auto& thread: _threads) {
+            thread.join();
+        }
+    }
+
+    inline void ThreadPool::run(const std::function<void(size_t)>& task)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _task = &task;
+        _error = nullptr;
+        _running = _threads.size();
+        _generation++;
+        _started.notify_all();
+        _finished.wait(lock, [this]() { return _running == 0; });
+        _task = nullptr;
+        if (_error) {
+            std::rethrow_exception(std::exchange(_error, nullptr));
+        }
+    }
+
+    inline void ThreadPool::work(size_t worker)
+    {
+        size_t generation = 0;
+        while (true) {
+            const std::function<void(size_t)>* task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _started.wait(lock, [&]() { return _stopping || _generation != generation; });
+                if (_stopping) {
+                    return;
+                }
+                generation = _generation;
+                task = _task;
+            }
+
+            std::exception_ptr error;
+            try {
+                (*task)(worker);
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (error && !_error) {
+                _error = error;
+            }
+            if (--_running == 0) {
+                _finished.notify_one();
+            }
+        }
+    }
+} // namespace rtree
@@ -0,0 +1,366 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "box_array.hpp"
+
+
+namespace rtree
+{
+    // Tree shared by one writer at a time and any number of readers that never wait for it.
+    // The writer modifies a private tree in place and keeps a mirror of it made of immutable node copies,
+    // one for every node of the tree. Publishing a version copies again the nodes changed since the previous one
+    // (changed leaves and their ancestors), the rest of the copies is shared with the versions before it.
+    // The root of a new version is published atomically. Readers pin the current version with a Snapshot
+    // and query it without any locks. Copies that are no longer reachable from the current version are freed
+    // once every snapshot that could still reach them is released (epoch-based reclamation).
+    // Memory: the mirror is a second copy of the whole tree, so the versioned tree takes about twice the memory
+    // of the tree itself, plus copies pinned by snapshots. Copies of freed nodes are found by walking
+    // the whole tree, which a write does in O(n) time once the mirror holds twice as many copies as the tree has nodes.
+    template<typename Tree>
+    class VersionedTree
+    {
+        struct FrozenNode;
+
+    public:
+        using tree_type = Tree;
+        using entry_type = typename Tree::entry_type;
+        using box_type = typename Tree::box_type;
+        using node_type = typename Tree::node_type;
+
+        // Version of the tree pinned by a reader. Must be released before the tree it was taken from is destroyed
+        class Snapshot
+        {
+        public:
+            Snapshot(Snapshot&& other) noexcept
+                : _slot(std::exchange(other._slot, nullptr)), _root(std::exchange(other._root, nullptr)) {}
+            Snapshot(const Snapshot&) = delete;
+            ~Snapshot() { release(); }
+
+            Snapshot& operator=(Snapshot&& other) noexcept;
+            Snapshot& operator=(const Snapshot&) = delete;
+
+            bool empty() const { return !_root; }
+            /**
+             * Find all entries whose bounding boxes are intersected by b
+             */
+            std::vector<entry_type> find(const box_type& b) const;
+            /**
+             * Call visitor for every entry whose bounding box is intersected by b.
+             * If visitor returns bool, returning false stops the query.
+             * Returns false if the query was stopped by visitor
+             */
+            template<typename Visitor>
+            bool query(const box_type& b, Visitor&& visitor) const;
+
+        private:
+            friend class VersionedTree;
+
+            Snapshot(std::atomic<std::uint64_t>* slot, const FrozenNode* root) : _slot(slot), _root(root) {}
+
+            void release();
+            template<typename Visitor>
+            static bool queryNode(const FrozenNode& node, const box_type& b, Visitor& visitor);
+
+            std::atomic<std::uint64_t>* _slot;
+            const FrozenNode* _root;
+        };
+
+        template<typename... Args>
+        explicit VersionedTree(Args&&... args);
+        VersionedTree(const VersionedTree&) = delete;
+        ~VersionedTree();
+
+        VersionedTree& operator=(const VersionedTree&) = delete;
+
+        /**
+         * Call fn(tree) under the writer lock and publish the result as a new version.
+         * Readers see either none or all of the changes made by fn
+         */
+        template<typename Fn>
+        void write(Fn&& fn);
+        void insert(const box_type& b, const typename node_type::data_type& data);
+        void remove(const typename node_type::data_type& data);
+
+        /**
+         * Pin the current version. Waits only if MaxReaders snapshots are held at once
+         */
+        Snapshot snapshot() const;
+
+        // Number of snapshots that can be held at the same time
+        static constexpr size_t MaxReaders = 128;
+
+    private:
+        struct FrozenNode
+        {
+            box_type box;
+            std::vector<const FrozenNode*> children;
+            std::vector<entry_type> entries;
+            // Boxes of entries or children in the same order
+            BoxArray<DynamicCapacity, typename node_type::coord_type> boxes;
+        };
+
+        /**
+         * Copy of the node that reflects its current state. Copies of unchanged nodes are reused
+         */
+        const FrozenNode* freeze(const node_type* node);
+        void publish();
+        /**
+         * Retire copies of nodes that are no longer in the tree and were not replaced by new nodes at the same address
+         */
+        void compact();
+        void retire(const FrozenNode* node) { _retired.push_back({ _version.load() + 1, node }); }
+        /**
+         * Free retired copies that no snapshot can reach anymore
+         */
+        void reclaim();
+
+        static constexpr std::uint64_t Idle = std::numeric_limits<std::uint64_t>::max();
+
+        // Accessed by the writer only
+        Tree _tree;
+        std::mutex _writer;
+        // Latest copy of every node of the tree. Entries of freed nodes stay until compact()
+        std::unordered_map<const node_type*, const FrozenNode*> _frozen;
+        // Copies with the first version they are unreachable from
+        std::vector<std::pair<std::uint64_t, const FrozenNode*>> _retired;
+        size_t _liveNodes = 0;
+
+        std::atomic<const FrozenNode*> _root { nullptr };
+        std::atomic<std::uint64_t> _version { 0 };
+        // Version pinned by every reader, Idle for a free slot
+        mutable std::array<std::atomic<std::uint64_t>, MaxReaders> _readers;
+    };
+
+
+    template<typename Tree>
+    template<typename... Args>
+    VersionedTree<Tree>::VersionedTree(Args&&... args)
+        : _tree(std::forward<Args>(args)...)
+    {
+        for (auto& reader: _readers) {
+            reader.store(Idle);
+        }
+        publish();
+    }
+
+    template<typename Tree>
+    VersionedTree<Tree>::~VersionedTree()
+    {
+        for (const auto& [version, node]: _retired) {
+            delete node;
+        }
+        for (const auto& [node, frozen]: _frozen) {
+            delete frozen;
+        }
+    }
+
+    template<typename Tree>
+    template<typename Fn>
+    void VersionedTree<Tree>::write(Fn&& fn)
+    {
+        std::lock_guard<std::mutex> lock(_writer);
+        try {
+            fn(_tree);
+        }
+        catch (...) {
+            // Whatever fn managed to change before throwing is still published, so copies match the tree
+            publish();
+            throw;
+        }
+        publish();
+    }
+
+    template<typename Tree>
+    void VersionedTree<Tree>::insert(const box_type& b, const typename node_type::data_type& data)
+    {
+        write([&](Tree& tree) { tree.insert(b, data); });
+    }
+
+    template<typename Tree>
+    void VersionedTree<Tree>::remove(const typename node_type::data_type& data)
+    {
+        write([&](Tree& tree) { tree.remove(data); });
+    }
+
+    template<typename Tree>
+    auto VersionedTree<Tree>::snapshot() const -> Snapshot
+    {
+        while (true) {
+            for (auto& reader: _readers) {
+                auto expected = Idle;
+                auto version = _version.load();
+                if (!reader.compare_exchange_strong(expected, version)) {
+                    continue;
+                }
+                // Writer may have reclaimed the pinned version before it saw the slot, then pin the newer one.
+                // Once the version is the same after pinning, the root read below is not older than it
+                for (auto current = _version.load(); current != version; current = _version.load()) {
+                    version = current;
+                    reader.store(version);
+                }
+                return Snapshot(&reader, _root.load());
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    template<typename Tree>
+    auto VersionedTree<Tree>::freeze(const node_type* node) -> const FrozenNode*
+    {
+        const auto it = _frozen.find(node);
+        if (it != _frozen.end() && !node->isChanged()) {
+            return it->second;
+        }
+
+        const auto frozen = new FrozenNode{ node->getBoundingBox(), {}, {}, {} };
+        if (node->isLeaf()) {
+            frozen->entries.assign(node->getEntries().begin(), node->getEntries().end());
+            for (const auto& entry: frozen->entries) {
+                frozen->boxes.push_back(entry.box);
+            }
+        }
+        else {
+            for (const auto child: node->getChildren()) {
+                frozen->children.push_back(freeze(child));
+                frozen->boxes.push_back(child->getBoundingBox());
+            }
+        }
+        node->resetChanged();
+
+        // Map may have been rehashed by freezing the children
+        auto& latest = _frozen[node];
+        if (latest) {
+            retire(latest);
+        }
+        latest = frozen;
+        return frozen;
+    }
+
+    template<typename Tree>
+    void VersionedTree<Tree>::publish()
+    {
+        const auto root = _tree.getRoot() ? freeze(_tree.getRoot()) : nullptr;
+        if (root != _root.load()) {
+            _root.store(root);
+            _version.store(_version.load() + 1);
+        }
+        // Freed nodes leave their copies in the map, it is cleaned once it holds twice as many as needed
+        if (_frozen.size() > 2 * _liveNodes + 64) {
+            compact();
+        }
+        reclaim();
+    }
+
+    template<typename Tree>
+    void VersionedTree<Tree>::compact()
+    {
+        std::unordered_set<const node_type*> live;
+        std::vector<const node_type*> stack;
+        if (_tree.getRoot()) {
+            stack.push_back(_tree.getRoot());
+        }
+        while (!stack.empty()) {
+            const auto node = stack.back();
+            stack.pop_back();
+            live.insert(node);
+            stack.insert(stack.end(), node->getChildren().begin(), node->getChildren().end());
+        }
+
+        // Current version doesn't reach copies of freed nodes, but snapshots of the previous ones might
+        _version.store(_version.load() + 1);
+        for (auto it = _frozen.begin(); it != _frozen.end();) {
+            if (live.count(it->first)) {
+                ++it;
+            }
+            else {
+                _retired.push_back({ _version.load(), it->second });
+                it = _frozen.erase(it);
+            }
+        }
+        _liveNodes = live.size();
+    }
+
+    template<typename Tree>
+    void VersionedTree<Tree>::reclaim()
+    {
+        auto oldest = _version.load();
+        for (const auto& reader: _readers) {
+            oldest = std::min(oldest, reader.load());
+        }
+        const auto kept = std::partition(_retired.begin(), _retired.end(),
+            [oldest](const auto& retired) { return retired.first > oldest; });
+        std::for_each(kept, _retired.end(), [](const auto& retired) { delete retired.second; });
+        _retired.erase(kept, _retired.end());
+    }
+
+
+    template<typename Tree>
+    auto VersionedTree<Tree>::Snapshot::operator=(Snapshot&& other) noexcept -> Snapshot&
+    {
+        if (this != &other) {
+            release();
+            _slot = std::exchange(other._slot, nullptr);
+            _root = std::exchange(other._root, nullptr);
+        }
+        return *this;
+    }
+
+    template<typename Tree>
+    auto VersionedTree<Tree>::Snapshot::find(const box_type& b) const -> std::vector<entry_type>
+    {
+        std::vector<entry_type> intersected;
+        query(b, [&intersected](const entry_type& entry) { intersected.push_back(entry); });
+        return intersected;
+    }
+
+    template<typename Tree>
+    template<typename Visitor>
+    bool VersionedTree<Tree>::Snapshot::query(const box_type& b, Visitor&& visitor) const
+    {
+        if (!_root || !_root->box.intersects(b)) {
+            return true;
+        }
+        return queryNode(*_root, b, visitor);
+    }
+
+    template<typename Tree>
+    void VersionedTree<Tree>::Snapshot::release()
+    {
+        if (_slot) {
+            _slot->store(Idle);
+            _slot = nullptr;
+        }
+        _root = nullptr;
+    }
+
+    template<typename Tree>
+    template<typename Visitor>
+    bool VersionedTree<Tree>::Snapshot::queryNode(const FrozenNode& node, const box_type& b, Visitor& visitor)
+    {
+        if (!node.entries.empty()) {
+            return node.boxes.forEachIntersecting(b, [&](size_t i) {
+                if constexpr (std::is_same<std::invoke_result_t<Visitor&, const entry_type&>, bool>::value) {
+                    return visitor(node.entries[i]);
+                }
+                else {
+                    visitor(node.entries[i]);
+                    return true;
+                }
+            });
+        }
+        return node.boxes.forEachIntersecting(b, [&](size_t i) {
+            return queryNode(*node.children[i], b, visitor);
+        });
+    }
+} // namespace rtree
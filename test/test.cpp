@@ -3,13 +3,83 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <rtree/concurrent.hpp>
+#include <rtree/mapped.hpp>
+#include <rtree/paged.hpp>
 #include <rtree/rtree.hpp>
 
 #include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <iterator>
+#include <mutex>
+#include <map>
+#include <optional>
+#include <random>
+#include <set>
+#include <thread>
 #include <vector>
 
 
+/**
+ * Check structural invariants of the tree and return the number of its entries
+ */
+template<typename Tree>
+size_t checkTree(const Tree& tree)
+{
+    size_t entryCount = 0;
+    std::optional<size_t> leafDepth;
+    std::for_each(tree.begin(), tree.end(), [&](const auto& node) {
+        BOOST_CHECK_LE(node.size(), tree.getMaxEntries());
+        typename Tree::box_type box;
+        if (node.isLeaf()) {
+            if (!leafDepth) {
+                leafDepth = node.depth();
+            }
+            BOOST_CHECK_EQUAL(node.depth(), *leafDepth);
+            for (const auto& entry: node.getEntries()) {
+                box = box & entry.box;
+                BOOST_CHECK_MESSAGE(tree.getBoundingBox(entry.data) == entry.box, "Id index is out of sync");
+            }
+            entryCount += node.size();
+        }
+        else {
+            for (const auto& child: node.getChildren()) {
+                BOOST_CHECK_EQUAL(child->getParent(), &node);
+                box = box & child->getBoundingBox();
+            }
+        }
+        BOOST_CHECK_MESSAGE(node.getBoundingBox() == box, "Node bounding box doesn`t cover its entries tightly");
+        if constexpr (Tree::node_type::aggregated) {
+            typename Tree::aggregate_type aggregate;
+            for (const auto& entry: node.getEntries()) {
+                aggregate.add(Tree::aggregate_type::of(entry.data));
+            }
+            for (const auto& child: node.getChildren()) {
+                aggregate.add(child->getAggregate());
+            }
+            BOOST_CHECK_MESSAGE(node.getAggregate() == aggregate, "Node aggregate doesn`t match its entries");
+        }
+    });
+    return entryCount;
+}
+
+/**
+ * Ids of entries, so that results of queries can be compared regardless of their order
+ */
+template<typename Entry>
+std::set<decltype(Entry::data)> idsOf(const std::vector<Entry>& entries)
+{
+    std::set<decltype(Entry::data)> ids;
+    std::for_each(entries.begin(), entries.end(), [&ids](const auto& entry) { ids.insert(entry.data); });
+    return ids;
+}
+
+// Windows for comparing queries of other trees with Tree: a corner, a thin strip, everything and nothing
+const std::vector<rtree::BoundingBox> comparedWindows = { rtree::BoundingBox(0, 0, 100, 100), rtree::BoundingBox(450, 200, 300, 20),
+                                                          rtree::BoundingBox(-50, -50, 2000, 2000), rtree::BoundingBox(2000, 2000, 5, 5) };
+
 BOOST_AUTO_TEST_SUITE(Tree)
 
 BOOST_AUTO_TEST_CASE(creation)
@@ -233,6 +303,38 @@ BOOST_AUTO_TEST_CASE(insert)
     }
 }
 
+BOOST_AUTO_TEST_CASE(linear_split_min_fill)
+{
+    // A far outlier is a seed of its own group, which still has to be filled up to the minimum
+    rtree::Tree<int, rtree::LinearSplit, 8, 4> tree;
+    for (int i = 0; i < 8; i++) {
+        tree.insert(rtree::BoundingBox(i, 0, 1, 1), i);
+    }
+    tree.insert(rtree::BoundingBox(1000, 1000, 1, 1), 8);
+    BOOST_REQUIRE_EQUAL(tree.getRoot()->getChildren().size(), 2);
+    for (const auto child: tree.getRoot()->getChildren()) {
+        BOOST_CHECK_GE(child->size(), tree.getMinEntries());
+    }
+    BOOST_CHECK_EQUAL(checkTree(tree), 9);
+}
+
+BOOST_AUTO_TEST_CASE(rstar_split_min_fill)
+{
+    // Four far items make the best distribution 4 / 7, which leaves a group below the minimum of the tree
+    rtree::Tree<int, rtree::RStarSplit> tree(5, 10);
+    for (int i = 0; i < 7; i++) {
+        tree.insert(rtree::BoundingBox(i, 0, 1, 1), i);
+    }
+    for (int i = 7; i < 11; i++) {
+        tree.insert(rtree::BoundingBox(1000 + i, 1000, 1, 1), i);
+    }
+    BOOST_REQUIRE_EQUAL(tree.getRoot()->getChildren().size(), 2);
+    for (const auto child: tree.getRoot()->getChildren()) {
+        BOOST_CHECK_GE(child->size(), tree.getMinEntries());
+    }
+    BOOST_CHECK_EQUAL(checkTree(tree), 11);
+}
+
 BOOST_AUTO_TEST_CASE(insert_duplicate_id)
 {
     rtree::Tree<int> tree;
@@ -384,4 +486,1314 @@ BOOST_AUTO_TEST_CASE(remove_without_condense)
     BOOST_CHECK_EQUAL(std::next(nodeIt), tree.end());
 }
 
+BOOST_AUTO_TEST_CASE(find_in_empty_tree)
+{
+    rtree::Tree<int> tree;
+    BOOST_CHECK(tree.find({ 0, 0, 10, 10 }).empty());
+}
+
+BOOST_AUTO_TEST_CASE(query)
+{
+    rtree::Tree<int> tree;
+    std::vector<rtree::BoundingBox> boxes;
+    for (int i = 0; i < 1000; i++) {
+        const rtree::BoundingBox box((i * 37) % 500, (i * 91) % 500, i % 7 + 1, i % 5 + 1);
+        boxes.push_back(box);
+        tree.insert(box, i);
+    }
+
+    const rtree::BoundingBox window(100, 100, 50, 80);
+    std::vector<int> expected;
+    for (size_t i = 0; i < boxes.size(); i++) {
+        if (boxes[i].intersects(window)) {
+            expected.push_back(i);
+        }
+    }
+
+    std::vector<int> found;
+    BOOST_CHECK(tree.query(window, [&found](const auto& entry) { found.push_back(entry.data); }));
+    std::sort(found.begin(), found.end());
+    BOOST_CHECK_EQUAL_COLLECTIONS(found.begin(), found.end(), expected.begin(), expected.end());
+
+    std::vector<rtree::Entry<int>> entries;
+    tree.query(window, std::back_inserter(entries));
+    BOOST_CHECK_EQUAL(entries.size(), expected.size());
+    BOOST_CHECK_EQUAL(tree.find(window).size(), expected.size());
+}
+
+BOOST_AUTO_TEST_CASE(query_early_exit)
+{
+    rtree::Tree<int> tree;
+    for (int i = 0; i < 100; i++) {
+        tree.insert({ i * 1.0, i * 1.0, 2, 2 }, i);
+    }
+
+    size_t visited = 0;
+    const auto completed = tree.query({ 0, 0, 100, 100 }, [&visited](const auto&) { return ++visited < 3; });
+    BOOST_CHECK(not completed);
+    BOOST_CHECK_EQUAL(visited, 3);
+}
+
+BOOST_AUTO_TEST_CASE(bulk_load)
+{
+    std::vector<rtree::Entry<int>> entries;
+    for (int i = 0; i < 1000; i++) {
+        entries.push_back({ rtree::BoundingBox((i * 37) % 500, (i * 91) % 500, i % 7 + 1, i % 5 + 1), i });
+    }
+    rtree::Tree<int> tree(entries.begin(), entries.end());
+
+    size_t leafDepth = 0;
+    size_t entryCount = 0;
+    for (auto nodeIt = tree.begin(); nodeIt != tree.end(); nodeIt++) {
+        if (nodeIt->getParent()) {
+            BOOST_CHECK_GE(nodeIt->size(), tree.getMinEntries());
+        }
+        BOOST_CHECK_LE(nodeIt->size(), tree.getMaxEntries());
+        if (nodeIt->isLeaf()) {
+            if (entryCount == 0) {
+                leafDepth = nodeIt->depth();
+            }
+            BOOST_CHECK_EQUAL(nodeIt->depth(), leafDepth);
+            entryCount += nodeIt->size();
+        }
+    }
+    BOOST_CHECK_EQUAL(entryCount, entries.size());
+    BOOST_CHECK_EQUAL(leafDepth, 2);
+
+    const rtree::BoundingBox window(100, 100, 50, 80);
+    const auto expected = std::count_if(entries.begin(), entries.end(),
+        [&window](const auto& entry) { return entry.box.intersects(window); });
+    BOOST_CHECK_EQUAL(tree.find(window).size(), expected);
+
+    // Ids are known to the tree after bulk load
+    BOOST_CHECK_THROW(tree.insert({ 1, 1, 1, 1 }, 0), rtree::DuplicateEntryException);
+    tree.remove(0);
+    const auto found = tree.find(entries.front().box);
+    BOOST_CHECK(std::none_of(found.begin(), found.end(), [](const auto& entry) { return entry.data == 0; }));
+    BOOST_CHECK_NO_THROW(tree.insert({ 1, 1, 1, 1 }, 0));
+}
+
+BOOST_AUTO_TEST_CASE(bulk_load_duplicate_id)
+{
+    std::vector<rtree::Entry<int>> entries {
+        { { 0, 0, 1, 1 }, 0 },
+        { { 1, 1, 1, 1 }, 1 },
+        { { 2, 2, 1, 1 }, 0 }
+    };
+    rtree::Tree<int> tree;
+    BOOST_CHECK_THROW(tree.bulkLoad(entries.begin(), entries.end()), rtree::DuplicateEntryException);
+}
+
+BOOST_AUTO_TEST_CASE(hilbert_index)
+{
+    const std::uint32_t half = std::uint32_t(1) << 31;
+    BOOST_CHECK_EQUAL(rtree::hilbertIndex(0, 0), 0);
+    BOOST_CHECK_LT(rtree::hilbertIndex(0, 0), rtree::hilbertIndex(0, half));
+    BOOST_CHECK_LT(rtree::hilbertIndex(0, half), rtree::hilbertIndex(half, half));
+    BOOST_CHECK_LT(rtree::hilbertIndex(half, half), rtree::hilbertIndex(half, 0));
+    BOOST_CHECK_LT(rtree::hilbertCoordinate(-1.5), rtree::hilbertCoordinate(0.0));
+    BOOST_CHECK_LT(rtree::hilbertCoordinate(0.0), rtree::hilbertCoordinate(2.5));
+}
+
+BOOST_AUTO_TEST_CASE(hilbert_bulk_load)
+{
+    std::vector<rtree::Entry<int>> entries;
+    for (int i = 0; i < 1000; i++) {
+        entries.push_back({ rtree::BoundingBox((i * 37) % 500, (i * 91) % 500, i % 7 + 1, i % 5 + 1), i });
+    }
+    rtree::Tree<int> tree;
+    tree.bulkLoad<rtree::HilbertPacking>(entries.begin(), entries.end());
+
+    size_t entryCount = 0;
+    std::for_each(tree.begin(), tree.end(), [&](const auto& node) {
+        if (node.isLeaf()) {
+            entryCount += node.size();
+        }
+    });
+    BOOST_CHECK_EQUAL(entryCount, entries.size());
+
+    const rtree::BoundingBox window(100, 100, 50, 80);
+    const auto expected = std::count_if(entries.begin(), entries.end(),
+        [&window](const auto& entry) { return entry.box.intersects(window); });
+    BOOST_CHECK_EQUAL(tree.find(window).size(), expected);
+}
+
+BOOST_AUTO_TEST_CASE(hilbert_split)
+{
+    rtree::Tree<int, rtree::HilbertSplit> tree;
+    std::vector<rtree::BoundingBox> boxes;
+    for (int i = 0; i < 1000; i++) {
+        const rtree::BoundingBox box((i * 37) % 500, (i * 91) % 500, i % 7 + 1, i % 5 + 1);
+        boxes.push_back(box);
+        tree.insert(box, i);
+    }
+
+    // Every known LHV covers Hilbert values of all entries of the subtree
+    std::for_each(tree.begin(), tree.end(), [](const auto& node) {
+        if (node.isLeaf() && node.getLargestHilbertValue() != rtree::UnknownHilbertValue) {
+            for (const auto& entry: node.getEntries()) {
+                BOOST_CHECK_LE(rtree::hilbertValue(entry.box), node.getLargestHilbertValue());
+            }
+        }
+    });
+
+    const rtree::BoundingBox window(100, 100, 50, 80);
+    const auto expected = std::count_if(boxes.begin(), boxes.end(),
+        [&window](const auto& box) { return box.intersects(window); });
+    BOOST_CHECK_EQUAL(tree.find(window).size(), expected);
+    tree.remove(10);
+    BOOST_CHECK_EQUAL(tree.find({ 0, 0, 1000, 1000 }).size(), boxes.size() - 1);
+}
+
+BOOST_AUTO_TEST_CASE(remove_many)
+{
+    rtree::Tree<int> tree;
+    for (int i = 0; i < 1000; i++) {
+        tree.insert({ (i * 37) % 500 * 1.0, (i * 91) % 500 * 1.0, i % 7 + 1.0, i % 5 + 1.0 }, i);
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        tree.remove(i);
+    }
+    BOOST_CHECK_EQUAL(checkTree(tree), 500);
+    BOOST_CHECK_EQUAL(tree.find({ 0, 0, 1000, 1000 }).size(), 500);
+}
+
+BOOST_AUTO_TEST_CASE(rstar_split)
+{
+    rtree::Tree<int, rtree::RStarSplit> tree;
+    std::vector<rtree::BoundingBox> boxes;
+    for (int i = 0; i < 2000; i++) {
+        const rtree::BoundingBox box((i * 37) % 500, (i * 91) % 500, i % 7 + 1, i % 5 + 1);
+        boxes.push_back(box);
+        tree.insert(box, i);
+    }
+    BOOST_CHECK_EQUAL(checkTree(tree), boxes.size());
+
+    const rtree::BoundingBox window(100, 100, 50, 80);
+    const auto expected = std::count_if(boxes.begin(), boxes.end(),
+        [&window](const auto& box) { return box.intersects(window); });
+    BOOST_CHECK_EQUAL(tree.find(window).size(), expected);
+
+    for (int i = 0; i < 2000; i += 3) {
+        tree.remove(i);
+    }
+    BOOST_CHECK_EQUAL(checkTree(tree), boxes.size() - 667);
+}
+
+BOOST_AUTO_TEST_CASE(id_index)
+{
+    rtree::IdIndex<int, int> index;
+    BOOST_CHECK(index.find(1) == nullptr);
+    BOOST_CHECK(!index.erase(1));
+    // Strided keys collide in low bits, they must still be found after erasing their neighbours
+    for (int i = 0; i < 5000; i++) {
+        BOOST_CHECK(index.insert(i * 1024, i));
+    }
+    BOOST_CHECK(!index.insert(1024, 0));
+    for (int i = 0; i < 5000; i += 3) {
+        BOOST_CHECK(index.erase(i * 1024));
+    }
+    BOOST_CHECK_EQUAL(index.size(), 5000 - 1667);
+    for (int i = 0; i < 5000; i++) {
+        const auto value = index.find(i * 1024);
+        if (i % 3 == 0) {
+            BOOST_CHECK(value == nullptr);
+        }
+        else {
+            BOOST_REQUIRE(value != nullptr);
+            BOOST_CHECK_EQUAL(*value, i);
+        }
+    }
+
+    rtree::Tree<int, rtree::RStarSplit> tree;
+    tree.insert({ 1, 2, 3, 4 }, 7);
+    BOOST_CHECK(tree.getBoundingBox(7) == rtree::BoundingBox(1, 2, 3, 4));
+    BOOST_CHECK(!tree.getBoundingBox(8).has_value());
+    tree.remove(7);
+    BOOST_CHECK(!tree.getBoundingBox(7).has_value());
+}
+
+BOOST_AUTO_TEST_CASE(clear_and_move)
+{
+    rtree::Tree<int> tree;
+    for (int i = 0; i < 100; i++) {
+        tree.insert({ i * 1.0, i * 1.0, 2, 2 }, i);
+    }
+    tree.clear();
+    BOOST_CHECK(tree.empty());
+    BOOST_CHECK_NO_THROW(tree.insert({ 1, 1, 1, 1 }, 0)); // ids are forgotten as well
+
+    for (int i = 1; i < 100; i++) {
+        tree.insert({ i * 1.0, i * 1.0, 2, 2 }, i);
+    }
+    auto moved = std::move(tree);
+    BOOST_CHECK(tree.empty());
+    BOOST_CHECK_EQUAL(checkTree(moved), 100);
+    BOOST_CHECK_EQUAL(moved.find({ 0, 0, 10, 10 }).size(), 11);
+}
+
+template<typename Tree>
+void checkStaticFanout()
+{
+    Tree tree;
+    BOOST_CHECK_EQUAL(tree.getMaxEntries(), 8);
+    BOOST_CHECK_EQUAL(tree.getMinEntries(), 3);
+    for (int i = 0; i < 1000; i++) {
+        tree.insert({ (i * 37) % 300 * 1.0, (i * 91) % 300 * 1.0, 3, 2 }, i);
+    }
+    BOOST_CHECK_EQUAL(checkTree(tree), 1000);
+    for (int i = 0; i < 1000; i += 2) {
+        tree.remove(i);
+    }
+    BOOST_CHECK_EQUAL(checkTree(tree), 500);
+    BOOST_CHECK_EQUAL(tree.find({ 0, 0, 300, 300 }).size(), 500);
+}
+
+BOOST_AUTO_TEST_CASE(static_fanout)
+{
+    using Leaf = rtree::Tree<int, rtree::LinearSplit, 8, 3>::node_type;
+    static_assert(std::is_trivially_destructible<Leaf>::value, "Fixed-capacity node must not own heap memory");
+    BOOST_CHECK_EQUAL(Leaf::capacity, 9);
+
+    checkStaticFanout<rtree::Tree<int, rtree::LinearSplit, 8, 3>>();
+    checkStaticFanout<rtree::Tree<int, rtree::QuadraticSplit, 8, 3>>();
+    checkStaticFanout<rtree::Tree<int, rtree::HilbertSplit, 8, 3>>();
+    checkStaticFanout<rtree::Tree<int, rtree::RStarSplit, 8, 3>>();
+
+    std::vector<rtree::Entry<int>> values;
+    for (int i = 0; i < 500; i++) {
+        values.push_back({ { i % 25 * 4.0, i / 25 * 4.0, 1, 1 }, i });
+    }
+    rtree::Tree<int, rtree::RStarSplit, 16> loaded(values.begin(), values.end());
+    BOOST_CHECK_EQUAL(loaded.getMinEntries(), 3);
+    BOOST_CHECK_EQUAL(checkTree(loaded), 500);
+    BOOST_CHECK_EQUAL(loaded.find({ 0, 0, 10, 10 }).size(), 9);
+}
+
+BOOST_AUTO_TEST_CASE(box_distance)
+{
+    const rtree::BoundingBox box(0, 0, 10, 10);
+    BOOST_CHECK_EQUAL(box.distance({ 5, 5, 20, 20 }), 0.0);
+    BOOST_CHECK_EQUAL(box.distance({ 10, 0, 5, 5 }), 0.0);
+    BOOST_CHECK_EQUAL(box.distance({ 13, 2, 5, 5 }), 3.0);
+    BOOST_CHECK_EQUAL(box.distance({ -7, 20, 9, -4 }), 6.0);
+    BOOST_CHECK_EQUAL(box.distance({ 13, 14, 1, 1 }), 5.0);
+    BOOST_CHECK_EQUAL(box.distance({ -4, -3, -1, -1 }), 5.0);
+    BOOST_CHECK_EQUAL(box.distance(rtree::BoundingBox()), 0.0);
+    BOOST_CHECK_EQUAL(rtree::BasicBoundingBox<std::int32_t>(0, 0, 1, 1).distance({ 4, 5, 1, 1 }), 5.0);
+}
+
+BOOST_AUTO_TEST_CASE(nearest)
+{
+    rtree::Tree<int, rtree::RStarSplit> tree;
+    BOOST_CHECK(tree.nearest({ 0, 0 }, 3).empty());
+
+    std::vector<rtree::BoundingBox> boxes;
+    for (int i = 0; i < 1000; i++) {
+        boxes.emplace_back((i * 37) % 500, (i * 91) % 500, i % 7, i % 5);
+        tree.insert(boxes.back(), i);
+    }
+
+    for (const rtree::Point p: { rtree::Point{ 0, 0 }, rtree::Point{ 250, 130 }, rtree::Point{ -40, 600 } }) {
+        std::vector<double> distances;
+        for (const auto& box: boxes) {
+            distances.push_back(box.squaredDistance(p));
+        }
+        std::sort(distances.begin(), distances.end());
+
+        const auto closest = tree.nearest(p, 8);
+        BOOST_REQUIRE_EQUAL(closest.size(), 8);
+        for (size_t i = 0; i < closest.size(); i++) {
+            BOOST_CHECK_EQUAL(closest[i].box.squaredDistance(p), distances[i]);
+        }
+
+        const double r = 30;
+        const auto within = tree.withinDistance(p, r);
+        const auto expected = std::count_if(distances.begin(), distances.end(),
+            [r](double d) { return d <= r * r; });
+        BOOST_CHECK_EQUAL(within.size(), expected);
+    }
+    BOOST_CHECK_EQUAL(tree.nearest({ 1, 1 }, 5000).size(), 1000);
+    BOOST_CHECK_EQUAL(tree.withinDistance({ 250, 250 }, 1000).size(), 1000);
+}
+
+template<typename Coord>
+void checkSimdKernels()
+{
+    std::vector<Coord> minX, minY, maxX, maxY;
+    for (int i = 0; i < 64; i++) {
+        minX.push_back((i * 37) % 50);
+        minY.push_back((i * 91) % 50);
+        maxX.push_back(minX.back() + i % 7);
+        maxY.push_back(minY.back() + i % 5);
+    }
+    const rtree::simd::Query<Coord> q { 10, 10, 25, 30 };
+    for (size_t count = 1; count <= minX.size(); count++) {
+        BOOST_CHECK_EQUAL(rtree::simd::intersectMask(minX.data(), minY.data(), maxX.data(), maxY.data(), count, q),
+                          rtree::simd::intersectMaskScalar(minX.data(), minY.data(), maxX.data(), maxY.data(), count, q));
+        BOOST_CHECK_EQUAL(rtree::simd::leastGrowth(minX.data(), minY.data(), maxX.data(), maxY.data(), count, q),
+                          rtree::simd::leastGrowthScalar(minX.data(), minY.data(), maxX.data(), maxY.data(), count, q));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(simd_kernels)
+{
+    checkSimdKernels<double>();
+    checkSimdKernels<float>();
+    checkSimdKernels<std::int32_t>();
+}
+
+template<typename Tree>
+void checkCoordinateType()
+{
+    using Box = typename Tree::box_type;
+    Tree tree;
+    std::vector<Box> boxes;
+    for (int i = 0; i < 1000; i++) {
+        boxes.emplace_back((i * 37) % 400, (i * 91) % 400, i % 7 + 1, i % 5 + 1);
+        tree.insert(boxes.back(), i);
+    }
+    BOOST_CHECK_EQUAL(checkTree(tree), boxes.size());
+
+    const Box window(100, 150, 60, 40);
+    const auto expected = std::count_if(boxes.begin(), boxes.end(),
+        [&window](const auto& box) { return box.intersects(window); });
+    BOOST_CHECK_EQUAL(tree.find(window).size(), expected);
+
+    for (int i = 0; i < 1000; i += 2) {
+        tree.remove(i);
+    }
+    BOOST_CHECK_EQUAL(checkTree(tree), 500);
+}
+
+BOOST_AUTO_TEST_CASE(coordinate_types)
+{
+    static_assert(sizeof(rtree::BasicBoundingBox<float>) < sizeof(rtree::BoundingBox), "Float box must be smaller");
+    // Integer areas don`t overflow the coordinate type
+    BOOST_CHECK_EQUAL(rtree::BasicBoundingBox<std::int32_t>(0, 0, 100000, 100000).area(), 10000000000LL);
+
+    using rtree::DynamicCapacity;
+    checkCoordinateType<rtree::Tree<int, rtree::LinearSplit, DynamicCapacity, DynamicCapacity, float>>();
+    checkCoordinateType<rtree::Tree<int, rtree::QuadraticSplit, DynamicCapacity, DynamicCapacity, std::int32_t>>();
+    checkCoordinateType<rtree::Tree<int, rtree::HilbertSplit, 8, 3, float>>();
+    checkCoordinateType<rtree::Tree<int, rtree::RStarSplit, 8, 3, std::int32_t>>();
+
+    std::vector<rtree::Entry<int, std::int32_t>> entries;
+    for (int i = 0; i < 400; i++) {
+        entries.push_back({ { i % 20 * 5, i / 20 * 5, 2, 2 }, i });
+    }
+    rtree::Tree<int, rtree::LinearSplit, DynamicCapacity, DynamicCapacity, std::int32_t> loaded;
+    loaded.bulkLoad<rtree::HilbertPacking>(entries.begin(), entries.end());
+    BOOST_CHECK_EQUAL(checkTree(loaded), 400);
+    BOOST_CHECK_EQUAL(loaded.find({ 0, 0, 5, 5 }).size(), 4);
+}
+
+
+template<typename Tree>
+void checkApplyBatch()
+{
+    using Box = typename Tree::box_type;
+    using Entry = typename Tree::entry_type;
+    const auto boxOf = [](int i, int shift) {
+        return Box((i * 37 + shift) % 500, (i * 91 + shift) % 500, i % 7 + 1, i % 5 + 1);
+    };
+
+    Tree tree;
+    for (int i = 0; i < 1000; i++) {
+        tree.insert(boxOf(i, 0), i);
+    }
+    std::vector<Entry> inserts;
+    std::vector<int> removes;
+    std::vector<Entry> updates;
+    for (int i = 1000; i < 3000; i++) {
+        inserts.push_back({ boxOf(i, 0), i });
+    }
+    for (int i = 0; i < 1000; i += 3) {
+        removes.push_back(i);
+    }
+    for (int i = 1; i < 1000; i += 3) {
+        updates.push_back({ boxOf(i, 250), i });
+    }
+    updates.push_back({ boxOf(5000, 0), 5000 }); // not in the tree yet
+    removes.push_back(7000); // never was in the tree
+    tree.applyBatch(inserts, removes, updates);
+    BOOST_CHECK_EQUAL(checkTree(tree), 3000 - 334 + 1);
+
+    std::vector<Entry> expected;
+    for (int i = 0; i < 3000; i++) {
+        if (i < 1000 && i % 3 == 0) {
+            continue;
+        }
+        expected.push_back({ boxOf(i, i < 1000 && i % 3 == 1 ? 250 : 0), i });
+    }
+    expected.push_back({ boxOf(5000, 0), 5000 });
+    for (const auto& entry: expected) {
+        BOOST_CHECK(tree.getBoundingBox(entry.data) == entry.box);
+    }
+    const Box window(100, 100, 80, 60);
+    const auto count = std::count_if(expected.begin(), expected.end(),
+        [&window](const auto& entry) { return entry.box.intersects(window); });
+    BOOST_CHECK_EQUAL(tree.find(window).size(), count);
+
+    // Everything is removed in one batch, then the tree is filled from scratch by another one
+    std::vector<int> all;
+    std::transform(expected.begin(), expected.end(), std::back_inserter(all), [](const auto& e) { return e.data; });
+    tree.applyBatch({}, all);
+    BOOST_CHECK(tree.empty());
+    tree.applyBatch(expected, {});
+    BOOST_CHECK_EQUAL(checkTree(tree), expected.size());
+
+    BOOST_CHECK_THROW(tree.applyBatch({ { boxOf(1, 0), 1 } }, {}), rtree::DuplicateEntryException);
+    BOOST_CHECK_THROW(tree.applyBatch({ { boxOf(1, 0), 9000 } }, { 2 }, { { boxOf(1, 0), 9000 } }),
+                      rtree::DuplicateEntryException);
+    BOOST_CHECK_EQUAL(checkTree(tree), expected.size()); // failed batches leave the tree intact
+    BOOST_CHECK_NO_THROW(tree.applyBatch({ { boxOf(1, 0), 1 } }, { 1 }));
+    BOOST_CHECK_EQUAL(checkTree(tree), expected.size());
+}
+
+BOOST_AUTO_TEST_CASE(apply_batch)
+{
+    checkApplyBatch<rtree::Tree<int>>();
+    checkApplyBatch<rtree::Tree<int, rtree::QuadraticSplit>>();
+    checkApplyBatch<rtree::Tree<int, rtree::RStarSplit, 8, 3>>();
+    checkApplyBatch<rtree::Tree<int, rtree::HilbertSplit, 16>>();
+    checkApplyBatch<rtree::Tree<int, rtree::LinearSplit, rtree::DynamicCapacity, rtree::DynamicCapacity, std::int32_t>>();
+}
+
+
+BOOST_AUTO_TEST_CASE(update)
+{
+    const auto boxOf = [](int i, int step) {
+        return rtree::BoundingBox((i * 37 + step * (i % 3)) % 1000, (i * 91 + step * (i % 5)) % 1000, i % 7 + 1, i % 5 + 1);
+    };
+    const auto expectedCount = [&](const rtree::BoundingBox& window, int step) {
+        int count = 0;
+        for (int i = 0; i < 2000; i++) {
+            count += boxOf(i, step).intersects(window);
+        }
+        return count;
+    };
+    const rtree::BoundingBox window(100, 200, 300, 150);
+
+    // Small steps keep most entries in their leaves, every tenth one jumps far and is reinserted
+    rtree::Tree<int, rtree::RStarSplit> tree;
+    for (int i = 0; i < 2000; i++) {
+        tree.insert(boxOf(i, 0), i);
+    }
+    for (int step = 1; step <= 5; step++) {
+        for (int i = 0; i < 2000; i++) {
+            tree.update(i, boxOf(i, i % 10 ? step : step * 100));
+        }
+        BOOST_CHECK_EQUAL(checkTree(tree), 2000);
+    }
+    for (int i = 0; i < 2000; i++) {
+        BOOST_CHECK(tree.getBoundingBox(i) == boxOf(i, i % 10 ? 5 : 500));
+    }
+    tree.update(5000, boxOf(5000, 0)); // not in the tree yet
+    BOOST_CHECK(tree.getBoundingBox(5000) == boxOf(5000, 0));
+
+    // Fat boxes leave room for small moves, which then don't change any node
+    rtree::Tree<int> fat;
+    fat.setFatMargin(10);
+    for (int i = 0; i < 2000; i++) {
+        fat.insert(boxOf(i, 0), i);
+    }
+    for (int i = 0; i < 2000; i++) {
+        fat.update(i, boxOf(i, 1));
+    }
+    BOOST_CHECK_EQUAL(fat.find(window).size(), expectedCount(window, 1));
+
+    // Rightmost entry grows its leaf and the root by the margin on the first step to the right
+    fat.insert(rtree::BoundingBox(1010, 500, 1, 1), 5000);
+    fat.update(5000, rtree::BoundingBox(1011, 500, 1, 1));
+    BOOST_CHECK_EQUAL(fat.getRoot()->getBoundingBox().tr().x, 1022);
+    std::vector<rtree::BoundingBox> nodeBoxes;
+    std::for_each(fat.begin(), fat.end(), [&nodeBoxes](const auto& node) { nodeBoxes.push_back(node.getBoundingBox()); });
+    for (int x = 1012; x <= 1021; x++) {
+        fat.update(5000, rtree::BoundingBox(x, 500, 1, 1));
+    }
+    size_t node = 0;
+    std::for_each(fat.begin(), fat.end(), [&](const auto& n) { BOOST_CHECK(n.getBoundingBox() == nodeBoxes[node++]); });
+    BOOST_CHECK_EQUAL(fat.find(rtree::BoundingBox(1021, 500, 0, 0)).size(), 1);
+    BOOST_CHECK(fat.find(rtree::BoundingBox(1011, 500, 9, 0)).empty());
+
+    // An entry drifting a little every step stays in touch with its leaf, but is reinserted before it stretches it far
+    const auto largestLeaf = [](const auto& t) {
+        double margin = 0;
+        std::for_each(t.begin(), t.end(), [&margin](const auto& node) {
+            if (node.isLeaf()) {
+                margin = std::max(margin, node.getBoundingBox().margin());
+            }
+        });
+        return margin;
+    };
+    const auto before = largestLeaf(tree);
+    for (int step = 1; step <= 3000; step++) {
+        tree.update(7, rtree::BoundingBox(step % 1000, step / 3, 1, 1));
+    }
+    BOOST_CHECK_EQUAL(checkTree(tree), 2001);
+    BOOST_CHECK_LE(largestLeaf(tree), 2 * before);
+
+    // Moved entries make largest Hilbert values of their leaves and ancestors unknown instead of stale
+    rtree::Tree<int, rtree::HilbertSplit, 8> hilbert;
+    for (int i = 0; i < 2000; i++) {
+        hilbert.insert(boxOf(i, 0), i);
+    }
+    for (int i = 0; i < 2000; i++) {
+        hilbert.update(i, boxOf(i, 1));
+    }
+    std::for_each(hilbert.begin(), hilbert.end(), [](const auto& node) {
+        std::uint64_t value = 0;
+        if (node.isLeaf()) {
+            for (const auto& entry: node.getEntries()) {
+                value = std::max(value, rtree::hilbertValue(entry.box));
+            }
+            BOOST_CHECK(node.getLargestHilbertValue() == rtree::UnknownHilbertValue || node.getLargestHilbertValue() >= value);
+        }
+    });
+    BOOST_CHECK_EQUAL(checkTree(hilbert), 2000);
+}
+
+BOOST_AUTO_TEST_CASE(refit)
+{
+    std::vector<rtree::Entry<int>> entries;
+    for (int i = 0; i < 5000; i++) {
+        entries.push_back({ rtree::BoundingBox(i % 100 * 10, i / 100 * 10, 2, 2), i });
+    }
+    const auto moved = [](int i) { return rtree::BoundingBox(i * 37 % 1000, i * 91 % 500, 2, 2); };
+    const rtree::BoundingBox window(100, 100, 200, 150);
+    const auto expected = std::count_if(entries.begin(), entries.end(),
+        [&](const auto& entry) { return moved(entry.data).intersects(window); });
+
+    rtree::Tree<int> tree(entries.begin(), entries.end());
+    tree.trackChanges(true);
+    const auto built = tree.overlapRatio();
+    tree.refit([&moved](int data, rtree::BoundingBox& box) { box = moved(data); });
+    BOOST_CHECK_EQUAL(checkTree(tree), entries.size());
+    BOOST_CHECK_EQUAL(tree.find(window).size(), expected);
+    BOOST_CHECK(!tree.takeChanges().has_value());
+    // Entries scattered all over keep their leaves, which now overlap a lot
+    BOOST_CHECK_GT(tree.overlapRatio(), 10 * built + 0.1);
+
+    rtree::ThreadPool pool(4);
+    rtree::Tree<int, rtree::HilbertSplit, 8> parallel(entries.begin(), entries.end());
+    parallel.refit([&moved](int data, rtree::BoundingBox& box) { box = moved(data); }, pool);
+    BOOST_CHECK_EQUAL(checkTree(parallel), entries.size());
+    BOOST_CHECK_EQUAL(parallel.find(window).size(), expected);
+    parallel.refit([](int, rtree::BoundingBox& box) { box = rtree::BoundingBox(box.x + 1, box.y, box.w, box.h); }, pool);
+    BOOST_CHECK_EQUAL(checkTree(parallel), entries.size());
+    BOOST_CHECK(parallel.getBoundingBox(7) == rtree::BoundingBox(moved(7).x + 1, moved(7).y, 2, 2));
+    parallel.insert(rtree::BoundingBox(5, 5, 1, 1), -1);
+    BOOST_CHECK_EQUAL(checkTree(parallel), entries.size() + 1);
+
+    rtree::Tree<int> single;
+    single.insert(rtree::BoundingBox(0, 0, 1, 1), 0);
+    single.refit([](int, rtree::BoundingBox& box) { box = rtree::BoundingBox(5, 5, 1, 1); }, pool);
+    BOOST_CHECK(single.getRoot()->getBoundingBox() == rtree::BoundingBox(5, 5, 1, 1));
+    BOOST_CHECK_EQUAL(single.overlapRatio(), 0.0);
+}
+
+struct Weight
+{
+    double operator()(int data) const { return data % 10; }
+};
+
+template<typename Tree>
+void checkAggregate()
+{
+    using Box = typename Tree::box_type;
+    using Entry = typename Tree::entry_type;
+    const auto boxOf = [](int i, int shift) {
+        return Box((i * 37 + shift) % 1000, (i * 91 + shift) % 1000, i % 7 + 1, i % 5 + 1);
+    };
+    const std::vector<Box> windows = { Box(100, 200, 300, 150), Box(0, 0, 1000, 1000), Box(500, 500, 3, 3), Box(2000, 0, 5, 5) };
+    const auto checkWindows = [&](const Tree& tree, const std::vector<Entry>& entries) {
+        BOOST_CHECK_EQUAL(checkTree(tree), entries.size());
+        for (const auto& window: windows) {
+            typename Tree::aggregate_type expected;
+            for (const auto& entry: entries) {
+                if (entry.box.intersects(window)) {
+                    expected.add(Tree::aggregate_type::of(entry.data));
+                }
+            }
+            BOOST_CHECK_EQUAL(tree.count(window), expected.count);
+            BOOST_CHECK(tree.aggregate(window) == expected);
+        }
+    };
+
+    Tree tree;
+    std::vector<Entry> entries;
+    for (int i = 0; i < 3000; i++) {
+        tree.insert(boxOf(i, 0), i);
+        entries.push_back({ boxOf(i, 0), i });
+    }
+    checkWindows(tree, entries);
+
+    // Removals condense nodes, updates move entries between leaves
+    for (int i = 0; i < 3000; i += 3) {
+        tree.remove(i);
+    }
+    for (int i = 1; i < 3000; i += 3) {
+        tree.update(i, boxOf(i, 200));
+    }
+    entries.clear();
+    for (int i = 0; i < 3000; i++) {
+        if (i % 3 != 0) {
+            entries.push_back({ boxOf(i, i % 3 == 1 ? 200 : 0), i });
+        }
+    }
+    checkWindows(tree, entries);
+
+    std::vector<Entry> inserts;
+    std::vector<int> removes;
+    for (int i = 3000; i < 4000; i++) {
+        inserts.push_back({ boxOf(i, 0), i });
+    }
+    for (int i = 2; i < 3000; i += 3) {
+        removes.push_back(i);
+    }
+    tree.applyBatch(inserts, removes);
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [](const auto& e) { return e.data % 3 == 2; }), entries.end());
+    entries.insert(entries.end(), inserts.begin(), inserts.end());
+    checkWindows(tree, entries);
+
+    tree.refit([&boxOf](int data, Box& box) { box = boxOf(data, 500); });
+    std::for_each(entries.begin(), entries.end(), [&boxOf](auto& entry) { entry.box = boxOf(entry.data, 500); });
+    checkWindows(tree, entries);
+
+    Tree loaded(entries.begin(), entries.end());
+    checkWindows(loaded, entries);
+    loaded.clear();
+    checkWindows(loaded, {});
+}
+
+BOOST_AUTO_TEST_CASE(aggregate)
+{
+    using rtree::DynamicCapacity;
+    checkAggregate<rtree::Tree<int, rtree::LinearSplit, DynamicCapacity, DynamicCapacity, double, rtree::CountAggregate>>();
+    checkAggregate<rtree::Tree<int, rtree::QuadraticSplit, DynamicCapacity, DynamicCapacity, double, rtree::SumAggregate<Weight>>>();
+    checkAggregate<rtree::Tree<int, rtree::RStarSplit, 8, 3, double, rtree::MinAggregate<Weight>>>();
+    checkAggregate<rtree::Tree<int, rtree::HilbertSplit, 16, DynamicCapacity, double, rtree::MaxAggregate<Weight, int>>>();
+    checkAggregate<rtree::Tree<int, rtree::LinearSplit, 6, DynamicCapacity, std::int32_t, rtree::SumAggregate<Weight>>>();
+
+    // Without an aggregate entries are counted by a query
+    rtree::Tree<int> plain;
+    for (int i = 0; i < 100; i++) {
+        plain.insert(rtree::BoundingBox(i, i, 1, 1), i);
+    }
+    BOOST_CHECK_EQUAL(plain.count(rtree::BoundingBox(10, 10, 9.5, 9.5)), 11);
+}
+
+BOOST_AUTO_TEST_CASE(sample)
+{
+    using Tree = rtree::Tree<int, rtree::RStarSplit, 8, 3, double, rtree::CountAggregate>;
+    Tree tree;
+    for (int i = 0; i < 10000; i++) {
+        tree.insert(rtree::BoundingBox(i * 37 % 1000, i * 91 % 1000, i % 7 + 1, i % 5 + 1), i);
+    }
+    const rtree::BoundingBox window(100, 200, 200, 200);
+    std::set<int> inside;
+    for (const auto& entry: tree.find(window)) {
+        inside.insert(entry.data);
+    }
+    BOOST_REQUIRE_GT(inside.size(), 100);
+
+    std::mt19937 rng(42);
+    const size_t k = 20;
+    const int runs = 4000;
+    std::map<int, int> picks;
+    for (int run = 0; run < runs; run++) {
+        const auto sampled = tree.sample(window, k, rng);
+        BOOST_REQUIRE_EQUAL(sampled.size(), k);
+        std::set<int> distinct;
+        for (const auto& entry: sampled) {
+            BOOST_CHECK(inside.count(entry.data));
+            BOOST_CHECK(tree.getBoundingBox(entry.data) == entry.box);
+            distinct.insert(entry.data);
+            picks[entry.data]++;
+        }
+        BOOST_CHECK_EQUAL(distinct.size(), k);
+    }
+    // Every entry is picked about as often as any other
+    const double expected = double(runs) * k / inside.size();
+    BOOST_CHECK_EQUAL(picks.size(), inside.size());
+    for (const auto& [data, count]: picks) {
+        BOOST_CHECK_MESSAGE(count > expected / 2 && count < expected * 3 / 2, "Entry " << data << " picked " << count << " times");
+    }
+
+    BOOST_CHECK_EQUAL(tree.sample(window, inside.size() + 10, rng).size(), inside.size());
+    BOOST_CHECK_EQUAL(tree.sample(rtree::BoundingBox(-1000, 0, 10, 10), 5, rng).size(), 0);
+    BOOST_CHECK_EQUAL(tree.sample(window, 0, rng).size(), 0);
+    BOOST_CHECK_EQUAL(Tree().sample(window, 5, rng).size(), 0);
+    const auto everything = tree.sample(rtree::BoundingBox(0, 0, 2000, 2000), 10000, rng);
+    std::set<int> all;
+    std::for_each(everything.begin(), everything.end(), [&all](const auto& entry) { all.insert(entry.data); });
+    BOOST_CHECK_EQUAL(all.size(), 10000);
+}
+
+struct Priority
+{
+    int operator()(int data) const { return data * 7919 % 1000; }
+};
+
+BOOST_AUTO_TEST_CASE(top_k)
+{
+    using Tree = rtree::Tree<int, rtree::QuadraticSplit, rtree::DynamicCapacity, rtree::DynamicCapacity, double,
+                             rtree::MaxAggregate<Priority, int>>;
+    const auto boxOf = [](int i) { return rtree::BoundingBox(i * 37 % 1000, i * 91 % 1000, i % 7 + 1, i % 5 + 1); };
+    Tree tree;
+    for (int i = 0; i < 5000; i++) {
+        tree.insert(boxOf(i), i);
+    }
+    for (int i = 0; i < 5000; i += 4) {
+        tree.remove(i);
+    }
+    const rtree::BoundingBox window(100, 200, 400, 300);
+    std::vector<int> expected;
+    for (const auto& entry: tree.find(window)) {
+        expected.push_back(Priority()(entry.data));
+    }
+    std::sort(expected.rbegin(), expected.rend());
+
+    for (size_t k: { 1, 10, 50 }) {
+        const auto best = tree.topK(window, k);
+        BOOST_REQUIRE_EQUAL(best.size(), k);
+        std::vector<int> priorities;
+        for (const auto& entry: best) {
+            BOOST_CHECK(entry.box.intersects(window));
+            priorities.push_back(Priority()(entry.data));
+        }
+        BOOST_CHECK(std::equal(priorities.begin(), priorities.end(), expected.begin()));
+    }
+    BOOST_CHECK_EQUAL(tree.topK(window, expected.size() + 10).size(), expected.size());
+    BOOST_CHECK(tree.topK(window, 0).empty());
+    BOOST_CHECK(tree.topK(rtree::BoundingBox(-1000, 0, 10, 10), 5).empty());
+    BOOST_CHECK(Tree().topK(window, 5).empty());
+}
+
+BOOST_AUTO_TEST_CASE(top_k_prioritized)
+{
+    using Id = rtree::Prioritized<int>;
+    using Tree = rtree::Tree<Id, rtree::LinearSplit, 8, 3, double, rtree::PriorityAggregate<>>;
+    const auto boxOf = [](int i) { return rtree::BoundingBox(i * 37 % 1000, i * 91 % 1000, i % 7 + 1, i % 5 + 1); };
+    Tree tree;
+    std::map<int, double> priorities;
+    for (int i = 0; i < 3000; i++) {
+        priorities[i] = i * 7919 % 1000;
+        tree.insert(boxOf(i), { i, priorities[i] });
+    }
+    for (int i = 0; i < 3000; i += 5) {
+        tree.remove({ i, 0 });
+        priorities.erase(i);
+    }
+    for (int i = 1; i < 3000; i += 3) {
+        if (priorities.count(i)) {
+            priorities[i] = i % 2 ? priorities[i] + 1000 : -1;
+            tree.setWeight({ i, priorities[i] });
+        }
+    }
+    tree.setWeight({ 0, 5000 });
+    checkTree(tree);
+
+    const rtree::BoundingBox window(100, 200, 400, 300);
+    std::vector<double> expected;
+    for (const auto& entry: tree.find(window)) {
+        BOOST_CHECK_EQUAL(entry.data.priority, priorities.at(entry.data.id));
+        expected.push_back(entry.data.priority);
+    }
+    std::sort(expected.rbegin(), expected.rend());
+    const auto best = tree.topK(window, 20);
+    BOOST_REQUIRE_EQUAL(best.size(), 20);
+    for (size_t i = 0; i < best.size(); i++) {
+        BOOST_CHECK_EQUAL(best[i].data.priority, expected[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(find_batch)
+{
+    rtree::Tree<int> tree;
+    for (int i = 0; i < 5000; i++) {
+        tree.insert({ (i * 37) % 1000 * 1.0, (i * 91) % 1000 * 1.0, i % 7 + 1.0, i % 5 + 1.0 }, i);
+    }
+    std::vector<rtree::BoundingBox> boxes;
+    for (int i = 0; i < 500; i++) {
+        boxes.push_back({ (i * 53) % 1000 * 1.0, (i * 29) % 1000 * 1.0, i % 40 * 1.0, i % 30 * 1.0 });
+    }
+
+    rtree::ThreadPool pool(4);
+    const auto result = tree.findBatch(boxes.begin(), boxes.end(), pool);
+    BOOST_REQUIRE_EQUAL(result.offsets.size(), boxes.size() + 1);
+    BOOST_CHECK_EQUAL(result.offsets.back(), result.entries.size());
+    for (size_t i = 0; i < boxes.size(); i++) {
+        const auto expected = tree.find(boxes[i]);
+        BOOST_REQUIRE_EQUAL(result.offsets[i + 1] - result.offsets[i], expected.size());
+        BOOST_CHECK(std::equal(expected.begin(), expected.end(), std::next(result.entries.begin(), result.offsets[i])));
+    }
+
+    BOOST_CHECK(tree.findBatch(boxes.begin(), boxes.begin(), pool).entries.empty());
+    BOOST_CHECK_THROW(pool.run([](size_t worker) { if (worker == 1) { throw std::runtime_error("task"); } }),
+                      std::runtime_error);
+}
+
+
+BOOST_AUTO_TEST_CASE(spatial_join)
+{
+    std::vector<rtree::Entry<int>> roads;
+    std::vector<rtree::Entry<int>> parcels;
+    for (int i = 0; i < 2000; i++) {
+        roads.push_back({ { (i * 37) % 1000 * 1.0, (i * 91) % 1000 * 1.0, i % 13 + 1.0, 1 }, i });
+        parcels.push_back({ { (i * 53) % 1000 * 1.0, (i * 29) % 1000 * 1.0, 4, i % 9 + 1.0 }, i });
+    }
+    std::vector<std::pair<int, int>> expected;
+    for (const auto& road: roads) {
+        for (const auto& parcel: parcels) {
+            if (road.box.intersects(parcel.box)) {
+                expected.emplace_back(road.data, parcel.data);
+            }
+        }
+    }
+    std::sort(expected.begin(), expected.end());
+
+    // Trees of different height and fanout are joined as well
+    rtree::Tree<int> roadTree(roads.begin(), roads.end());
+    rtree::Tree<int, rtree::RStarSplit, 32> parcelTree;
+    for (const auto& parcel: parcels) {
+        parcelTree.insert(parcel.box, parcel.data);
+    }
+
+    std::vector<std::pair<int, int>> pairs;
+    rtree::spatialJoin(roadTree, parcelTree, [&pairs](const auto& road, const auto& parcel) {
+        pairs.emplace_back(road.data, parcel.data);
+    });
+    std::sort(pairs.begin(), pairs.end());
+    BOOST_CHECK(pairs == expected);
+
+    rtree::ThreadPool pool(4);
+    std::mutex mutex;
+    pairs.clear();
+    rtree::spatialJoin(parcelTree, roadTree, [&](const auto& parcel, const auto& road) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pairs.emplace_back(road.data, parcel.data);
+    }, pool);
+    std::sort(pairs.begin(), pairs.end());
+    BOOST_CHECK(pairs == expected);
+
+    size_t count = 0;
+    rtree::spatialJoin(roadTree, rtree::Tree<int>(), [&count](const auto&, const auto&) { count++; }, pool);
+    BOOST_CHECK_EQUAL(count, 0);
+}
+
+
+BOOST_AUTO_TEST_CASE(self_join)
+{
+    using Pairs = std::set<std::pair<int, int>>;
+    const auto boxOf = [](int i, int frame) {
+        return rtree::BoundingBox((i * 37 + frame * (i % 5)) % 300, (i * 91 + frame * (i % 3)) % 300, i % 7 + 2, i % 5 + 2);
+    };
+    const auto ordered = [](int a, int b) { return std::make_pair(std::min(a, b), std::max(a, b)); };
+    const auto bruteForce = [&](const auto& tree) {
+        Pairs pairs;
+        for (auto a = tree.begin(); a != tree.end(); ++a) {
+            for (const auto& entry: a->getEntries()) {
+                for (const auto& other: tree.find(entry.box)) {
+                    if (entry.data != other.data) {
+                        pairs.insert(ordered(entry.data, other.data));
+                    }
+                }
+            }
+        }
+        return pairs;
+    };
+
+    rtree::Tree<int> tree;
+    for (int i = 0; i < 1000; i++) {
+        tree.insert(boxOf(i, 0), i);
+    }
+    Pairs pairs;
+    size_t calls = 0;
+    tree.selfJoin([&](const auto& a, const auto& b) {
+        pairs.insert(ordered(a.data, b.data));
+        calls++;
+    });
+    BOOST_CHECK_EQUAL(calls, pairs.size()); // every pair is reported once
+    BOOST_CHECK(pairs == bruteForce(tree));
+
+    rtree::IncrementalSelfJoin<rtree::Tree<int>> join;
+    Pairs tracked;
+    const auto added = [&](int a, int b) { BOOST_CHECK(tracked.insert(ordered(a, b)).second); };
+    const auto removed = [&](int a, int b) { BOOST_CHECK(tracked.erase(ordered(a, b)) == 1); };
+    join.update(tree, added, removed);
+    BOOST_CHECK(tracked == pairs);
+    for (int frame = 1; frame < 6; frame++) {
+        // Some objects move, some disappear and new ones appear
+        for (int i = frame; i < 1000; i += 7) {
+            tree.remove(i);
+            tree.insert(boxOf(i, frame), i);
+        }
+        tree.applyBatch({ { boxOf(1000 + frame, 0), 1000 + frame } }, { frame * 10 }, { { boxOf(frame, 3), frame } });
+        join.update(tree, added, removed);
+        BOOST_CHECK(tracked == bruteForce(tree));
+        BOOST_CHECK_EQUAL(join.size(), tracked.size());
+    }
+
+    // Replaced content is compared with the previous frame as a whole
+    std::vector<rtree::Entry<int>> entries;
+    for (int i = 0; i < 500; i++) {
+        entries.push_back({ boxOf(i, 9), i });
+    }
+    tree.bulkLoad(entries.begin(), entries.end());
+    join.update(tree, added, removed);
+    BOOST_CHECK(tracked == bruteForce(tree));
+}
+
+BOOST_AUTO_TEST_CASE(versioned_tree)
+{
+    using Versioned = rtree::VersionedTree<rtree::Tree<int>>;
+    const auto all = rtree::BoundingBox(-1000, -1000, 3000, 3000);
+    const auto boxOf = [](int i) { return rtree::BoundingBox(i % 100 * 10, i / 100 * 10, 5, 5); };
+
+    Versioned tree;
+    const auto empty = tree.snapshot();
+    for (int i = 0; i < 500; i++) {
+        tree.insert(boxOf(i), i);
+    }
+    const auto before = tree.snapshot();
+    for (int i = 0; i < 250; i++) {
+        tree.remove(i);
+    }
+    tree.write([&](auto& t) {
+        for (int i = 500; i < 700; i++) {
+            t.insert(boxOf(i), i);
+        }
+    });
+
+    // Snapshots keep seeing the versions they pinned
+    BOOST_CHECK(empty.empty());
+    const auto beforeIds = idsOf(before.find(all));
+    BOOST_CHECK_EQUAL(beforeIds.size(), 500);
+    BOOST_CHECK_EQUAL(*beforeIds.begin(), 0);
+    BOOST_CHECK_EQUAL(*beforeIds.rbegin(), 499);
+    std::set<int> current;
+    tree.write([&](const auto& t) { current = idsOf(t.find(all)); });
+    BOOST_CHECK_EQUAL(current.size(), 450);
+    BOOST_CHECK(idsOf(tree.snapshot().find(all)) == current);
+    BOOST_CHECK_EQUAL(tree.snapshot().find(boxOf(300)).size(), 1);
+
+    // Readers see either both entries of a pair or none of them, while a writer keeps replacing pairs
+    std::atomic<bool> done { false };
+    std::atomic<size_t> brokenPairs { 0 };
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; r++) {
+        readers.emplace_back([&]() {
+            while (!done) {
+                const auto snapshot = tree.snapshot();
+                const auto ids = idsOf(snapshot.find(all));
+                for (const auto id: ids) {
+                    if (id >= 1000 && !ids.count(id ^ 1)) {
+                        brokenPairs++;
+                    }
+                }
+            }
+        });
+    }
+    for (int k = 0; k < 1000; k++) {
+        tree.write([&](auto& t) {
+            t.insert(boxOf(k), 1000 + 2 * k);
+            t.insert(boxOf(k + 7), 1001 + 2 * k);
+            if (k >= 50) {
+                t.remove(900 + 2 * k);
+                t.remove(901 + 2 * k);
+            }
+        });
+    }
+    done = true;
+    for (auto& reader: readers) {
+        reader.join();
+    }
+    BOOST_CHECK_EQUAL(brokenPairs, 0);
+    BOOST_CHECK_EQUAL(tree.snapshot().find(all).size(), 450 + 100);
+}
+
+template<typename Tree>
+void checkConcurrentTree()
+{
+    constexpr int ThreadCount = 4;
+    constexpr int PerThread = 3000;
+    // Every thread works in its own band, a few of its entries reach into the neighbouring one
+    const auto boxOf = [](int id) {
+        const int band = id / PerThread;
+        const int i = id % PerThread;
+        return rtree::BoundingBox(band * 1000 + i % 60 * 15, i / 60 * 15, i % 11 == 0 ? 1200 : 10, 10);
+    };
+    const auto all = rtree::BoundingBox(-10, -10, 10000, 10000);
+
+    rtree::ConcurrentTree<Tree> tree;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < ThreadCount; t++) {
+        threads.emplace_back([&, t]() {
+            for (int id = t * PerThread; id < (t + 1) * PerThread; id++) {
+                tree.insert(boxOf(id), id);
+            }
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    threads.clear();
+    BOOST_CHECK_EQUAL(checkTree(tree.getTree()), ThreadCount * PerThread);
+    BOOST_CHECK_EQUAL(tree.find(all).size(), ThreadCount * PerThread);
+    BOOST_CHECK_THROW(tree.insert(boxOf(5), 5), rtree::DuplicateEntryException);
+
+    // Threads remove two thirds of their entries and insert new ones while others query
+    std::atomic<size_t> missing { 0 };
+    for (int t = 0; t < ThreadCount; t++) {
+        threads.emplace_back([&, t]() {
+            for (int id = t * PerThread; id < (t + 1) * PerThread; id++) {
+                if (id % 3 != 0) {
+                    tree.remove(id);
+                }
+                if (id % 5 == 0) {
+                    tree.insert(boxOf(id), ThreadCount * PerThread + id);
+                }
+                // Entries that are never removed are always found
+                const auto kept = t * PerThread + (id * 7 % PerThread) / 3 * 3;
+                const auto found = tree.find(boxOf(kept));
+                if (std::none_of(found.begin(), found.end(), [kept](const auto& entry) { return entry.data == kept; })) {
+                    missing++;
+                }
+            }
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    BOOST_CHECK_EQUAL(missing, 0);
+    const size_t expected = ThreadCount * PerThread / 3 + ThreadCount * PerThread / 5;
+    BOOST_CHECK_EQUAL(checkTree(tree.getTree()), expected);
+    BOOST_CHECK_EQUAL(tree.find(all).size(), expected);
+
+    for (int id = 0; id < ThreadCount * PerThread * 2; id++) {
+        tree.remove(id);
+    }
+    BOOST_CHECK(tree.getTree().empty());
+    tree.insert(boxOf(1), 1);
+    BOOST_CHECK_EQUAL(tree.find(all).size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_tree)
+{
+    checkConcurrentTree<rtree::Tree<int, rtree::LinearSplit, 12, 4>>();
+    checkConcurrentTree<rtree::Tree<int, rtree::QuadraticSplit, 8, 3>>();
+    checkConcurrentTree<rtree::Tree<int, rtree::RStarSplit, 16, 6>>();
+}
+
+BOOST_AUTO_TEST_CASE(mapped_tree)
+{
+    const auto path = (std::filesystem::temp_directory_path() / "rtree_mapped_test.bin").string();
+
+    rtree::Tree<int> tree;
+    for (int i = 0; i < 3000; i++) {
+        tree.insert(rtree::BoundingBox(i * 37 % 1000, i * 91 % 1000, i % 7 + 1, i % 5 + 1), i);
+    }
+    rtree::freeze(tree, path);
+    const rtree::MappedTree<int> mapped(path);
+    BOOST_CHECK_EQUAL(mapped.size(), 3000);
+    for (const auto& window: comparedWindows) {
+        BOOST_CHECK(idsOf(mapped.find(window)) == idsOf(tree.find(window)));
+    }
+    size_t visited = 0;
+    BOOST_CHECK(!mapped.query(rtree::BoundingBox(0, 0, 1000, 1000), [&visited](const auto&) { return ++visited < 10; }));
+    BOOST_CHECK_EQUAL(visited, 10);
+    for (const rtree::Point p: { rtree::Point{ 500, 500 }, rtree::Point{ -100, 30 } }) {
+        const auto expected = tree.nearest(p, 20);
+        const auto found = mapped.nearest(p, 20);
+        BOOST_REQUIRE_EQUAL(found.size(), expected.size());
+        for (size_t i = 0; i < found.size(); i++) {
+            BOOST_CHECK_EQUAL(found[i].box.squaredDistance(p), expected[i].box.squaredDistance(p));
+        }
+    }
+
+    // Files are checked against the types they are opened with
+    using WrongCoord = rtree::MappedTree<int, float>;
+    BOOST_CHECK_THROW(WrongCoord{ path }, std::runtime_error);
+    BOOST_CHECK_THROW(rtree::MappedTree<int>(path + ".missing"), std::runtime_error);
+
+    // Truncated files are rejected on opening, corrupted nodes when queries reach them
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) / 2);
+    BOOST_CHECK_THROW(rtree::MappedTree<int>{ path }, std::runtime_error);
+    rtree::freeze(tree, path);
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        rtree::MappedHeader header;
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        rtree::MappedNode<double> root;
+        file.seekg(header.nodesOffset);
+        file.read(reinterpret_cast<char*>(&root), sizeof(root));
+        root.count = header.nodeCount;
+        file.seekp(header.nodesOffset);
+        file.write(reinterpret_cast<const char*>(&root), sizeof(root));
+    }
+    const rtree::MappedTree<int> corrupted(path);
+    BOOST_CHECK_THROW(corrupted.find(rtree::BoundingBox(0, 0, 1000, 1000)), std::runtime_error);
+    BOOST_CHECK_THROW(corrupted.nearest(rtree::Point{ 500, 500 }, 5), std::runtime_error);
+
+    rtree::Tree<std::int64_t, rtree::QuadraticSplit, 8, 3, std::int32_t> small;
+    rtree::freeze(small, path);
+    BOOST_CHECK((rtree::MappedTree<std::int64_t, std::int32_t>(path).find(rtree::BasicBoundingBox<std::int32_t>(0, 0, 10, 10)).empty()));
+    small.insert(rtree::BasicBoundingBox<std::int32_t>(1, 1, 2, 2), 7);
+    rtree::freeze(small, path);
+    const auto found = rtree::MappedTree<std::int64_t, std::int32_t>(path).find(rtree::BasicBoundingBox<std::int32_t>(0, 0, 10, 10));
+    BOOST_REQUIRE_EQUAL(found.size(), 1);
+    BOOST_CHECK_EQUAL(found.front().data, 7);
+    std::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(paged_tree)
+{
+    const auto path = (std::filesystem::temp_directory_path() / "rtree_paged_test.bin").string();
+    std::filesystem::remove(path);
+    const auto boxOf = [](int i) { return rtree::BoundingBox(i * 37 % 1000, i * 91 % 1000, i % 7 + 1, i % 5 + 1); };
+
+    rtree::Tree<int> tree;
+    {
+        // Small pages and a buffer of a few of them make the tree much bigger than the buffer
+        rtree::PagedTree<int, rtree::QuadraticSplit> paged(path, 16 * 512, 512);
+        for (int i = 0; i < 5000; i++) {
+            tree.insert(boxOf(i), i);
+            paged.insert(boxOf(i), i);
+        }
+        BOOST_CHECK_EQUAL(paged.size(), 5000);
+        BOOST_CHECK_GT(paged.getHeight(), 2);
+        for (const auto& window: comparedWindows) {
+            BOOST_CHECK(idsOf(paged.find(window)) == idsOf(tree.find(window)));
+        }
+        BOOST_CHECK_GT(paged.getStats().hits, 0);
+        BOOST_CHECK_GT(paged.getStats().misses, 0);
+        BOOST_CHECK_GT(paged.getStats().writes, 0);
+
+        for (int i = 0; i < 5000; i += 3) {
+            BOOST_CHECK(paged.remove(boxOf(i), i));
+            tree.remove(i);
+        }
+        BOOST_CHECK(!paged.remove(boxOf(0), 0));
+        BOOST_CHECK(!paged.remove(boxOf(1), 2));
+        BOOST_CHECK_EQUAL(paged.size(), 3333);
+    }
+
+    // Reopened file holds the same tree, pages freed by removal are reused
+    const auto fileSize = std::filesystem::file_size(path);
+    {
+        rtree::PagedTree<int, rtree::QuadraticSplit> paged(path, 16 * 512, 512);
+        BOOST_CHECK_EQUAL(paged.size(), 3333);
+        for (const auto& window: comparedWindows) {
+            BOOST_CHECK(idsOf(paged.find(window)) == idsOf(tree.find(window)));
+        }
+        for (int i = 0; i < 5000; i += 3) {
+            paged.insert(boxOf(i), i);
+            tree.insert(boxOf(i), i);
+        }
+        for (const auto& window: comparedWindows) {
+            BOOST_CHECK(idsOf(paged.find(window)) == idsOf(tree.find(window)));
+        }
+        size_t visited = 0;
+        BOOST_CHECK(!paged.query(rtree::BoundingBox(0, 0, 1000, 1000), [&visited](const auto&) { return ++visited < 10; }));
+        BOOST_CHECK_EQUAL(visited, 10);
+        for (int i = 0; i < 5000; i++) {
+            BOOST_CHECK(paged.remove(boxOf(i), i));
+        }
+        BOOST_CHECK(paged.empty());
+        BOOST_CHECK(paged.find(rtree::BoundingBox(-50, -50, 2000, 2000)).empty());
+    }
+    BOOST_CHECK_LE(std::filesystem::file_size(path), fileSize * 3 / 2);
+
+    // Files are checked against the types and page size they are opened with
+    using WrongCoord = rtree::PagedTree<int, rtree::LinearSplit, float>;
+    BOOST_CHECK_THROW(WrongCoord(path, 16 * 512, 512), std::runtime_error);
+    BOOST_CHECK_THROW((rtree::PagedTree<int>(path, 16 * 4096)), std::runtime_error);
+    BOOST_CHECK_THROW((rtree::PagedTree<int>(path, 4096, 512)), std::invalid_argument);
+    BOOST_CHECK_THROW((rtree::PagedTree<int>(path, 4096, 0)), std::invalid_argument);
+    BOOST_CHECK_THROW((rtree::PagedTree<int>(path, 4096, 1)), std::invalid_argument);
+    std::filesystem::remove(path);
+
+    {
+        rtree::PagedTree<int> linear(path, 64 * 1024);
+        for (int i = 0; i < 5000; i++) {
+            linear.insert(boxOf(i), i);
+        }
+        for (const auto& window: comparedWindows) {
+            BOOST_CHECK(idsOf(linear.find(window)) == idsOf(tree.find(window)));
+        }
+    }
+    std::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(paged_bulk_load)
+{
+    const auto path = (std::filesystem::temp_directory_path() / "rtree_paged_bulk_test.bin").string();
+    std::filesystem::remove(path);
+    std::vector<rtree::Entry<int>> entries;
+    for (int i = 0; i < 20000; i++) {
+        entries.push_back({ rtree::BoundingBox(i * 37 % 1000, i * 91 % 1000, i % 7 + 1, i % 5 + 1), i });
+    }
+    const rtree::Tree<int> tree(entries.begin(), entries.end());
+
+    const auto check = [&](auto& paged) {
+        BOOST_CHECK_EQUAL(paged.size(), entries.size());
+        for (const auto& window: comparedWindows) {
+            BOOST_CHECK(idsOf(paged.find(window)) == idsOf(tree.find(window)));
+        }
+    };
+    {
+        // Memory for a few thousand entries makes many runs merged in several passes
+        rtree::PagedTree<int> paged(path, 16 * 4096);
+        paged.bulkLoad(entries.begin(), entries.end(), 64 * 1024);
+        check(paged);
+        // Leaves are packed full: 20000 entries in pages of 102 take three levels
+        BOOST_CHECK_EQUAL(paged.getHeight(), 3);
+
+        paged.bulkLoad<rtree::HilbertPacking>(entries.begin(), entries.end(), 64 * 1024);
+        check(paged);
+        paged.insert(rtree::BoundingBox(5000, 5000, 1, 1), -1);
+        BOOST_CHECK_EQUAL(paged.find(rtree::BoundingBox(4999, 4999, 2, 2)).size(), 1);
+        BOOST_CHECK(paged.remove(rtree::BoundingBox(5000, 5000, 1, 1), -1));
+
+        // Everything fits into memory and no temporary files are needed
+        paged.bulkLoad(entries.begin(), entries.end(), 16 * 1024 * 1024);
+        check(paged);
+    }
+    // Runs share one file, so the number of open files doesn't grow with the input
+    {
+        const auto openFiles = []() {
+            return std::distance(std::filesystem::directory_iterator("/proc/self/fd"), std::filesystem::directory_iterator());
+        };
+        const auto before = openFiles();
+        rtree::TempFile input(std::filesystem::temp_directory_path().string());
+        for (std::uint64_t i = 0; i < 200000; i++) {
+            const auto value = i * 7919 % 200000;
+            input.write(&value, 1);
+        }
+        std::uint64_t expected = 0;
+        bool sorted = true;
+        rtree::externalSort<std::uint64_t>(input, [](std::uint64_t value) { return value; }, 16 * 1024,
+            std::filesystem::temp_directory_path().string(), [&](std::uint64_t value) {
+                sorted = sorted && value == expected++;
+                if (expected % 10000 == 0) {
+                    BOOST_CHECK_LE(openFiles(), before + 4);
+                }
+            });
+        BOOST_CHECK(sorted);
+        BOOST_CHECK_EQUAL(expected, 200000);
+    }
+    // Pages of replaced trees are reused
+    BOOST_CHECK_LE(std::filesystem::file_size(path), 3 * 4096 * (entries.size() / 102));
+    {
+        rtree::PagedTree<int> paged(path, 16 * 4096);
+        check(paged);
+        paged.bulkLoad(entries.end(), entries.end(), 64 * 1024);
+        BOOST_CHECK(paged.empty());
+        BOOST_CHECK(paged.find(rtree::BoundingBox(-50, -50, 2000, 2000)).empty());
+    }
+    std::filesystem::remove(path);
+}
+
 BOOST_AUTO_TEST_SUITE_END()